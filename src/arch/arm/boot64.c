@@ -77,6 +77,14 @@ static void *get_kernel_reloc_addr(Arm64KernelHeader *header, size_t image_size)
 	return 0;
 }
 
+/* Output handed to cache maintenance at a time while decompressing. */
+#define KERNEL_DECOMPRESS_CHUNK	(1 * MiB)
+
+static void kernel_chunk_loaded(void *data, size_t size)
+{
+	arch_program_segment_loaded(data, size);
+}
+
 int boot_arm_linux(void *fdt, FitImageNode *kernel)
 {
 	size_t image_size = 64*MiB;	// default value for pre-3.17 headers
@@ -89,9 +97,12 @@ int boot_arm_linux(void *fdt, FitImageNode *kernel)
 		u32 canary;
 	} scratch;
 
+	FitDecompressor decomp;
+
 	// Partially decompress to get text_offset. Can't check for errors.
+	timestamp_add_now(TS_KERNEL_HEADER_PEEK);
 	scratch.canary = SCRATCH_CANARY_VALUE;
-	fit_decompress(kernel, scratch.raw, sizeof(scratch.raw));
+	fit_decompress_peek(&decomp, kernel, scratch.raw, sizeof(scratch.raw));
 
 	// Should never happen, but if it does we'll want to know.
 	if (scratch.canary != SCRATCH_CANARY_VALUE) {
@@ -116,7 +127,12 @@ int boot_arm_linux(void *fdt, FitImageNode *kernel)
 
 	timestamp_add_now(TS_KERNEL_DECOMPRESSION);
 
-	size_t true_size = fit_decompress(kernel, reloc_addr, image_size);
+	/* Flush dcache and icache to make loaded code visible, piece by
+	 * piece while the data is still hot in the cache. */
+	size_t true_size = fit_decompress_resume(&decomp, reloc_addr,
+						 image_size,
+						 KERNEL_DECOMPRESS_CHUNK,
+						 &kernel_chunk_loaded);
 	if (!true_size) {
 		printf("ERROR: Kernel decompression failed!\n");
 		return 1;
@@ -126,9 +142,6 @@ int boot_arm_linux(void *fdt, FitImageNode *kernel)
 
 	timestamp_add_now(TS_START_KERNEL);
 
-	/* Flush dcache and icache to make loaded code visible. */
-	arch_program_segment_loaded(reloc_addr, true_size);
-
 	tlb_invalidate_all();
 	mmu_disable();
 
@@ -107,7 +107,7 @@ int boot(struct boot_info *bi)
 	}
 
 	// Reserve the spot the device tree will go.
-	DeviceTreeReserveMapEntry *entry = xzalloc(sizeof(*entry));
+	DeviceTreeReserveMapEntry *entry = dt_alloc(sizeof(*entry));
 	entry->start = (uintptr_t)fdt;
 	entry->size = size;
 	list_insert_after(&entry->list_node, &tree->reserve_map);
@@ -0,0 +1,191 @@
+/*
+ * Copyright 2021 Google Inc.
+ *
+ * See file CREDITS for list of people who contributed to this
+ * project.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but without any warranty; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <arch/cache.h>
+#include <libpayload.h>
+
+#include "base/parallel.h"
+#include "drivers/power/psci.h"
+
+#define SECONDARY_STACK_SIZE	(16 * KiB)
+#define MPIDR_AFF_MASK		0xff00ffffffULL
+
+/* Read by secondary_entry64 with the MMU off, keep in sync with it. */
+typedef struct {
+	uint64_t stack_top;
+	uint64_t mair;
+	uint64_t tcr;
+	uint64_t ttbr0;
+	uint64_t sctlr;
+	uint64_t vbar;
+	uint64_t entry;
+} SecondaryCpu;
+
+typedef struct {
+	SecondaryCpu boot;
+	uint64_t mpidr;
+	void *stack;
+	int started;
+} ParallelCpu;
+
+extern void secondary_entry64(void);
+
+static ParallelCpu *cpus;
+static int num_cpus;
+static void (*secondary_work)(void);
+
+#define READ_SYSREG(reg, el) ({						\
+	uint64_t __val;							\
+	if (el == 2)							\
+		asm volatile("mrs %0, " #reg "_el2" : "=r" (__val));	\
+	else								\
+		asm volatile("mrs %0, " #reg "_el1" : "=r" (__val));	\
+	__val;								\
+})
+
+static uint64_t read_mpidr(void)
+{
+	uint64_t mpidr;
+
+	asm volatile("mrs %0, mpidr_el1" : "=r" (mpidr));
+	return mpidr & MPIDR_AFF_MASK;
+}
+
+static int current_el(void)
+{
+	uint64_t el;
+
+	asm volatile("mrs %0, CurrentEL" : "=r" (el));
+	return (el >> 2) & 3;
+}
+
+static void secondary_main(void)
+{
+	secondary_work();
+	psci_cpu_off();
+}
+
+void arch_parallel_add_cpu(uint64_t mpidr)
+{
+	mpidr &= MPIDR_AFF_MASK;
+	if (mpidr == read_mpidr() || num_cpus == CONFIG_PARALLEL_CPUS)
+		return;
+	for (int i = 0; i < num_cpus; i++)
+		if (cpus[i].mpidr == mpidr)
+			return;
+
+	if (!cpus)
+		cpus = xzalloc(CONFIG_PARALLEL_CPUS * sizeof(*cpus));
+	cpus[num_cpus++].mpidr = mpidr;
+}
+
+void arch_parallel_add_dt_cpus(DeviceTree *tree)
+{
+	u32 addr_cells = 1;
+	DeviceTreeNode *cpus_node = dt_find_node_by_path(tree, "cpus",
+							 &addr_cells, NULL, 0);
+	DeviceTreeNode *node;
+	int known = num_cpus;
+
+	if (!cpus_node || !CONFIG_PARALLEL_CPUS)
+		return;
+
+	list_for_each(node, cpus_node->children, list_node) {
+		const char *type = dt_find_string_prop(node, "device_type");
+		const char *method = dt_find_string_prop(node,
+							 "enable-method");
+		const char *status = dt_find_string_prop(node, "status");
+		void *reg;
+		size_t size;
+
+		if (!type || strcmp(type, "cpu") || !method ||
+		    strcmp(method, "psci"))
+			continue;
+		if (status && strcmp(status, "okay") && strcmp(status, "ok"))
+			continue;
+
+		dt_find_bin_prop(node, "reg", &reg, &size);
+		if (!reg || size < addr_cells * sizeof(u32))
+			continue;
+
+		uint64_t mpidr = betohl(((u32 *)reg)[0]);
+		if (addr_cells == 2)
+			mpidr = mpidr << 32 | betohl(((u32 *)reg)[1]);
+		arch_parallel_add_cpu(mpidr);
+	}
+
+	if (num_cpus != known)
+		printf("Using %d secondary CPUs for parallel work.\n",
+		       num_cpus);
+}
+
+int arch_parallel_cpus(void)
+{
+	return num_cpus;
+}
+
+int arch_parallel_start(void (*entry)(void), int max)
+{
+	int el = current_el();
+	int started = 0;
+
+	secondary_work = entry;
+
+	for (int i = 0; i < MIN(max, num_cpus); i++) {
+		ParallelCpu *cpu = &cpus[i];
+
+		if (!cpu->stack)
+			cpu->stack = xmemalign(16, SECONDARY_STACK_SIZE);
+		cpu->boot.stack_top = (uintptr_t)cpu->stack +
+				      SECONDARY_STACK_SIZE;
+		cpu->boot.mair = READ_SYSREG(mair, el);
+		cpu->boot.tcr = READ_SYSREG(tcr, el);
+		cpu->boot.ttbr0 = READ_SYSREG(ttbr0, el);
+		cpu->boot.sctlr = READ_SYSREG(sctlr, el);
+		cpu->boot.vbar = READ_SYSREG(vbar, el);
+		cpu->boot.entry = (uintptr_t)&secondary_main;
+		/* The CPU reads this before its caches are on. */
+		dcache_clean_by_mva(&cpu->boot, sizeof(cpu->boot));
+
+		cpu->started = psci_cpu_on(cpu->mpidr,
+					   (uintptr_t)&secondary_entry64,
+					   (uintptr_t)&cpu->boot) ==
+			       PSCI_RET_SUCCESS;
+		started += cpu->started;
+	}
+
+	return started;
+}
+
+void arch_parallel_stop(void)
+{
+	for (int i = 0; i < num_cpus; i++) {
+		ParallelCpu *cpu = &cpus[i];
+		uint64_t start = timer_us(0);
+
+		if (!cpu->started)
+			continue;
+		while (psci_affinity_info(cpu->mpidr) != PSCI_AFFINITY_OFF) {
+			if (timer_us(start) > USECS_PER_SEC) {
+				printf("WARNING: CPU %#llx didn't power off\n",
+				       cpu->mpidr);
+				break;
+			}
+		}
+		cpu->started = 0;
+	}
+}
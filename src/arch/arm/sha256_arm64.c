@@ -0,0 +1,59 @@
+/*
+ * Copyright 2021 Google Inc.
+ *
+ * See file CREDITS for list of people who contributed to this
+ * project.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but without any warranty; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <libpayload.h>
+
+#include "base/sha256.h"
+
+#define ID_AA64ISAR0_SHA2_SHIFT	12
+#define ID_AA64ISAR0_SHA2_MASK	0xf
+#define CPACR_EL1_FPEN		(3 << 20)
+#define CPTR_EL2_TFP		(1 << 10)
+
+extern void sha256_blocks_ce(uint32_t state[8], const uint8_t *data,
+			     size_t blocks);
+
+/* The SHA instructions use the SIMD registers, make sure they don't trap. */
+static void enable_simd(void)
+{
+	uint64_t el, reg;
+
+	asm volatile("mrs %0, CurrentEL" : "=r" (el));
+	if (((el >> 2) & 3) == 2) {
+		asm volatile("mrs %0, cptr_el2" : "=r" (reg));
+		if (reg & CPTR_EL2_TFP)
+			asm volatile("msr cptr_el2, %0\n\tisb"
+				     : : "r" (reg & ~CPTR_EL2_TFP));
+	} else {
+		asm volatile("mrs %0, cpacr_el1" : "=r" (reg));
+		if ((reg & CPACR_EL1_FPEN) != CPACR_EL1_FPEN)
+			asm volatile("msr cpacr_el1, %0\n\tisb"
+				     : : "r" (reg | CPACR_EL1_FPEN));
+	}
+}
+
+Sha256BlocksFunc arch_sha256_blocks(void)
+{
+	uint64_t isar0;
+
+	asm volatile("mrs %0, id_aa64isar0_el1" : "=r" (isar0));
+	if (!((isar0 >> ID_AA64ISAR0_SHA2_SHIFT) & ID_AA64ISAR0_SHA2_MASK))
+		return NULL;
+
+	enable_simd();
+	return &sha256_blocks_ce;
+}
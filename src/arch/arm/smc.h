@@ -22,6 +22,9 @@
 
 // From ARM PSCI specification (ARM DEN 0022C). Expand as needed.
 enum psci_function_id {
+	PSCI_CPU_OFF = 0x84000002,
+	PSCI_CPU_ON = 0xC4000003,
+	PSCI_AFFINITY_INFO = 0xC4000004,
 	PSCI_SYSTEM_OFF = 0x84000008,
 	PSCI_SYSTEM_RESET = 0x84000009,
 };
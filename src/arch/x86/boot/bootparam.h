@@ -65,6 +65,8 @@ struct setup_header {
 	uint32_t payload_offset;
 	uint32_t payload_length;
 	uint64_t setup_data;
+	uint64_t pref_address;
+	uint32_t init_size;
 } __attribute__((packed));
 
 struct sys_desc_table {
@@ -0,0 +1,146 @@
+/*
+ * Copyright 2021 Google Inc.
+ *
+ * See file CREDITS for list of people who contributed to this
+ * project.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but without any warranty; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <cpuid.h>
+#include <immintrin.h>
+#include <libpayload.h>
+
+#include "base/sha256.h"
+
+#define CPUID1_ECX_SSSE3	(1 << 9)
+#define CPUID1_ECX_SSE41	(1 << 19)
+#define CPUID7_EBX_SHA		(1 << 29)
+#define CR4_OSFXSR		(1 << 9)
+
+static const uint32_t sha256_k[64] __attribute__((aligned(16))) = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+/*
+ * Four rounds with message words msg (already byte swapped). sha256rnds2
+ * does two rounds per instruction, taking the two round constants plus
+ * message words in the low half of xmm0.
+ */
+#define ROUNDS4(state0, state1, msg, i) do {				\
+	__m128i __wk = _mm_add_epi32(msg,				\
+		_mm_load_si128((const __m128i *)&sha256_k[(i) * 4]));	\
+	state1 = _mm_sha256rnds2_epu32(state1, state0, __wk);		\
+	__wk = _mm_shuffle_epi32(__wk, 0x0e);				\
+	state0 = _mm_sha256rnds2_epu32(state0, state1, __wk);		\
+} while (0)
+
+/* Message schedule: w[i..i+3] from the previous sixteen words. */
+#define SCHEDULE(m0, m1, m2, m3) do {					\
+	m0 = _mm_sha256msg1_epu32(m0, m1);				\
+	m0 = _mm_add_epi32(m0, _mm_alignr_epi8(m3, m2, 4));		\
+	m0 = _mm_sha256msg2_epu32(m0, m3);				\
+} while (0)
+
+__attribute__((target("sha,sse4.1")))
+static void sha256_blocks_shani(uint32_t state[8], const uint8_t *data,
+				size_t blocks)
+{
+	const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+					     0x0405060700010203ULL);
+	__m128i state0, state1, tmp;
+
+	/* Reorder a..h into the ABEF/CDGH halves sha256rnds2 works on. */
+	tmp = _mm_loadu_si128((const __m128i *)&state[0]);	/* DCBA */
+	state1 = _mm_loadu_si128((const __m128i *)&state[4]);	/* HGFE */
+	tmp = _mm_shuffle_epi32(tmp, 0xb1);			/* CDAB */
+	state1 = _mm_shuffle_epi32(state1, 0x1b);		/* EFGH */
+	state0 = _mm_alignr_epi8(tmp, state1, 8);		/* ABEF */
+	state1 = _mm_blend_epi16(state1, tmp, 0xf0);		/* CDGH */
+
+	for (; blocks; blocks--, data += SHA256_BLOCK_SIZE) {
+		const __m128i *in = (const __m128i *)data;
+		__m128i save0 = state0, save1 = state1;
+		__m128i m0, m1, m2, m3;
+
+		m0 = _mm_shuffle_epi8(_mm_loadu_si128(in + 0), bswap);
+		m1 = _mm_shuffle_epi8(_mm_loadu_si128(in + 1), bswap);
+		m2 = _mm_shuffle_epi8(_mm_loadu_si128(in + 2), bswap);
+		m3 = _mm_shuffle_epi8(_mm_loadu_si128(in + 3), bswap);
+
+		ROUNDS4(state0, state1, m0, 0);
+		ROUNDS4(state0, state1, m1, 1);
+		ROUNDS4(state0, state1, m2, 2);
+		ROUNDS4(state0, state1, m3, 3);
+		for (int i = 4; i < 16; i += 4) {
+			SCHEDULE(m0, m1, m2, m3);
+			ROUNDS4(state0, state1, m0, i);
+			SCHEDULE(m1, m2, m3, m0);
+			ROUNDS4(state0, state1, m1, i + 1);
+			SCHEDULE(m2, m3, m0, m1);
+			ROUNDS4(state0, state1, m2, i + 2);
+			SCHEDULE(m3, m0, m1, m2);
+			ROUNDS4(state0, state1, m3, i + 3);
+		}
+
+		state0 = _mm_add_epi32(state0, save0);
+		state1 = _mm_add_epi32(state1, save1);
+	}
+
+	tmp = _mm_shuffle_epi32(state0, 0x1b);			/* FEBA */
+	state1 = _mm_shuffle_epi32(state1, 0xb1);		/* DCHG */
+	state0 = _mm_blend_epi16(tmp, state1, 0xf0);		/* DCBA */
+	state1 = _mm_alignr_epi8(state1, tmp, 8);		/* HGFE */
+	_mm_storeu_si128((__m128i *)&state[0], state0);
+	_mm_storeu_si128((__m128i *)&state[4], state1);
+}
+
+static unsigned long read_cr4(void)
+{
+	unsigned long cr4;
+
+	asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+	return cr4;
+}
+
+Sha256BlocksFunc arch_sha256_blocks(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return NULL;
+	if ((ecx & (CPUID1_ECX_SSSE3 | CPUID1_ECX_SSE41)) !=
+	    (CPUID1_ECX_SSSE3 | CPUID1_ECX_SSE41))
+		return NULL;
+	if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) ||
+	    !(ebx & CPUID7_EBX_SHA))
+		return NULL;
+	/* SSE instructions fault unless coreboot left them enabled. */
+	if (!(read_cr4() & CR4_OSFXSR))
+		return NULL;
+
+	return &sha256_blocks_shani;
+}
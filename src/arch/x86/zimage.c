@@ -25,6 +25,45 @@
 /* See "The Linux/x86 Boot Protocol" in kernel docs */
 #define INITRD_MAX_ADDRESS 0x37FFFFFF
 
+/* Kernels up to this version don't tell us how much memory they need. */
+#define BOOT_PROTOCOL_INIT_SIZE 0x020a
+
+/*
+ * Check whether the ramdisk can be at ramdisk: page aligned, below the limit,
+ * and clear of both the kernel image and the memory the kernel decompresses
+ * itself into. Older kernels don't say where that is, so they only get the
+ * ramdisk above the image, as before.
+ */
+static int ramdisk_fits(struct setup_header *header, struct boot_info *bi,
+			void *ramdisk, uint32_t initrd_addr_max)
+{
+	uintptr_t start = (uintptr_t)ramdisk;
+	uintptr_t end = start + bi->ramdisk_size;
+	uintptr_t kernel = (uintptr_t)bi->kernel;
+	uintptr_t kernel_end = kernel + (header->setup_sects + 1) * 512 +
+			       header->syssize * 16;
+
+	if (!IS_ALIGNED(start, 4096) || end - 1 > initrd_addr_max)
+		return 0;
+
+	if (header->version < BOOT_PROTOCOL_INIT_SIZE)
+		return start >= kernel_end;
+
+	if (start < kernel_end && end > kernel)
+		return 0;
+
+	/*
+	 * A relocatable kernel runs at its load address rounded up to its
+	 * alignment, but never below its preferred address.
+	 */
+	uint64_t run = header->pref_address;
+	if (header->relocatable_kernel && header->kernel_alignment) {
+		uint64_t aligned = ALIGN_UP(kernel, header->kernel_alignment);
+		run = MAX(run, aligned);
+	}
+	return end <= run || start >= run + header->init_size;
+}
+
 int boot(struct boot_info *bi)
 {
 	/*
@@ -55,18 +94,25 @@ int boot(struct boot_info *bi)
 			if (initrd_addr_max > INITRD_MAX_ADDRESS)
 				initrd_addr_max = INITRD_MAX_ADDRESS;
 
-			void *ramdisk = (void*)ALIGN_DOWN(
-				initrd_addr_max - bi->ramdisk_size, 4096);
+			// Leave it where it was loaded if that's safe.
+			void *ramdisk = bi->ramdisk_addr;
 
-			unsigned long kernel_size = header->syssize * 16;
+			if (header->version < BOOT_PROTOCOL_INIT_SIZE ||
+			    !ramdisk_fits(header, bi, ramdisk,
+					  initrd_addr_max)) {
+				ramdisk = (void*)ALIGN_DOWN(
+					initrd_addr_max - bi->ramdisk_size,
+					4096);
 
-			if (((uintptr_t)bi->kernel + kernel_size) >
-			    (uintptr_t)ramdisk) {
-				printf("Not enough space for initrd\n");
-				return -1;
-			}
+				if (!ramdisk_fits(header, bi, ramdisk,
+						  initrd_addr_max)) {
+					printf("Not enough space for initrd\n");
+					return -1;
+				}
 
-			memcpy(ramdisk, bi->ramdisk_addr, bi->ramdisk_size);
+				memcpy(ramdisk, bi->ramdisk_addr,
+				       bi->ramdisk_size);
+			}
 			header->ramdisk_image = (uintptr_t)ramdisk;
 			header->ramdisk_size = bi->ramdisk_size;
 		}
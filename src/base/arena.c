@@ -0,0 +1,85 @@
+/*
+ * Copyright 2021 Google Inc.
+ *
+ * See file CREDITS for list of people who contributed to this
+ * project.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but without any warranty; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <libpayload.h>
+
+#include "base/arena.h"
+
+/* Large enough that even big device trees only need a few slabs. */
+#define ARENA_SLAB_SIZE	(64 * KiB)
+#define ARENA_ALIGN	sizeof(uint64_t)
+
+static ArenaSlab *arena_new_slab(Arena *arena, size_t size)
+{
+	ArenaSlab **link = &arena->spare;
+	ArenaSlab *slab;
+
+	// Reuse a spare slab if one is big enough, most of them will be.
+	for (slab = arena->spare; slab; link = &slab->next, slab = slab->next)
+		if (slab->size >= size)
+			break;
+
+	if (slab) {
+		*link = slab->next;
+	} else {
+		size = MAX(size, ARENA_SLAB_SIZE);
+		slab = xmalloc(ALIGN_UP(sizeof(*slab), ARENA_ALIGN) + size);
+		slab->size = size;
+	}
+
+	slab->used = 0;
+	slab->next = arena->slabs;
+	arena->slabs = slab;
+	if (!arena->oldest)
+		arena->oldest = slab;
+	return slab;
+}
+
+void *arena_alloc(Arena *arena, size_t size)
+{
+	ArenaSlab *slab = arena->slabs;
+
+	size = ALIGN_UP(size, ARENA_ALIGN);
+	if (!slab || slab->size - slab->used < size)
+		slab = arena_new_slab(arena, size);
+
+	uint8_t *ptr = (uint8_t *)slab + ALIGN_UP(sizeof(*slab), ARENA_ALIGN) +
+		       slab->used;
+	slab->used += size;
+	memset(ptr, 0, size);
+	return ptr;
+}
+
+char *arena_strdup(Arena *arena, const char *str)
+{
+	size_t len = strlen(str) + 1;
+	char *copy = arena_alloc(arena, len);
+
+	memcpy(copy, str, len);
+	return copy;
+}
+
+void arena_reset(Arena *arena)
+{
+	if (!arena->slabs)
+		return;
+
+	arena->oldest->next = arena->spare;
+	arena->spare = arena->slabs;
+	arena->slabs = NULL;
+	arena->oldest = NULL;
+}
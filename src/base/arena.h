@@ -0,0 +1,66 @@
+/*
+ * Copyright 2021 Google Inc.
+ *
+ * See file CREDITS for list of people who contributed to this
+ * project.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but without any warranty; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __BASE_ARENA_H__
+#define __BASE_ARENA_H__
+
+#include <stddef.h>
+
+/* A chunk of heap memory that allocations are carved out of in order. */
+typedef struct ArenaSlab {
+	struct ArenaSlab *next;
+	size_t size;
+	size_t used;
+} ArenaSlab;
+
+/*
+ * A bump allocator for lots of small objects that all go away together.
+ * Memory is taken from the heap in big slabs, so the number of malloc()
+ * calls doesn't grow with the number of objects, and is only ever given
+ * back all at once. A zero-initialized Arena is ready to use.
+ */
+typedef struct Arena {
+	ArenaSlab *slabs;	// in use, newest first
+	ArenaSlab *oldest;	// last slab in the slabs list
+	ArenaSlab *spare;	// kept from before the last reset
+} Arena;
+
+/*
+ * Allocates zeroed memory from the arena. Like xzalloc(), this never fails.
+ *
+ * @param arena		Arena to allocate from.
+ * @param size		Number of bytes needed.
+ */
+void *arena_alloc(Arena *arena, size_t size);
+
+/*
+ * Copies a string into the arena.
+ *
+ * @param arena		Arena to allocate from.
+ * @param str		String to copy.
+ */
+char *arena_strdup(Arena *arena, const char *str);
+
+/*
+ * Frees everything allocated from the arena in constant time. The slabs are
+ * kept for allocations that come after.
+ *
+ * @param arena		Arena to reset.
+ */
+void arena_reset(Arena *arena);
+
+#endif /* __BASE_ARENA_H__ */
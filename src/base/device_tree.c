@@ -20,6 +20,7 @@
 #include <libpayload.h>
 #include <stdint.h>
 
+#include "base/arena.h"
 #include "base/device_tree.h"
 
 /*
@@ -170,33 +171,109 @@ int fdt_skip_node(void *blob, uint32_t start_offset)
 	return offset - start_offset + sizeof(uint32_t);
 }
 
+uint32_t fdt_first_child(void *blob, uint32_t offset)
+{
+	int size = fdt_node_name(blob, offset, NULL);
+	if (!size)
+		return 0;
+	offset += size;
+
+	while ((size = fdt_next_property(blob, offset, NULL)))
+		offset += size;
+
+	return offset;
+}
+
+uint32_t fdt_find_child(void *blob, uint32_t offset, const char *name)
+{
+	const char *child_name;
+	int size;
+
+	offset = fdt_first_child(blob, offset);
+	if (!offset)
+		return 0;
+
+	while ((size = fdt_node_name(blob, offset, &child_name))) {
+		if (!strcmp(child_name, name))
+			return offset;
+		offset += fdt_skip_node(blob, offset);
+	}
+
+	return 0;
+}
+
+int fdt_find_prop(void *blob, uint32_t offset, const char *name,
+		  FdtProperty *prop)
+{
+	int size = fdt_node_name(blob, offset, NULL);
+	if (!size)
+		return -1;
+	offset += size;
+
+	while ((size = fdt_next_property(blob, offset, prop))) {
+		if (!strcmp(prop->name, name))
+			return 0;
+		offset += size;
+	}
+
+	prop->name = NULL;
+	return -1;
+}
+
+int fdt_check_header(void *blob)
+{
+	FdtHeader *header = (FdtHeader *)blob;
+
+	uint32_t magic = betohl(header->magic);
+	uint32_t version = betohl(header->version);
+	uint32_t last_comp_version = betohl(header->last_comp_version);
+
+	if (magic != FdtMagic) {
+		printf("Invalid device tree magic %#.8x!\n", magic);
+		return -1;
+	}
+	if (last_comp_version > FdtSupportedVersion) {
+		printf("Unsupported device tree version %u(>=%u)!\n",
+		       version, last_comp_version);
+		return -1;
+	}
+	if (version > FdtSupportedVersion)
+		printf("NOTE: FDT version %u too new, should add support!\n",
+		       version);
+
+	return 0;
+}
+
 
 
 /*
  * Functions to turn a flattened tree into an unflattened one.
  */
 
-static DeviceTreeNode node_cache[1000];
-static int node_counter = 0;
-static DeviceTreeProperty prop_cache[5000];
-static int prop_counter = 0;
-
 /*
  * Libpayload's malloc() has linear allocation complexity and goes completely
- * mental after a few thousand small requests. This little hack will absorb
- * the worst of it to avoid increasing boot time for no reason.
+ * mental after a few thousand small requests. Everything that belongs to the
+ * tree comes from an arena instead, which is freed in one go.
  */
+static Arena dt_arena;
+
+void *dt_alloc(size_t size)
+{
+	return arena_alloc(&dt_arena, size);
+}
+
+void dt_free_all(void)
+{
+	arena_reset(&dt_arena);
+}
+
 static DeviceTreeNode *alloc_node(void)
 {
-	if (node_counter >= ARRAY_SIZE(node_cache))
-		return xzalloc(sizeof(DeviceTreeNode));
-	return &node_cache[node_counter++];
+	return dt_alloc(sizeof(DeviceTreeNode));
 }
 static DeviceTreeProperty *alloc_prop(void)
 {
-	if (prop_counter >= ARRAY_SIZE(prop_cache))
-		return xzalloc(sizeof(DeviceTreeProperty));
-	return &prop_cache[prop_counter++];
+	return dt_alloc(sizeof(DeviceTreeProperty));
 }
 
 static int dt_prop_is_phandle(DeviceTreeProperty *prop)
@@ -262,7 +339,7 @@ static int fdt_unflatten_map_entry(void *blob, uint32_t offset,
 	if (!size)
 		return 0;
 
-	DeviceTreeReserveMapEntry *entry = xzalloc(sizeof(*entry));
+	DeviceTreeReserveMapEntry *entry = dt_alloc(sizeof(*entry));
 	*new_entry = entry;
 	entry->start = start;
 	entry->size = size;
@@ -272,26 +349,13 @@ static int fdt_unflatten_map_entry(void *blob, uint32_t offset,
 
 DeviceTree *fdt_unflatten(void *blob)
 {
-	DeviceTree *tree = xzalloc(sizeof(*tree));
 	FdtHeader *header = (FdtHeader *)blob;
-	tree->header = header;
-
-	uint32_t magic = betohl(header->magic);
-	uint32_t version = betohl(header->version);
-	uint32_t last_comp_version = betohl(header->last_comp_version);
 
-	if (magic != FdtMagic) {
-		printf("Invalid device tree magic %#.8x!\n", magic);
-		return NULL;
-	}
-	if (last_comp_version > FdtSupportedVersion) {
-		printf("Unsupported device tree version %u(>=%u)!\n",
-		       version, last_comp_version);
+	if (fdt_check_header(blob))
 		return NULL;
-	}
-	if (version > FdtSupportedVersion)
-		printf("NOTE: FDT version %u too new, should add support!\n",
-		       version);
+
+	DeviceTree *tree = dt_alloc(sizeof(*tree));
+	tree->header = header;
 
 	uint32_t struct_offset = betohl(header->structure_offset);
 	uint32_t strings_offset = betohl(header->strings_offset);
@@ -322,12 +386,193 @@ DeviceTree *fdt_unflatten(void *blob)
 
 
 
+/*
+ * Hash tables for looking up strings and numbers, allocated from the arena.
+ */
+
+typedef struct DtHashEntry
+{
+	struct DtHashEntry *next;
+	const char *key;	// NULL for entries keyed by a number
+	uint32_t hash;
+	void *value;
+} DtHashEntry;
+
+typedef struct DtHash
+{
+	DtHashEntry **buckets;
+	uint32_t mask;
+} DtHash;
+
+static uint32_t dt_hash_string(const char *str)
+{
+	uint32_t hash = 2166136261;	// FNV-1a
+
+	while (*str)
+		hash = (hash ^ (uint8_t)*str++) * 16777619;
+	return hash;
+}
+
+static DtHashEntry **dt_hash_bucket(DtHash *table, uint32_t hash)
+{
+	return &table->buckets[(hash * 2654435761U >> 7) & table->mask];
+}
+
+static void dt_hash_init(DtHash *table, uint32_t count)
+{
+	uint32_t size = 16;
+
+	while (size < count)
+		size *= 2;
+	table->buckets = dt_alloc(size * sizeof(*table->buckets));
+	table->mask = size - 1;
+}
+
+// Entries with the same key stay in the order they were added in.
+static void dt_hash_add(DtHash *table, const char *key, uint32_t hash,
+			void *value)
+{
+	DtHashEntry **link = dt_hash_bucket(table, hash);
+	DtHashEntry *entry = dt_alloc(sizeof(*entry));
+
+	entry->key = key;
+	entry->hash = hash;
+	entry->value = value;
+	while (*link)
+		link = &(*link)->next;
+	*link = entry;
+}
+
+static void *dt_hash_find(DtHash *table, const char *key, uint32_t hash)
+{
+	DtHashEntry *entry = *dt_hash_bucket(table, hash);
+
+	for (; entry; entry = entry->next)
+		if (entry->hash == hash &&
+		    (!key || (entry->key && !strcmp(entry->key, key))))
+			return entry->value;
+	return NULL;
+}
+
+
+
 /*
  * Functions to find the size of device tree would take if it was flattened.
+ *
+ * Most of a tree is usually still exactly what was unflattened from the
+ * original blob. Nodes whose properties and children still all point into
+ * the blob in their original order are copied over from it as a whole, and
+ * only the nodes around them are put together again. The original string
+ * table is kept as the start of the new one, so the property name offsets in
+ * those copies stay valid, and names that aren't in it yet are added once.
  */
 
-static void dt_flat_prop_size(DeviceTreeProperty *prop, uint32_t *struct_size,
-			      uint32_t *strings_size)
+typedef struct DtFlatState
+{
+	uint8_t *blob;
+	uint8_t *struct_start;
+	uint8_t *struct_end;
+	const char *strings;
+	uint32_t strings_size;	// of the original table
+
+	DtHash names;		// names added to the table, offset + 1
+	int names_ready;
+	uint32_t new_strings_size;
+} DtFlatState;
+
+static void dt_flat_state_init(DeviceTree *tree, DtFlatState *state)
+{
+	FdtHeader *header = tree->header;
+	uint8_t *blob = tree->header;
+
+	memset(state, 0, sizeof(*state));
+	state->blob = blob;
+	state->struct_start = blob + betohl(header->structure_offset);
+	state->struct_end = state->struct_start +
+			    betohl(header->structure_size);
+	state->strings = (char *)blob + betohl(header->strings_offset);
+	state->strings_size = betohl(header->strings_size);
+}
+
+// Return the offset of name in the new string table, adding it if needed.
+static uint32_t dt_flat_name_offset(DtFlatState *state, const char *name)
+{
+	if (name >= state->strings &&
+	    name < state->strings + state->strings_size)
+		return name - state->strings;
+
+	// Only hash the original names once they're needed for comparison.
+	if (!state->names_ready) {
+		dt_hash_init(&state->names, 256);
+		for (uint32_t offset = 0; offset < state->strings_size;
+		     offset += strlen(state->strings + offset) + 1) {
+			const char *str = state->strings + offset;
+			dt_hash_add(&state->names, str, dt_hash_string(str),
+				    (void *)(uintptr_t)(offset + 1));
+		}
+		state->names_ready = 1;
+	}
+
+	uint32_t hash = dt_hash_string(name);
+	uintptr_t found = (uintptr_t)dt_hash_find(&state->names, name, hash);
+	if (found)
+		return found - 1;
+
+	uint32_t offset = state->strings_size + state->new_strings_size;
+	dt_hash_add(&state->names, name, hash, (void *)(uintptr_t)(offset + 1));
+	state->new_strings_size += strlen(name) + 1;
+	return offset;
+}
+
+/*
+ * Return the size of the node's span in the original blob if neither the node
+ * nor anything below it has changed since it was unflattened, or 0. The
+ * children must have been checked already.
+ */
+static uint32_t dt_flat_clean_span(DtFlatState *state, DeviceTreeNode *node)
+{
+	uint8_t *name = (uint8_t *)node->name;
+
+	if (name < state->struct_start + sizeof(uint32_t) ||
+	    name >= state->struct_end)
+		return 0;
+
+	uint32_t start = name - sizeof(uint32_t) - state->blob;
+	const char *flat_name;
+	int size = fdt_node_name(state->blob, start, &flat_name);
+	if (!size || flat_name != node->name)
+		return 0;
+	uint32_t offset = start + size;
+
+	DeviceTreeProperty *prop;
+	FdtProperty flat_prop;
+	list_for_each(prop, node->properties, list_node) {
+		size = fdt_next_property(state->blob, offset, &flat_prop);
+		if (!size || flat_prop.name != prop->prop.name ||
+		    flat_prop.data != prop->prop.data ||
+		    flat_prop.size != prop->prop.size)
+			return 0;
+		offset += size;
+	}
+	if (fdt_next_property(state->blob, offset, NULL))
+		return 0;
+
+	DeviceTreeNode *child;
+	list_for_each(child, node->children, list_node) {
+		if (!child->flat_span ||
+		    (uint8_t *)child->name - sizeof(uint32_t) !=
+		    state->blob + offset)
+			return 0;
+		offset += child->flat_span;
+	}
+	if (betohl(*(uint32_t *)(state->blob + offset)) != TokenEndNode)
+		return 0;
+
+	return offset + sizeof(uint32_t) - start;
+}
+
+static void dt_flat_prop_size(DtFlatState *state, DeviceTreeProperty *prop,
+			      uint32_t *struct_size)
 {
 	// Starting token.
 	*struct_size += sizeof(uint32_t);
@@ -339,27 +584,37 @@ static void dt_flat_prop_size(DeviceTreeProperty *prop, uint32_t *struct_size,
 	*struct_size += size32(prop->prop.size) * sizeof(uint32_t);
 
 	// Property name.
-	*strings_size += strlen(prop->prop.name) + 1;
+	dt_flat_name_offset(state, prop->prop.name);
 }
 
-static void dt_flat_node_size(DeviceTreeNode *node, uint32_t *struct_size,
-			      uint32_t *strings_size)
+static void dt_flat_node_size(DtFlatState *state, DeviceTreeNode *node,
+			      uint32_t *struct_size)
 {
+	uint32_t size = 0;
+
+	DeviceTreeNode *child;
+	list_for_each(child, node->children, list_node)
+		dt_flat_node_size(state, child, &size);
+
+	node->flat_span = dt_flat_clean_span(state, node);
+	if (node->flat_span) {
+		*struct_size += node->flat_span;
+		return;
+	}
+
 	// Starting token.
-	*struct_size += sizeof(uint32_t);
+	size += sizeof(uint32_t);
 	// Node name.
-	*struct_size += size32(strlen(node->name) + 1) * sizeof(uint32_t);
+	size += size32(strlen(node->name) + 1) * sizeof(uint32_t);
 
 	DeviceTreeProperty *prop;
 	list_for_each(prop, node->properties, list_node)
-		dt_flat_prop_size(prop, struct_size, strings_size);
-
-	DeviceTreeNode *child;
-	list_for_each(child, node->children, list_node)
-		dt_flat_node_size(child, struct_size, strings_size);
+		dt_flat_prop_size(state, prop, &size);
 
 	// End token.
-	*struct_size += sizeof(uint32_t);
+	size += sizeof(uint32_t);
+
+	*struct_size += size;
 }
 
 uint32_t dt_flat_size(DeviceTree *tree)
@@ -370,15 +625,16 @@ uint32_t dt_flat_size(DeviceTree *tree)
 		size += sizeof(uint64_t) * 2;
 	size += sizeof(uint64_t) * 2;
 
+	DtFlatState state;
 	uint32_t struct_size = 0;
-	uint32_t strings_size = 0;
-	dt_flat_node_size(tree->root, &struct_size, &strings_size);
+	dt_flat_state_init(tree, &state);
+	dt_flat_node_size(&state, tree->root, &struct_size);
 
 	size += struct_size;
 	// End token.
 	size += sizeof(uint32_t);
 
-	size += strings_size;
+	size += state.strings_size + state.new_strings_size;
 
 	return size;
 }
@@ -397,11 +653,10 @@ static void dt_flatten_map_entry(DeviceTreeReserveMapEntry *entry,
 	*map_start = ((uint8_t *)*map_start) + sizeof(uint64_t) * 2;
 }
 
-static void dt_flatten_prop(DeviceTreeProperty *prop, void **struct_start,
-			    void *strings_base, void **strings_start)
+static void dt_flatten_prop(DtFlatState *state, DeviceTreeProperty *prop,
+			    void **struct_start, char *strings_base)
 {
 	uint8_t *dstruct = (uint8_t *)*struct_start;
-	uint8_t *dstrings = (uint8_t *)*strings_start;
 
 	*((uint32_t *)dstruct) = htobel(TokenProperty);
 	dstruct += sizeof(uint32_t);
@@ -409,25 +664,30 @@ static void dt_flatten_prop(DeviceTreeProperty *prop, void **struct_start,
 	*((uint32_t *)dstruct) = htobel(prop->prop.size);
 	dstruct += sizeof(uint32_t);
 
-	uint32_t name_offset = (uintptr_t)dstrings - (uintptr_t)strings_base;
+	uint32_t name_offset = dt_flat_name_offset(state, prop->prop.name);
 	*((uint32_t *)dstruct) = htobel(name_offset);
 	dstruct += sizeof(uint32_t);
 
-	strcpy((char *)dstrings, prop->prop.name);
-	dstrings += strlen(prop->prop.name) + 1;
+	if (name_offset >= state->strings_size)
+		strcpy(strings_base + name_offset, prop->prop.name);
 
 	memcpy(dstruct, prop->prop.data, prop->prop.size);
 	dstruct += size32(prop->prop.size) * 4;
 
 	*struct_start = dstruct;
-	*strings_start = dstrings;
 }
 
-static void dt_flatten_node(DeviceTreeNode *node, void **struct_start,
-			    void *strings_base, void **strings_start)
+static void dt_flatten_node(DtFlatState *state, DeviceTreeNode *node,
+			    void **struct_start, char *strings_base)
 {
 	uint8_t *dstruct = (uint8_t *)*struct_start;
-	uint8_t *dstrings = (uint8_t *)*strings_start;
+
+	if (node->flat_span) {
+		memcpy(dstruct, node->name - sizeof(uint32_t),
+		       node->flat_span);
+		*struct_start = dstruct + node->flat_span;
+		return;
+	}
 
 	*((uint32_t *)dstruct) = htobel(TokenBeginNode);
 	dstruct += sizeof(uint32_t);
@@ -437,24 +697,26 @@ static void dt_flatten_node(DeviceTreeNode *node, void **struct_start,
 
 	DeviceTreeProperty *prop;
 	list_for_each(prop, node->properties, list_node)
-		dt_flatten_prop(prop, (void **)&dstruct, strings_base,
-				(void **)&dstrings);
+		dt_flatten_prop(state, prop, (void **)&dstruct, strings_base);
 
 	DeviceTreeNode *child;
 	list_for_each(child, node->children, list_node)
-		dt_flatten_node(child, (void **)&dstruct, strings_base,
-				(void **)&dstrings);
+		dt_flatten_node(state, child, (void **)&dstruct, strings_base);
 
 	*((uint32_t *)dstruct) = htobel(TokenEndNode);
 	dstruct += sizeof(uint32_t);
 
 	*struct_start = dstruct;
-	*strings_start = dstrings;
 }
 
 void dt_flatten(DeviceTree *tree, void *start_dest)
 {
 	uint8_t *dest = (uint8_t *)start_dest;
+	DtFlatState state;
+
+	// Read everything needed from the original header before (possibly)
+	// overwriting it.
+	dt_flat_state_init(tree, &state);
 
 	memcpy(dest, tree->header, tree->header_size);
 	FdtHeader *header = (FdtHeader *)dest;
@@ -467,8 +729,8 @@ void dt_flatten(DeviceTree *tree, void *start_dest)
 	dest += sizeof(uint64_t) * 2;
 
 	uint32_t struct_size = 0;
-	uint32_t strings_size = 0;
-	dt_flat_node_size(tree->root, &struct_size, &strings_size);
+	dt_flat_node_size(&state, tree->root, &struct_size);
+	uint32_t strings_size = state.strings_size + state.new_strings_size;
 
 	uint8_t *struct_start = dest;
 	header->structure_offset = htobel(dest - (uint8_t *)start_dest);
@@ -478,13 +740,14 @@ void dt_flatten(DeviceTree *tree, void *start_dest)
 	*((uint32_t *)dest) = htobel(TokenEnd);
 	dest += sizeof(uint32_t);
 
-	uint8_t *strings_start = dest;
+	char *strings_start = (char *)dest;
 	header->strings_offset = htobel(dest - (uint8_t *)start_dest);
 	header->strings_size = htobel(strings_size);
+	memcpy(strings_start, state.strings, state.strings_size);
 	dest += strings_size;
 
-	dt_flatten_node(tree->root, (void **)&struct_start, strings_start,
-			(void **)&strings_start);
+	dt_flatten_node(&state, tree->root, (void **)&struct_start,
+			strings_start);
 
 	header->totalsize = htobel(dest - (uint8_t *)start_dest);
 }
@@ -523,6 +786,101 @@ void dt_print_node(DeviceTreeNode *node)
 
 
 
+/*
+ * Indexes to speed up lookups in big unflattened trees.
+ */
+
+typedef struct DeviceTreeIndex
+{
+	int stale;
+	DtHash phandles;
+	DtHash paths;
+	DtHash compats;		// one entry per string, in tree order
+} DeviceTreeIndex;
+
+static uint32_t dt_count_nodes(DeviceTreeNode *node)
+{
+	uint32_t count = 1;
+	DeviceTreeNode *child;
+
+	list_for_each(child, node->children, list_node)
+		count += dt_count_nodes(child);
+	return count;
+}
+
+static void dt_index_node(DeviceTreeIndex *index, DeviceTreeNode *node,
+			  const char *parent_path)
+{
+	char *path;
+
+	if (parent_path) {
+		size_t len = strlen(parent_path);
+		path = dt_alloc(len + strlen(node->name) + 2);
+		strcpy(path, parent_path);
+		if (len > 1)
+			path[len++] = '/';
+		strcpy(path + len, node->name);
+	} else {
+		path = "/";
+	}
+	dt_hash_add(&index->paths, path, dt_hash_string(path), node);
+
+	if (node->phandle)
+		dt_hash_add(&index->phandles, NULL, node->phandle, node);
+
+	void *data = NULL;
+	size_t bytes = 0;
+	dt_find_bin_prop(node, "compatible", &data, &bytes);
+	for (const char *str = data, *end = str + bytes; str < end;
+	     str += strnlen(str, end - str) + 1)
+		dt_hash_add(&index->compats, str, dt_hash_string(str), node);
+
+	DeviceTreeNode *child;
+	list_for_each(child, node->children, list_node)
+		dt_index_node(index, child, path);
+}
+
+void dt_index_tree(DeviceTree *tree)
+{
+	DeviceTreeIndex *index = dt_alloc(sizeof(*index));
+	uint32_t count = dt_count_nodes(tree->root);
+
+	dt_hash_init(&index->phandles, count);
+	dt_hash_init(&index->paths, count);
+	dt_hash_init(&index->compats, count);
+	dt_index_node(index, tree->root, NULL);
+	tree->index = index;
+}
+
+void dt_index_invalidate(DeviceTree *tree)
+{
+	if (tree->index)
+		tree->index->stale = 1;
+}
+
+// Returns the tree's index, rebuilt if necessary, or NULL if it has none.
+static DeviceTreeIndex *dt_get_index(DeviceTree *tree)
+{
+	if (tree->index && tree->index->stale)
+		dt_index_tree(tree);
+	return tree->index;
+}
+
+static DeviceTreeNode *dt_find_tree_phandle(DeviceTree *tree,
+					    uint32_t phandle)
+{
+	DeviceTreeIndex *index = dt_get_index(tree);
+	DeviceTreeNode *node = NULL;
+
+	if (index)
+		node = dt_hash_find(&index->phandles, NULL, phandle);
+	if (!node)
+		node = dt_find_node_by_phandle(tree->root, phandle);
+	return node;
+}
+
+
+
 /*
  * Functions for reading and manipulating an unflattened device tree.
  */
@@ -584,9 +942,7 @@ DeviceTreeNode *dt_find_node(DeviceTreeNode *parent, const char **path,
 			return NULL;
 
 		found = alloc_node();
-		found->name = strdup(*path);
-		if (!found->name)
-			return NULL;
+		found->name = arena_strdup(&dt_arena, *path);
 
 		list_insert_after(&found->list_node, &parent->children);
 	}
@@ -623,6 +979,7 @@ DeviceTreeNode *dt_find_node_by_path(DeviceTree *tree, const char *path,
 	const char *path_array[15];
 	int i;
 	DeviceTreeNode *node = NULL;
+	DeviceTreeIndex *index = NULL;
 
 	if (path[0] == '/') { // regular path
 		if (path[1] == '\0') {	// special case: "/" is root node
@@ -630,6 +987,16 @@ DeviceTreeNode *dt_find_node_by_path(DeviceTree *tree, const char *path,
 			return tree->root;
 		}
 
+		// The cell sizes can only be found by walking down the path.
+		if (!addrcp && !sizecp)
+			index = dt_get_index(tree);
+		if (index) {
+			node = dt_hash_find(&index->paths, path,
+					    dt_hash_string(path));
+			if (node)
+				return node;
+		}
+
 		sub_path = duped_str = strdup(&path[1]);
 		if (!sub_path)
 			return NULL;
@@ -680,6 +1047,11 @@ DeviceTreeNode *dt_find_node_by_path(DeviceTree *tree, const char *path,
 				    addrcp, sizecp, create);
 	}
 
+	// Remember nodes added after the index was built.
+	if (node && index)
+		dt_hash_add(&index->paths, arena_strdup(&dt_arena, path),
+			    dt_hash_string(path), node);
+
 	free(duped_str);
 	return node;
 }
@@ -780,6 +1152,38 @@ DeviceTreeNode *dt_find_compat(DeviceTreeNode *parent, const char *compat)
 	return NULL;
 }
 
+/*
+ * Find a node from a compatible string anywhere in a tree.
+ *
+ * @param tree		The device tree to search.
+ * @param compat	The compatible string to find.
+ * @return		The found node, or NULL.
+ */
+DeviceTreeNode *dt_find_tree_compat(DeviceTree *tree, const char *compat)
+{
+	DeviceTreeIndex *index = dt_get_index(tree);
+	DeviceTreeNode *node = NULL;
+
+	if (index)
+		node = dt_hash_find(&index->compats, compat,
+				    dt_hash_string(compat));
+	if (!node)
+		node = dt_find_compat(tree->root, compat);
+	return node;
+}
+
+/*
+ * Remove a node and its subtree from a tree.
+ *
+ * @param tree		The device tree the node is in.
+ * @param node		The node to remove.
+ */
+void dt_remove_node(DeviceTree *tree, DeviceTreeNode *node)
+{
+	list_remove(&node->list_node);
+	dt_index_invalidate(tree);
+}
+
 /*
  * Find the next compatible child of a given parent. All children upto the
  * child passed in by caller are ignored. If child is NULL, it considers all the
@@ -957,7 +1361,7 @@ void dt_add_string_prop(DeviceTreeNode *node, const char *name, char *str)
  */
 void dt_add_u32_prop(DeviceTreeNode *node, const char *name, u32 val)
 {
-	u32 *val_ptr = xmalloc(sizeof(val));
+	u32 *val_ptr = dt_alloc(sizeof(val));
 	*val_ptr = htobel(val);
 	dt_add_bin_prop(node, name, val_ptr, sizeof(*val_ptr));
 }
@@ -971,7 +1375,7 @@ void dt_add_u32_prop(DeviceTreeNode *node, const char *name, u32 val)
  */
 void dt_add_u64_prop(DeviceTreeNode *node, const char *name, u64 val)
 {
-	u64 *val_ptr = xmalloc(sizeof(val));
+	u64 *val_ptr = dt_alloc(sizeof(val));
 	*val_ptr = htobell(val);
 	dt_add_bin_prop(node, name, val_ptr, sizeof(*val_ptr));
 }
@@ -991,7 +1395,7 @@ void dt_add_reg_prop(DeviceTreeNode *node, u64 *addrs, u64 *sizes,
 {
 	int i;
 	size_t length = (addr_cells + size_cells) * sizeof(u32) * count;
-	u8 *data = xmalloc(length);
+	u8 *data = dt_alloc(length);
 	u8 *cur = data;
 
 	for (i = 0; i < count; i++) {
@@ -1233,8 +1637,7 @@ static void dt_fix_symbols(DeviceTreeNode *symbols, DeviceTreeNode *fragment,
 		if (!strncmp(prop->prop.data, node_path, len)) {
 			prop->prop.size = snprintf(buf, sizeof(buf), "%s%s",
 				base_path, (char *)prop->prop.data + len) + 1;
-			free(prop->prop.data);
-			prop->prop.data = strdup(buf);
+			prop->prop.data = arena_strdup(&dt_arena, buf);
 		}
 }
 
@@ -1313,18 +1716,31 @@ static int dt_fixup_all_externals(DeviceTree *tree, DeviceTreeNode *symbols,
 				  DeviceTreeNode *overlay_symbols)
 {
 	DeviceTreeProperty *fix;
+	DeviceTreeProperty *prop;
 
 	// If we have any external fixups, the base tree must have /__symbols__.
 	if (!symbols)
 		return -1;
 
+	// There can be thousands of labels, hash them instead of searching
+	// through all of them for every fixup.
+	DtHash labels;
+	uint32_t count = 0;
+	list_for_each(prop, symbols->properties, list_node)
+		count++;
+	dt_hash_init(&labels, count);
+	list_for_each(prop, symbols->properties, list_node)
+		dt_hash_add(&labels, prop->prop.name,
+			    dt_hash_string(prop->prop.name), prop->prop.data);
+
 	// Unlike /__local_fixups__, /__fixups__ is not a whole subtree that
 	// mirrors the node hierarchy. It's just a directory of fixup properties
 	// that each directly contain all information necessary to apply them.
 	list_for_each(fix, fixups->properties, list_node) {
 		// The name of a fixup property is the label of the node we want
 		// a property to phandle-reference. Look it up in /__symbols__.
-		const char *path = dt_find_string_prop(symbols, fix->prop.name);
+		const char *path = dt_hash_find(&labels, fix->prop.name,
+						dt_hash_string(fix->prop.name));
 		if (!path)
 			return -1;
 
@@ -1443,8 +1859,8 @@ static int dt_import_fragment(DeviceTree *tree, DeviceTreeNode *fragment,
 	if (phandle) {
 		if (phandle->prop.size != sizeof(uint32_t))
 			return -1;
-		target = dt_find_node_by_phandle(tree->root,
-						 be32dec(phandle->prop.data));
+		target = dt_find_tree_phandle(tree,
+					      be32dec(phandle->prop.data));
 		// Symbols already updated as part of dt_fixup_external(target).
 	} else if (path) {
 		target = dt_find_node_by_path(tree, path->prop.data,
@@ -1486,6 +1902,10 @@ int dt_apply_overlay(DeviceTree *tree, void *overlay_blob)
 	}
 	tree->max_phandle = new_max;
 
+	// Every external fixup looks up a node in the overlay by path. Index
+	// it only now, so the phandles in the index are the adjusted ones.
+	dt_index_tree(overlay);
+
 	// Now that we changed phandles in the overlay, we need to update any
 	// nodes referring to them. Those are listed in /__local_fixups__.
 	DeviceTreeNode *local_fixups = dt_find_node_by_path(overlay,
@@ -1540,5 +1960,8 @@ int dt_apply_overlay(DeviceTree *tree, void *overlay_blob)
 					  &tree->root->children);
 	}
 
+	// The fragments may have changed compatible properties.
+	dt_index_invalidate(tree);
+
 	return 0;
 }
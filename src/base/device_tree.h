@@ -18,6 +18,7 @@
 #ifndef __BASE_DEVICE_TREE_H__
 #define __BASE_DEVICE_TREE_H__
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include "base/list.h"
@@ -76,6 +77,9 @@ typedef struct DeviceTreeNode
 {
 	const char *name;
 	uint32_t phandle;
+	// Size of the node in the blob it was unflattened from, if unchanged.
+	// Only valid while flattening.
+	uint32_t flat_span;
 
 	// List of DeviceTreeProperty-s.
 	ListNode properties;
@@ -102,6 +106,9 @@ typedef struct DeviceTree
 	ListNode reserve_map;
 
 	DeviceTreeNode *root;
+
+	// Lookup tables set up by dt_index_tree(), NULL if there are none.
+	struct DeviceTreeIndex *index;
 } DeviceTree;
 
 
@@ -119,6 +126,17 @@ int fdt_node_name(void *blob, uint32_t offset, const char **name);
 void fdt_print_node(void *blob, uint32_t offset);
 int fdt_skip_node(void *blob, uint32_t offset);
 
+// The functions below return offsets rather than sizes, 0 means not found.
+// Find the first child of the node at offset, or where it would be.
+uint32_t fdt_first_child(void *blob, uint32_t offset);
+// Find the direct child called name of the node at offset.
+uint32_t fdt_find_child(void *blob, uint32_t offset, const char *name);
+// Read the property called name of the node at offset. Returns 0 if found.
+int fdt_find_prop(void *blob, uint32_t offset, const char *name,
+		  FdtProperty *prop);
+// Check the header of a flattened tree. Returns 0 if it's usable.
+int fdt_check_header(void *blob);
+
 // Read a flattened device tree into a heirarchical structure which refers to
 // the contents of the flattened tree in place. Modifying the flat tree
 // invalidates the unflattened one.
@@ -130,6 +148,12 @@ DeviceTree *fdt_unflatten(void *blob);
  * Unflattened device tree functions.
  */
 
+// Nodes, properties and property values created by the functions below come
+// from an arena, and so does anything else allocated with dt_alloc(). It is
+// all freed at once by dt_free_all(), which invalidates every tree.
+void *dt_alloc(size_t size);
+void dt_free_all(void);
+
 // Figure out how big a device tree would be if it were flattened.
 uint32_t dt_flat_size(DeviceTree *tree);
 // Flatten a device tree into the buffer pointed to by dest.
@@ -151,6 +175,18 @@ DeviceTreeNode *dt_find_node_by_alias(DeviceTree *tree, const char *alias);
 DeviceTreeNode *dt_find_node_by_phandle(DeviceTreeNode *root, uint32_t phandle);
 // Look up a node relative to a parent node, through its compatible string.
 DeviceTreeNode *dt_find_compat(DeviceTreeNode *parent, const char *compatible);
+// Look up a node anywhere in the tree through its compatible string.
+DeviceTreeNode *dt_find_tree_compat(DeviceTree *tree, const char *compatible);
+// Remove a node and everything below it from the tree.
+void dt_remove_node(DeviceTree *tree, DeviceTreeNode *node);
+
+// Build hash tables that make lookups by absolute path, phandle and
+// compatible string constant time, for big trees with many lookups. Nodes
+// added later are still found, but removing nodes other than with
+// dt_remove_node() or changing a node's phandle or compatible property
+// requires a call to dt_index_invalidate() to rebuild the tables.
+void dt_index_tree(DeviceTree *tree);
+void dt_index_invalidate(DeviceTree *tree);
 // Look up the next child of a parent node, through its compatible string. It
 // uses child pointer as the marker to find next.
 DeviceTreeNode *dt_find_next_compat_child(DeviceTreeNode *parent,
@@ -42,3 +42,10 @@ void list_insert_before(ListNode *node, ListNode *before)
 	if (node->prev)
 		node->prev->next = node;
 }
+
+void list_append(ListNode *node, ListNode *head)
+{
+	while (head->next)
+		head = head->next;
+	list_insert_after(node, head);
+}
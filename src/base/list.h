@@ -34,6 +34,8 @@ void list_remove(ListNode *node);
 void list_insert_after(ListNode *node, ListNode *after);
 // Insert ListNode node before ListNode before in a doubly linked list.
 void list_insert_before(ListNode *node, ListNode *before);
+// Insert ListNode node at the end of the list starting at ListNode head.
+void list_append(ListNode *node, ListNode *head);
 
 #define list_for_each(ptr, head, member)                                      \
 	for ((ptr) = container_of((head).next, typeof(*(ptr)), member);       \
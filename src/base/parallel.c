@@ -0,0 +1,123 @@
+/*
+ * Copyright 2021 Google Inc.
+ *
+ * See file CREDITS for list of people who contributed to this
+ * project.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but without any warranty; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <libpayload.h>
+
+#include "base/parallel.h"
+
+/* How long finishing CPUs get once the boot CPU is out of work. */
+#define PARALLEL_TIMEOUT_US	USECS_PER_SEC
+
+/* Set in job.arrived once the boot CPU stops waiting for more CPUs. */
+#define PARALLEL_CLOSED		(1 << 30)
+
+static struct {
+	ParallelFunc func;
+	void *arg;
+	int count;
+	int next;		/* next work item to hand out */
+	int arrived;		/* secondary CPUs that showed up for the job */
+	int finished;		/* secondary CPUs done with the job */
+} job;
+
+static void parallel_do_work(void)
+{
+	int i;
+
+	while ((i = __atomic_fetch_add(&job.next, 1, __ATOMIC_ACQ_REL)) <
+	       job.count)
+		job.func(job.arg, i);
+}
+
+static void parallel_secondary(void)
+{
+	/* Too late, the boot CPU already handed out all the work. */
+	if (__atomic_fetch_add(&job.arrived, 1, __ATOMIC_ACQ_REL) &
+	    PARALLEL_CLOSED)
+		return;
+	parallel_do_work();
+	__atomic_fetch_add(&job.finished, 1, __ATOMIC_RELEASE);
+}
+
+int parallel_cpus(void)
+{
+	return MIN(arch_parallel_cpus(), CONFIG_PARALLEL_CPUS);
+}
+
+int parallel_run(ParallelFunc func, void *arg, int count)
+{
+	uint64_t start;
+	int arrived;
+
+	job.func = func;
+	job.arg = arg;
+	job.count = count;
+	job.next = 0;
+	job.arrived = 0;
+	job.finished = 0;
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	if (count < 2 || !parallel_cpus() ||
+	    !arch_parallel_start(&parallel_secondary,
+				 MIN(parallel_cpus(), count - 1))) {
+		parallel_do_work();
+		return 0;
+	}
+
+	/* The boot CPU pitches in, which also covers CPUs that never come. */
+	parallel_do_work();
+
+	/*
+	 * Every item is handed out now, so only the CPUs that took one are
+	 * worth waiting for. Any that show up later go straight back off.
+	 */
+	arrived = __atomic_fetch_or(&job.arrived, PARALLEL_CLOSED,
+				    __ATOMIC_ACQ_REL);
+
+	start = timer_us(0);
+	while (__atomic_load_n(&job.finished, __ATOMIC_ACQUIRE) < arrived) {
+		if (timer_us(start) > PARALLEL_TIMEOUT_US) {
+			printf("WARNING: %d of %d CPUs didn't finish their "
+			       "work\n",
+			       arrived - __atomic_load_n(&job.finished,
+							 __ATOMIC_ACQUIRE),
+			       arrived);
+			arch_parallel_stop();
+			return -1;
+		}
+	}
+
+	arch_parallel_stop();
+	return 0;
+}
+
+/* Weak defaults for architectures without secondary CPU support. */
+
+void arch_parallel_add_cpu(uint64_t id) __attribute__((weak));
+void arch_parallel_add_cpu(uint64_t id) { /* do nothing */ }
+
+void arch_parallel_add_dt_cpus(DeviceTree *tree) __attribute__((weak));
+void arch_parallel_add_dt_cpus(DeviceTree *tree) { /* do nothing */ }
+
+int arch_parallel_cpus(void) __attribute__((weak));
+int arch_parallel_cpus(void) { return 0; }
+
+int arch_parallel_start(void (*entry)(void), int max) __attribute__((weak));
+int arch_parallel_start(void (*entry)(void), int max) { return 0; }
+
+void arch_parallel_stop(void) __attribute__((weak));
+void arch_parallel_stop(void) { /* do nothing */ }
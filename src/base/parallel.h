@@ -0,0 +1,61 @@
+/*
+ * Copyright 2021 Google Inc.
+ *
+ * See file CREDITS for list of people who contributed to this
+ * project.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but without any warranty; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __BASE_PARALLEL_H__
+#define __BASE_PARALLEL_H__
+
+#include "base/device_tree.h"
+
+/*
+ * Borrow otherwise idle secondary CPUs for a burst of independent work items,
+ * e.g. decompressing the blocks of an LZ4 frame. The CPUs are powered up for
+ * each parallel_run() and off again before it returns, so the OS still finds
+ * them in the state it expects.
+ *
+ * Work functions also run on the secondary CPUs, where there is no console,
+ * heap or timer: they may only compute on memory they are handed.
+ */
+typedef void (*ParallelFunc)(void *arg, int index);
+
+/*
+ * Call func(arg, i) for each i below count and return once all are done.
+ * Returns 0 on success, or -1 if a secondary CPU took an item and didn't
+ * finish it in time. The results are unusable then, and the stuck CPU may
+ * still write to arg.
+ */
+int parallel_run(ParallelFunc func, void *arg, int count);
+
+/* Number of secondary CPUs parallel_run() can use. */
+int parallel_cpus(void);
+
+/*
+ * Architecture hooks. arch_parallel_add_cpu() registers a secondary CPU by
+ * its ID (MPIDR affinity on arm64). Boards do that from their setup, so the
+ * CPUs are known before anything is decompressed; the boot CPU and CPUs
+ * already known are skipped. arch_parallel_add_dt_cpus() adds the CPUs in
+ * the kernel device tree on top of those. arch_parallel_start() powers up
+ * at most max of them to run entry() and returns how many it started,
+ * arch_parallel_stop() waits until they have powered down again. Without an
+ * implementation, everything runs on the boot CPU.
+ */
+void arch_parallel_add_cpu(uint64_t id);
+void arch_parallel_add_dt_cpus(DeviceTree *tree);
+int arch_parallel_cpus(void);
+int arch_parallel_start(void (*entry)(void), int max);
+void arch_parallel_stop(void);
+
+#endif /* __BASE_PARALLEL_H__ */
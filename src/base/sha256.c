@@ -0,0 +1,182 @@
+/*
+ * Copyright 2021 Google Inc.
+ *
+ * See file CREDITS for list of people who contributed to this
+ * project.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but without any warranty; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <libpayload.h>
+
+#include "base/sha256.h"
+
+static const uint32_t sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static const uint32_t sha256_iv[8] = {
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+	0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+#define ROR(x, n)	(((x) >> (n)) | ((x) << (32 - (n))))
+#define CH(x, y, z)	(((x) & (y)) ^ (~(x) & (z)))
+#define MAJ(x, y, z)	(((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+#define SIGMA0(x)	(ROR(x, 2) ^ ROR(x, 13) ^ ROR(x, 22))
+#define SIGMA1(x)	(ROR(x, 6) ^ ROR(x, 11) ^ ROR(x, 25))
+#define GAMMA0(x)	(ROR(x, 7) ^ ROR(x, 18) ^ ((x) >> 3))
+#define GAMMA1(x)	(ROR(x, 17) ^ ROR(x, 19) ^ ((x) >> 10))
+
+static void sha256_blocks_generic(uint32_t state[8], const uint8_t *data,
+				  size_t blocks)
+{
+	uint32_t w[64];
+
+	for (; blocks; blocks--, data += SHA256_BLOCK_SIZE) {
+		uint32_t a = state[0], b = state[1], c = state[2];
+		uint32_t d = state[3], e = state[4], f = state[5];
+		uint32_t g = state[6], h = state[7];
+		int i;
+
+		for (i = 0; i < 16; i++)
+			w[i] = be32dec(data + i * 4);
+		for (; i < 64; i++)
+			w[i] = GAMMA1(w[i - 2]) + w[i - 7] +
+			       GAMMA0(w[i - 15]) + w[i - 16];
+
+		for (i = 0; i < 64; i++) {
+			uint32_t t1 = h + SIGMA1(e) + CH(e, f, g) +
+				      sha256_k[i] + w[i];
+			uint32_t t2 = SIGMA0(a) + MAJ(a, b, c);
+
+			h = g;
+			g = f;
+			f = e;
+			e = d + t1;
+			d = c;
+			c = b;
+			b = a;
+			a = t1 + t2;
+		}
+
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
+		state[5] += f;
+		state[6] += g;
+		state[7] += h;
+	}
+}
+
+static Sha256BlocksFunc sha256_blocks;
+
+static Sha256BlocksFunc sha256_select(void)
+{
+	if (!sha256_blocks) {
+		sha256_blocks = arch_sha256_blocks();
+		if (!sha256_blocks)
+			sha256_blocks = &sha256_blocks_generic;
+	}
+	return sha256_blocks;
+}
+
+int sha256_accelerated(void)
+{
+	return sha256_select() != &sha256_blocks_generic;
+}
+
+void sha256_init(Sha256Ctx *ctx)
+{
+	memcpy(ctx->state, sha256_iv, sizeof(ctx->state));
+	ctx->total = 0;
+}
+
+void sha256_update(Sha256Ctx *ctx, const void *data, size_t size)
+{
+	Sha256BlocksFunc blocks = sha256_select();
+	size_t used = ctx->total % SHA256_BLOCK_SIZE;
+	const uint8_t *p = data;
+
+	ctx->total += size;
+
+	if (used) {
+		size_t fill = MIN(size, SHA256_BLOCK_SIZE - used);
+
+		memcpy(ctx->buf + used, p, fill);
+		p += fill;
+		size -= fill;
+		if (used + fill < SHA256_BLOCK_SIZE)
+			return;
+		blocks(ctx->state, ctx->buf, 1);
+	}
+
+	/* Whole blocks are hashed straight from the caller's buffer. */
+	if (size >= SHA256_BLOCK_SIZE) {
+		blocks(ctx->state, p, size / SHA256_BLOCK_SIZE);
+		p += size & ~(size_t)(SHA256_BLOCK_SIZE - 1);
+		size %= SHA256_BLOCK_SIZE;
+	}
+
+	memcpy(ctx->buf, p, size);
+}
+
+void sha256_final(Sha256Ctx *ctx, uint8_t digest[SHA256_DIGEST_SIZE])
+{
+	Sha256BlocksFunc blocks = sha256_select();
+	size_t used = ctx->total % SHA256_BLOCK_SIZE;
+	uint64_t bits = ctx->total * 8;
+
+	ctx->buf[used++] = 0x80;
+	if (used > SHA256_BLOCK_SIZE - 8) {
+		memset(ctx->buf + used, 0, SHA256_BLOCK_SIZE - used);
+		blocks(ctx->state, ctx->buf, 1);
+		used = 0;
+	}
+	memset(ctx->buf + used, 0, SHA256_BLOCK_SIZE - 8 - used);
+	for (int i = 0; i < 8; i++)
+		ctx->buf[SHA256_BLOCK_SIZE - 1 - i] = bits >> (i * 8);
+	blocks(ctx->state, ctx->buf, 1);
+
+	for (int i = 0; i < 8; i++)
+		be32enc(digest + i * 4, ctx->state[i]);
+}
+
+void sha256(const void *data, size_t size, uint8_t digest[SHA256_DIGEST_SIZE])
+{
+	Sha256Ctx ctx;
+
+	sha256_init(&ctx);
+	sha256_update(&ctx, data, size);
+	sha256_final(&ctx, digest);
+}
+
+/* Weak default for architectures without SHA instructions. */
+
+Sha256BlocksFunc arch_sha256_blocks(void) __attribute__((weak));
+Sha256BlocksFunc arch_sha256_blocks(void) { return NULL; }
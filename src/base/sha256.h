@@ -0,0 +1,61 @@
+/*
+ * Copyright 2021 Google Inc.
+ *
+ * See file CREDITS for list of people who contributed to this
+ * project.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but without any warranty; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __BASE_SHA256_H__
+#define __BASE_SHA256_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_BLOCK_SIZE	64
+#define SHA256_DIGEST_SIZE	32
+
+/*
+ * Incremental SHA-256 that uses the CPU's SHA instructions (ARMv8 Crypto
+ * Extensions, x86 SHA-NI) when the running CPU has them and falls back to
+ * portable C otherwise.
+ */
+typedef struct {
+	uint32_t state[8];
+	uint64_t total;			/* bytes hashed so far */
+	uint8_t buf[SHA256_BLOCK_SIZE];	/* partial block */
+} Sha256Ctx;
+
+void sha256_init(Sha256Ctx *ctx);
+void sha256_update(Sha256Ctx *ctx, const void *data, size_t size);
+void sha256_final(Sha256Ctx *ctx, uint8_t digest[SHA256_DIGEST_SIZE]);
+
+/* Hash a whole buffer in one go. */
+void sha256(const void *data, size_t size, uint8_t digest[SHA256_DIGEST_SIZE]);
+
+/* Returns 1 if the CPU's SHA instructions are used, 0 for portable C. */
+int sha256_accelerated(void);
+
+/*
+ * Run the compression function over blocks consecutive 64 byte blocks,
+ * updating state in place.
+ */
+typedef void (*Sha256BlocksFunc)(uint32_t state[8], const uint8_t *data,
+				 size_t blocks);
+
+/*
+ * Architecture hook, called once: return an accelerated compression
+ * function if the running CPU supports one, or NULL.
+ */
+Sha256BlocksFunc arch_sha256_blocks(void);
+
+#endif /* __BASE_SHA256_H__ */
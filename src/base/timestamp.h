@@ -30,11 +30,13 @@ enum timestamp_id {
 	TS_VB_SELECT_AND_LOAD_KERNEL = 1020,
 	TS_VB_EC_VBOOT_DONE = 1030,
 	TS_VB_STORAGE_INIT_DONE = 1040,
+	TS_VB_READ_KERNEL_START = 1045,
 	TS_VB_READ_KERNEL_DONE = 1050,
 	TS_VB_VBOOT_DONE = 1100,
 
 	TS_START_KERNEL = 1101,
 	TS_KERNEL_DECOMPRESSION = 1102,
+	TS_KERNEL_HEADER_PEEK = 1103,
 };
 
 void timestamp_init(void);
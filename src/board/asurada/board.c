@@ -9,6 +9,7 @@
 #include <libpayload.h>
 
 #include "base/init_funcs.h"
+#include "base/parallel.h"
 #include "drivers/bus/i2s/mtk.h"
 #include "drivers/bus/spi/mtk.h"
 #include "drivers/bus/usb/usb.h"
@@ -87,6 +88,10 @@ static int board_setup(void)
 
 	power_set_ops(&psci_power_ops);
 
+	/* MT8192: eight CPUs in one DynamIQ cluster. */
+	for (int i = 0; i < 8; i++)
+		arch_parallel_add_cpu(i << 8);
+
 	GpioOps *spi5_cs = new_gpio_not(new_mtk_gpio_output(PAD_SPI5_CSB));
 	MtkSpi *spi5 = new_mtk_spi(0x11019000, spi5_cs);
 	tpm_set_ops(&new_tpm_spi(&spi5->ops, cr50_irq_status)->ops);
@@ -19,6 +19,7 @@
 #include <libpayload.h>
 
 #include "base/init_funcs.h"
+#include "base/parallel.h"
 #include "drivers/bus/i2c/mtk_i2c.h"
 #include "drivers/bus/i2s/mtk.h"
 #include "drivers/bus/spi/mtk.h"
@@ -106,6 +107,12 @@ static int board_setup(void)
 
 	power_set_ops(&psci_power_ops);
 
+	/* MT8183: two clusters of four CPUs. */
+	for (int i = 0; i < 4; i++) {
+		arch_parallel_add_cpu(0x000 + i);
+		arch_parallel_add_cpu(0x100 + i);
+	}
+
 	GpioOps *spi0_cs = new_gpio_not(new_mtk_gpio_output(PAD_SPI_CSB));
 	MtkSpi *spi0 = new_mtk_spi(0x1100A000, spi0_cs);
 	tpm_set_ops(&new_tpm_spi(&spi0->ops, cr50_irq_status)->ops);
@@ -17,6 +17,7 @@
 #include <libpayload.h>
 
 #include "base/init_funcs.h"
+#include "base/parallel.h"
 #include "drivers/gpio/gpio.h"
 #include "vboot/util/flag.h"
 #include "boot/fit.h"
@@ -89,6 +90,10 @@ static int board_setup(void)
 
 	power_set_ops(&psci_power_ops);
 
+	/* SC7180: eight CPUs in one DynamIQ cluster. */
+	for (int i = 0; i < 8; i++)
+		arch_parallel_add_cpu(i << 8);
+
 	struct cb_mainboard *mainboard =
 		phys_to_virt(lib_sysinfo.cb_mainboard);
 	if (!strcmp(cb_mb_part_string(mainboard), "Bubs"))
@@ -19,22 +19,28 @@
 #include <endian.h>
 #include <libpayload.h>
 #include <lzma.h>
-#include <lz4.h>
 #include <stdint.h>
 #include <tlcl.h>
 #include <vb2_sha.h>
 #include <ctype.h>
 
+#include "base/parallel.h"
 #include "base/ranges.h"
 #include "base/timestamp.h"
 #include "boot/fit.h"
+#include "boot/lz4_stream.h"
 #include "image/symbols.h"
 #include "vboot/stages.h"
 
 
 
+/*
+ * The FIT is read in place. Image nodes are only unpacked when a config that
+ * might be booted refers to them, and are cached in image_nodes after that.
+ */
+static void *fit_blob;
+static uint32_t images_offset;
 static ListNode image_nodes;
-static ListNode config_nodes;
 
 static const char *fit_kernel_compat[10] = { NULL };
 static int num_fit_kernel_compat = 0;
@@ -100,6 +106,35 @@ static void fit_add_default_compats(void)
 	fit_add_compat(strdup(base));
 }
 
+static FitImageNode *image_node(uint32_t offset)
+{
+	FitImageNode *image = dt_alloc(sizeof(*image));
+	image->compression = CompressionNone;
+
+	fdt_node_name(fit_blob, offset, &image->name);
+
+	FdtProperty prop;
+	if (!fdt_find_prop(fit_blob, offset, "data", &prop)) {
+		image->data = prop.data;
+		image->size = prop.size;
+	}
+	if (!fdt_find_prop(fit_blob, offset, "compression", &prop)) {
+		if (!strcmp("none", prop.data))
+			image->compression = CompressionNone;
+		else if (!strcmp("lzma", prop.data))
+			image->compression = CompressionLzma;
+		else if (!strcmp("lz4", prop.data))
+			image->compression = CompressionLz4;
+		else
+			image->compression = CompressionInvalid;
+	}
+
+	printf("Image %s has %d bytes.\n", image->name, image->size);
+
+	list_insert_after(&image->list_node, &image_nodes);
+	return image;
+}
+
 static FitImageNode *find_image(const char *name)
 {
 	FitImageNode *image;
@@ -107,6 +142,13 @@ static FitImageNode *find_image(const char *name)
 		if (!strcmp(image->name, name))
 			return image;
 	}
+
+	uint32_t offset = 0;
+	if (images_offset)
+		offset = fdt_find_child(fit_blob, images_offset, name);
+	if (offset)
+		return image_node(offset);
+
 	printf("ERROR: Can't find image node %s!\n", name);
 	return NULL;
 }
@@ -122,7 +164,7 @@ static FitImageNode *find_image_with_overlays(const char *name, int bytes,
 	bytes -= len;
 	name += len;
 	while (bytes > 0) {
-		FitOverlayChain *next = xzalloc(sizeof(*next));
+		FitOverlayChain *next = dt_alloc(sizeof(*next));
 		next->overlay = find_image(name);
 		if (!next->overlay)
 			return NULL;
@@ -136,70 +178,52 @@ static FitImageNode *find_image_with_overlays(const char *name, int bytes,
 	return base;
 }
 
-static void image_node(DeviceTreeNode *node)
+/*
+ * What choosing a config takes, read straight from the flat FIT. Only the
+ * config that gets booted is unpacked into a FitConfigNode.
+ */
+typedef struct FitConfigInfo
 {
-	FitImageNode *image = xzalloc(sizeof(*image));
-	image->compression = CompressionNone;
-
-	image->name = node->name;
-
-	DeviceTreeProperty *prop;
-	list_for_each(prop, node->properties, list_node) {
-		if (!strcmp("data", prop->prop.name)) {
-			image->data = prop->prop.data;
-			image->size = prop->prop.size;
-		} else if (!strcmp("compression", prop->prop.name)) {
-			if (!strcmp("none", prop->prop.data))
-				image->compression = CompressionNone;
-			else if (!strcmp("lzma", prop->prop.data))
-				image->compression = CompressionLzma;
-			else if (!strcmp("lz4", prop->prop.data))
-				image->compression = CompressionLz4;
-			else
-				image->compression = CompressionInvalid;
-		}
-	}
-
-	list_insert_after(&image->list_node, &image_nodes);
-}
-
-static void config_node(DeviceTreeNode *node)
+	const char *name;
+	uint32_t offset;
+	FdtProperty kernel;
+	FdtProperty fdt;	// base FDT, followed by any overlays
+	FdtProperty ramdisk;
+	FdtProperty compat;
+	int compat_rank;
+	int compat_pos;
+} FitConfigInfo;
+
+static void config_info(uint32_t offset, FitConfigInfo *info)
 {
-	FitConfigNode *config = xzalloc(sizeof(*config));
-	config->name = node->name;
-
-	DeviceTreeProperty *prop;
-	list_for_each(prop, node->properties, list_node) {
-		if (!strcmp("kernel", prop->prop.name))
-			config->kernel = find_image(prop->prop.data);
-		else if (!strcmp("fdt", prop->prop.name))
-			config->fdt = find_image_with_overlays(prop->prop.data,
-				prop->prop.size, &config->overlays);
-		else if (!strcmp("ramdisk", prop->prop.name))
-			config->ramdisk = find_image(prop->prop.data);
-		else if (!strcmp("compatible", prop->prop.name))
-			config->compat = prop->prop;
-	}
-
-	list_insert_after(&config->list_node, &config_nodes);
+	memset(info, 0, sizeof(*info));
+	info->offset = offset;
+	fdt_node_name(fit_blob, offset, &info->name);
+
+	fdt_find_prop(fit_blob, offset, "kernel", &info->kernel);
+	fdt_find_prop(fit_blob, offset, "fdt", &info->fdt);
+	fdt_find_prop(fit_blob, offset, "ramdisk", &info->ramdisk);
+	fdt_find_prop(fit_blob, offset, "compatible", &info->compat);
 }
 
-static void fit_unpack(DeviceTree *tree, const char **default_config)
+static FitConfigNode *config_node(FitConfigInfo *info)
 {
-	DeviceTreeNode *child;
-	DeviceTreeNode *images = dt_find_node_by_path(tree, "/images",
-						      NULL, NULL, 0);
-	if (images)
-		list_for_each(child, images->children, list_node)
-			image_node(child);
-
-	DeviceTreeNode *configs = dt_find_node_by_path(tree, "/configurations",
-						       NULL, NULL, 0);
-	if (configs) {
-		*default_config = dt_find_string_prop(configs, "default");
-		list_for_each(child, configs->children, list_node)
-			config_node(child);
-	}
+	FitConfigNode *config = dt_alloc(sizeof(*config));
+	config->name = info->name;
+	config->compat = info->compat;
+	config->compat_rank = info->compat_rank;
+	config->compat_pos = info->compat_pos;
+
+	config->kernel = find_image(info->kernel.data);
+	config->fdt = find_image_with_overlays(info->fdt.data,
+					       info->fdt.size,
+					       &config->overlays);
+	if (info->ramdisk.name)
+		config->ramdisk = find_image(info->ramdisk.data);
+
+	if (!config->kernel || !config->fdt)
+		return NULL;
+	return config;
 }
 
 static int fdt_find_compat(void *blob, uint32_t start_offset, FdtProperty *prop)
@@ -238,17 +262,21 @@ static int fit_check_compat(FdtProperty *compat_prop, const char *compat_name)
 	return -1;
 }
 
-static int fit_rank_compat(FitConfigNode *config)
+static int fit_rank_compat(FitConfigInfo *config)
 {
 	// If there was no "compatible" property in config node, this is a
 	// legacy FIT image. Must extract compat prop from FDT itself.
 	if (!config->compat.name) {
-		void *fdt_blob = config->fdt->data;
+		FitImageNode *fdt = find_image(config->fdt.data);
+		if (!fdt)
+			return -1;
+
+		void *fdt_blob = fdt->data;
 		FdtHeader *fdt_header = (FdtHeader *)fdt_blob;
 		uint32_t fdt_offset =
 			betohl(fdt_header->structure_offset);
 
-		if (config->fdt->compression != CompressionNone) {
+		if (fdt->compression != CompressionNone) {
 			printf("ERROR: config %s has a compressed FDT without "
 			       "external compatible property, skipping.\n",
 			       config->name);
@@ -256,7 +284,8 @@ static int fit_rank_compat(FitConfigNode *config)
 		}
 
 		// FDT overlays are not supported in legacy FIT images.
-		if (config->overlays.next) {
+		if (strnlen(config->fdt.data, config->fdt.size) + 1 <
+		    config->fdt.size) {
 			printf("ERROR: config %s has overlay but no compat!\n",
 			       config->name);
 			return -1;
@@ -265,7 +294,7 @@ static int fit_rank_compat(FitConfigNode *config)
 		if (fdt_find_compat(fdt_blob, fdt_offset, &config->compat)) {
 			printf("ERROR: Can't find compat string in FDT %s "
 			       "for config %s, skipping.\n",
-			       config->fdt->name, config->name);
+			       fdt->name, config->name);
 			return -1;
 		}
 	}
@@ -285,24 +314,108 @@ static int fit_rank_compat(FitConfigNode *config)
 	return 0;
 }
 
-size_t fit_decompress(FitImageNode *node, void *buffer, size_t bufsize)
+/* Run s to the end, passing everything in its output buffer to done(). */
+static size_t fit_lz4_finish(Lz4Stream *s, size_t chunk,
+			     void (*done)(void *data, size_t size))
+{
+	size_t emitted = 0;
+	int ret;
+
+	do {
+		ret = lz4_stream_decode(s, s->src_size,
+					MAX(emitted + chunk, s->out_pos));
+		if (ret == LZ4_STREAM_ERROR)
+			return 0;
+		/* All input is there, so no progress means it's truncated. */
+		if (ret == LZ4_STREAM_MORE && s->out_pos == emitted)
+			return 0;
+		if (done && s->out_pos > emitted)
+			done(s->dst + emitted, s->out_pos - emitted);
+		emitted = s->out_pos;
+	} while (ret != LZ4_STREAM_DONE);
+
+	return s->out_pos;
+}
+
+size_t fit_decompress_chunked(FitImageNode *node, void *buffer, size_t bufsize,
+			      size_t chunk, void (*done)(void *data,
+							 size_t size))
 {
+	size_t size;
+
 	switch (node->compression) {
 	case CompressionNone:
 		printf("Relocating %s to %p\n", node->name, buffer);
 		memmove(buffer, node->data, MIN(node->size, bufsize));
-		return node->size <= bufsize ? node->size : 0;
+		size = node->size <= bufsize ? node->size : 0;
+		break;
 	case CompressionLzma:
 		printf("LZMA decompressing %s to %p\n", node->name, buffer);
-		return ulzman(node->data, node->size, buffer, bufsize);
+		size = ulzman(node->data, node->size, buffer, bufsize);
+		break;
 	case CompressionLz4:
+	{
+		Lz4Stream lz4;
+
 		printf("LZ4 decompressing %s to %p\n", node->name, buffer);
-		return ulz4fn(node->data, node->size, buffer, bufsize);
+		size = lz4_decode_parallel(node->data, node->size, buffer,
+					   bufsize);
+		if (size)
+			break;
+		lz4_stream_init(&lz4, node->data, node->size, buffer, bufsize);
+		return fit_lz4_finish(&lz4, chunk ? chunk : bufsize, done);
+	}
 	default:
 		printf("ERROR: Illegal compression algorithm (%d) for %s!\n",
 		       node->compression, node->name);
 		return 0;
 	}
+
+	if (done && size)
+		done(buffer, size);
+	return size;
+}
+
+size_t fit_decompress(FitImageNode *node, void *buffer, size_t bufsize)
+{
+	return fit_decompress_chunked(node, buffer, bufsize, 0, NULL);
+}
+
+size_t fit_decompress_peek(FitDecompressor *d, FitImageNode *node,
+			   void *buffer, size_t bufsize)
+{
+	d->node = node;
+
+	if (node->compression != CompressionLz4)
+		return fit_decompress(node, buffer, bufsize);
+
+	/* Unlimited size so that stopping at bufsize isn't an overflow. */
+	lz4_stream_init(&d->lz4, node->data, node->size, buffer, SIZE_MAX);
+	if (lz4_stream_decode(&d->lz4, node->size, bufsize) ==
+	    LZ4_STREAM_ERROR)
+		return 0;
+	return d->lz4.out_pos;
+}
+
+size_t fit_decompress_resume(FitDecompressor *d, void *buffer, size_t bufsize,
+			     size_t chunk, void (*done)(void *data,
+							size_t size))
+{
+	FitImageNode *node = d->node;
+
+	if (node->compression != CompressionLz4)
+		return fit_decompress_chunked(node, buffer, bufsize, chunk,
+					      done);
+
+	/* Decoding everything on all CPUs beats continuing on one. */
+	if (parallel_cpus())
+		return fit_decompress_chunked(node, buffer, bufsize, chunk,
+					      done);
+
+	printf("LZ4 decompressing %s to %p, resuming at %#zx\n", node->name,
+	       buffer, d->lz4.out_pos);
+	lz4_stream_move_output(&d->lz4, buffer, bufsize);
+	return fit_lz4_finish(&d->lz4, chunk ? chunk : bufsize, done);
 }
 
 static void *get_fdt_data(FitImageNode *fdt)
@@ -320,9 +433,8 @@ static void *get_fdt_data(FitImageNode *fdt)
 	if (!size)
 		return NULL;
 
-	void *ret = malloc(size);
-	if (ret)
-		memcpy(ret, buffer, size);
+	void *ret = dt_alloc(size);
+	memcpy(ret, buffer, size);
 	return ret;
 }
 
@@ -338,7 +450,7 @@ static void update_chosen(DeviceTree *tree, char *cmd_line)
 			uint64_t kaslr;
 			uint8_t rng[64];
 		};
-	} *seed = xzalloc(sizeof(*seed));
+	} *seed = dt_alloc(sizeof(*seed));
 	uint32_t size;
 	const char *path[] = { "chosen", NULL };
 	DeviceTreeNode *node = dt_find_node(tree->root, path, NULL, NULL, 1);
@@ -369,19 +481,45 @@ void fit_add_ramdisk(DeviceTree *tree, void *ramdisk_addr, size_t ramdisk_size)
 	const char *path[] = { "chosen", NULL };
 	DeviceTreeNode *node = dt_find_node(tree->root, path, NULL, NULL, 1);
 
-	/* Warning: this assumes the ramdisk is currently located below 4GiB. */
-	u32 start = (uintptr_t)ramdisk_addr;
-	u32 end = start + ramdisk_size;
+	uint64_t start = (uintptr_t)ramdisk_addr;
+	uint64_t end = start + ramdisk_size;
+
+	// Linux takes either cell size, only use two where it's needed.
+	if (end > UINT32_MAX) {
+		dt_add_u64_prop(node, "linux,initrd-start", start);
+		dt_add_u64_prop(node, "linux,initrd-end", end);
+	} else {
+		dt_add_u32_prop(node, "linux,initrd-start", start);
+		dt_add_u32_prop(node, "linux,initrd-end", end);
+	}
+}
+
+/*
+ * A compressed ramdisk is decompressed straight to where the kernel will find
+ * it: the unused part of the kernel buffer behind the FIT. The whole buffer is
+ * kept clear of the kernel's own load address, and the kernel reserves the
+ * ramdisk through the linux,initrd-* properties.
+ */
+#define RAMDISK_ALIGN	(4 * KiB)
+
+static void *fit_ramdisk_buffer(void *fit)
+{
+	FdtHeader *header = fit;
+	char *end = (char *)fit + betohl(header->totalsize);
+	char *ramdisk = (char *)ALIGN_UP((uintptr_t)end, RAMDISK_ALIGN);
 
-	dt_add_u32_prop(node, "linux,initrd-start", start);
-	dt_add_u32_prop(node, "linux,initrd-end", end);
+	if ((char *)fit < _kernel_start || ramdisk >= _kernel_end) {
+		printf("ERROR: No space for the ramdisk behind the FIT!\n");
+		return NULL;
+	}
+	return ramdisk;
 }
 
 static void update_reserve_map(uint64_t start, uint64_t end, void *data)
 {
 	DeviceTree *tree = (DeviceTree *)data;
 
-	DeviceTreeReserveMapEntry *entry = xzalloc(sizeof(*entry));
+	DeviceTreeReserveMapEntry *entry = dt_alloc(sizeof(*entry));
 	entry->start = start;
 	entry->size = end - start;
 
@@ -444,9 +582,9 @@ static void update_memory(DeviceTree *tree)
 	list_for_each(node, tree->root->children, list_node) {
 		const char *devtype = dt_find_string_prop(node, "device_type");
 		if (devtype && !strcmp(devtype, "memory"))
-			list_remove(&node->list_node);
+			dt_remove_node(tree, node);
 	}
-	node = xzalloc(sizeof(*node));
+	node = dt_alloc(sizeof(*node));
 	node->name = "memory";
 	list_insert_after(&node->list_node, &tree->root->children);
 	dt_add_string_prop(node, "device_type", "memory");
@@ -493,7 +631,7 @@ static void update_memory(DeviceTree *tree)
 
 	// Allocate the right amount of space and fill up the entries.
 	size_t length = count * (addr_cells + size_cells) * sizeof(u32);
-	void *data = xmalloc(length);
+	void *data = dt_alloc(length);
 	EntryParams add_params = { addr_cells, size_cells, data };
 	ranges_for_each(&mem, &update_mem_property, &add_params);
 	assert(add_params.data - data == length);
@@ -502,43 +640,62 @@ static void update_memory(DeviceTree *tree)
 	dt_add_bin_prop(node, "reg", data, length);
 }
 
+static int fit_has_image(const char *name)
+{
+	return images_offset && fdt_find_child(fit_blob, images_offset, name);
+}
+
 FitImageNode *fit_load(void *fit, char *cmd_line, DeviceTree **dt)
 {
-	FitImageNode *image;
-	FitConfigNode *config;
 	FitOverlayChain *overlay_chain;
 
 	printf("Loading FIT.\n");
 
-	DeviceTree *tree = fdt_unflatten(fit);
-	if (!tree) {
-		printf("Failed to unflatten FIT image!\n");
+	if (fdt_check_header(fit)) {
+		printf("Invalid FIT image!\n");
 		return NULL;
 	}
 
-	const char *default_config_name = NULL;
-	FitConfigNode *default_config = NULL;
-	FitConfigNode *compat_config = NULL;
+	// Forget the images and trees unpacked for an earlier attempt.
+	dt_free_all();
+	fit_blob = fit;
+	image_nodes.next = NULL;
+
+	FdtHeader *header = fit;
+	uint32_t root = betohl(header->structure_offset);
+	images_offset = fdt_find_child(fit, root, "images");
+	uint32_t configs_offset = fdt_find_child(fit, root, "configurations");
 
-	fit_unpack(tree, &default_config_name);
+	const char *default_config_name = NULL;
+	FitConfigInfo infos[3];
+	FitConfigInfo *config = &infos[0];
+	FitConfigInfo *default_config = NULL;
+	FitConfigInfo *compat_config = NULL;
 
-	// List the images we found.
-	list_for_each(image, image_nodes, list_node)
-		printf("Image %s has %d bytes.\n", image->name, image->size);
+	FdtProperty prop;
+	if (configs_offset &&
+	    !fdt_find_prop(fit, configs_offset, "default", &prop))
+		default_config_name = prop.data;
 
 	fit_add_default_compats();
 	printf("Compat preference:");
 	for (int i = 0; i < num_fit_kernel_compat; i++)
 		printf(" %s", fit_kernel_compat[i]);
 	printf("\n");
-	// Process and list the configs.
-	list_for_each(config, config_nodes, list_node) {
-		if (!config->kernel) {
+
+	// Process and list the configs, only keeping the candidates around.
+	uint32_t offset = configs_offset ?
+		fdt_first_child(fit, configs_offset) : 0;
+	for (; offset && fdt_node_name(fit, offset, NULL);
+	     offset += fdt_skip_node(fit, offset)) {
+		config_info(offset, config);
+
+		if (!config->kernel.name) {
 			printf("ERROR: config %s has no kernel, skipping.\n",
 			       config->name);
 			continue;
 		}
-		if (!config->fdt) {
+		if (!config->fdt.name) {
 			printf("ERROR: config %s has no FDT, skipping.\n",
 			       config->name);
 			continue;
@@ -547,18 +704,42 @@ FitImageNode *fit_load(void *fit, char *cmd_line, DeviceTree **dt)
 		if (fit_rank_compat(config) != 0)
 			continue;
 
+		int is_default = default_config_name &&
+				 !strcmp(config->name, default_config_name);
+		int is_better = config->compat.name && config->compat_rank >= 0 &&
+			(!compat_config ||
+			 config->compat_rank <= compat_config->compat_rank);
+
+		// Looking up images is slow, only do it for candidates.
+		if (is_default || is_better) {
+			if (!fit_has_image(config->kernel.data)) {
+				printf("ERROR: config %s has no kernel, "
+				       "skipping.\n", config->name);
+				continue;
+			}
+			if (!fit_has_image(config->fdt.data)) {
+				printf("ERROR: config %s has no FDT, "
+				       "skipping.\n", config->name);
+				continue;
+			}
+		}
+
 		printf("Config %s", config->name);
-		if (default_config_name &&
-				!strcmp(config->name, default_config_name)) {
+		if (is_default) {
 			printf(" (default)");
 			default_config = config;
 		}
-		printf(", kernel %s", config->kernel->name);
-		printf(", fdt %s", config->fdt->name);
-		list_for_each(overlay_chain, config->overlays, list_node)
-			printf(" %s", overlay_chain->overlay->name);
-		if (config->ramdisk)
-			printf(", ramdisk %s", config->ramdisk->name);
+		printf(", kernel %s", (char *)config->kernel.data);
+		printf(", fdt");
+		const char *fdt_str = config->fdt.data;
+		for (int bytes = config->fdt.size; bytes > 0 && fdt_str[0];) {
+			printf(" %s", fdt_str);
+			int len = strnlen(fdt_str, bytes) + 1;
+			fdt_str += len;
+			bytes -= len;
+		}
+		if (config->ramdisk.name)
+			printf(", ramdisk %s", (char *)config->ramdisk.data);
 		if (config->compat.name) {
 			printf(", compat");
 			int bytes = config->compat.size;
@@ -571,29 +752,38 @@ FitImageNode *fit_load(void *fit, char *cmd_line, DeviceTree **dt)
 				compat_str += len;
 				bytes -= len;
 			}
-
-			if (config->compat_rank >= 0 && (!compat_config ||
-			    config->compat_rank < compat_config->compat_rank))
-				compat_config = config;
 		}
 		printf("\n");
+
+		// Later configs win ties, like they always have.
+		if (is_better)
+			compat_config = config;
+
+		// Scan the next config into whichever slot is still free.
+		if (is_default || is_better)
+			for (int i = 0; i < ARRAY_SIZE(infos); i++)
+				if (&infos[i] != default_config &&
+				    &infos[i] != compat_config)
+					config = &infos[i];
 	}
 
-	FitConfigNode *to_boot = NULL;
+	FitConfigInfo *chosen = NULL;
 	if (compat_config) {
-		to_boot = compat_config;
+		chosen = compat_config;
 		printf("Choosing best match %s for compat %s.\n",
-		       to_boot->name, fit_kernel_compat[to_boot->compat_rank]);
+		       chosen->name, fit_kernel_compat[chosen->compat_rank]);
 	} else if (default_config) {
-		to_boot = default_config;
-		printf("No match, choosing default %s.\n", to_boot->name);
+		chosen = default_config;
+		printf("No match, choosing default %s.\n", chosen->name);
 	} else {
 		printf("No compatible or default configs. Giving up.\n");
-		// We're leaking memory here, but at this point we're beyond
-		// saving anyway.
 		return NULL;
 	}
 
+	FitConfigNode *to_boot = config_node(chosen);
+	if (!to_boot)
+		return NULL;
+
 	void *fdt_data = get_fdt_data(to_boot->fdt);
 	if (!fdt_data) {
 		printf("ERROR: Can't decompress FDT %s!\n",
@@ -607,6 +797,9 @@ FitImageNode *fit_load(void *fit, char *cmd_line, DeviceTree **dt)
 		return NULL;
 	}
 
+	// Overlays and fixups do a lot of lookups in the kernel's tree.
+	dt_index_tree(*dt);
+
 	list_for_each(overlay_chain, to_boot->overlays, list_node) {
 		fdt_data = get_fdt_data(overlay_chain->overlay);
 		if (!fdt_data) {
@@ -625,13 +818,26 @@ FitImageNode *fit_load(void *fit, char *cmd_line, DeviceTree **dt)
 
 	update_memory(*dt);
 
+	// Boards may not list every CPU, pick up the rest before the ramdisk.
+	arch_parallel_add_dt_cpus(*dt);
+
 	if (to_boot->ramdisk) {
+		void *ramdisk = to_boot->ramdisk->data;
+		size_t size = to_boot->ramdisk->size;
+
 		if (to_boot->ramdisk->compression != CompressionNone) {
-			printf("Ramdisk compression not supported.\n");
-			return NULL;
+			ramdisk = fit_ramdisk_buffer(fit);
+			if (!ramdisk)
+				return NULL;
+			size = fit_decompress(to_boot->ramdisk, ramdisk,
+					      _kernel_end - (char *)ramdisk);
+			if (!size) {
+				printf("ERROR: Can't decompress ramdisk %s!\n",
+				       to_boot->ramdisk->name);
+				return NULL;
+			}
 		}
-		fit_add_ramdisk(*dt, to_boot->ramdisk->data,
-				to_boot->ramdisk->size);
+		fit_add_ramdisk(*dt, ramdisk, size);
 	}
 
 	return to_boot->kernel;
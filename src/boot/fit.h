@@ -23,6 +23,7 @@
 
 #include "base/device_tree.h"
 #include "base/list.h"
+#include "boot/lz4_stream.h"
 
 typedef enum CompressionType
 {
@@ -87,4 +88,33 @@ void fit_add_ramdisk(DeviceTree *tree, void *ramdisk_addr, size_t ramdisk_size);
 
 size_t fit_decompress(FitImageNode *node, void *buffer, size_t bufsize);
 
+/*
+ * Like fit_decompress(), but pass the output to done() in pieces of about
+ * chunk bytes as soon as they are final, so the caller can process them
+ * while the rest is still being decompressed. Formats that can't be
+ * decoded incrementally produce a single piece at the end.
+ */
+size_t fit_decompress_chunked(FitImageNode *node, void *buffer, size_t bufsize,
+			      size_t chunk, void (*done)(void *data,
+							 size_t size));
+
+/*
+ * Decompress a node in two steps: fit_decompress_peek() decodes just the
+ * first bufsize bytes, e.g. a header that decides where the image goes, and
+ * fit_decompress_resume() then decodes all of it into the final buffer like
+ * fit_decompress_chunked(). LZ4 picks up where the peek stopped and only
+ * copies the peeked bytes over, other formats start over. The peek can't
+ * always tell a short buffer from an error, check what it returns instead.
+ */
+typedef struct FitDecompressor {
+	FitImageNode *node;
+	Lz4Stream lz4;
+} FitDecompressor;
+
+size_t fit_decompress_peek(FitDecompressor *d, FitImageNode *node,
+			   void *buffer, size_t bufsize);
+size_t fit_decompress_resume(FitDecompressor *d, void *buffer, size_t bufsize,
+			     size_t chunk, void (*done)(void *data,
+							size_t size));
+
 #endif /* __BOOT_FIT_H__ */
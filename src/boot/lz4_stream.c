@@ -0,0 +1,387 @@
+/*
+ * Copyright 2021 Google Inc.
+ *
+ * See file CREDITS for list of people who contributed to this
+ * project.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <libpayload.h>
+
+#include "base/parallel.h"
+#include "boot/lz4_stream.h"
+
+#define LZ4F_MAGIC		0x184D2204
+#define LZ4F_VERSION_MASK	0xC0
+#define LZ4F_VERSION		0x40
+#define LZ4F_BLOCK_INDEP	(1 << 5)
+#define LZ4F_BLOCK_CHECKSUM	(1 << 4)
+#define LZ4F_CONTENT_SIZE	(1 << 3)
+#define LZ4F_CONTENT_CHECKSUM	(1 << 2)
+#define LZ4F_DICT_ID		(1 << 0)
+#define LZ4F_BLOCK_RAW		(1U << 31)
+
+#define LZ4_MIN_MATCH		4
+
+enum {
+	STATE_HEADER,
+	STATE_BLOCK_HEADER,
+	STATE_RAW,
+	STATE_TOKEN,
+	STATE_LITERALS,
+	STATE_MATCH,
+	STATE_DONE,
+	STATE_ERROR,
+};
+
+static uint32_t lz4_read_le32(const uint8_t *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/*
+ * Parse the frame descriptor, returning its size, 0 if more input is needed
+ * or -1 if it's invalid.
+ */
+static int lz4_parse_header(const uint8_t *in, size_t in_avail, uint8_t *flags)
+{
+	int size = 7;
+
+	if (in_avail < size)
+		return 0;
+	if (lz4_read_le32(in) != LZ4F_MAGIC)
+		return -1;
+	*flags = in[4];
+	if ((*flags & LZ4F_VERSION_MASK) != LZ4F_VERSION ||
+	    (*flags & LZ4F_DICT_ID))
+		return -1;
+	if (*flags & LZ4F_CONTENT_SIZE)
+		size += 8;
+	if (in_avail < size)
+		return 0;
+
+	/* The header checksum is ignored, just like ulz4fn() does. */
+	return size;
+}
+
+static int lz4_stream_header(Lz4Stream *s, size_t in_avail)
+{
+	int size = lz4_parse_header(s->src, in_avail, &s->flags);
+
+	if (size < 0)
+		return LZ4_STREAM_ERROR;
+	if (!size)
+		return LZ4_STREAM_MORE;
+
+	s->in_pos = size;
+	s->state = STATE_BLOCK_HEADER;
+	return LZ4_STREAM_MORE;
+}
+
+/* Start the next block once all of it is available. */
+static int lz4_stream_block_header(Lz4Stream *s, size_t in_avail)
+{
+	if (in_avail - s->in_pos < 4)
+		return LZ4_STREAM_MORE;
+
+	uint32_t header = lz4_read_le32(s->src + s->in_pos);
+	uint32_t size = header & ~LZ4F_BLOCK_RAW;
+
+	if (!header) {
+		size_t end = s->in_pos + 4;
+
+		if (s->flags & LZ4F_CONTENT_CHECKSUM)
+			end += 4;
+		if (in_avail < end)
+			return LZ4_STREAM_MORE;
+		s->in_pos = end;
+		s->state = STATE_DONE;
+		return LZ4_STREAM_DONE;
+	}
+
+	size_t end = s->in_pos + 4 + size;
+	if (s->flags & LZ4F_BLOCK_CHECKSUM)
+		end += 4;
+	if (end > s->src_size)
+		return LZ4_STREAM_ERROR;
+	if (end > in_avail)
+		return LZ4_STREAM_MORE;
+
+	s->in_pos += 4;
+	s->block_end = s->in_pos + size;
+	s->block_raw = header & LZ4F_BLOCK_RAW;
+	s->state = s->block_raw ? STATE_RAW : STATE_TOKEN;
+	return LZ4_STREAM_MORE;
+}
+
+static void lz4_stream_end_block(Lz4Stream *s)
+{
+	s->in_pos = s->block_end;
+	if (s->flags & LZ4F_BLOCK_CHECKSUM)
+		s->in_pos += 4;
+	s->state = STATE_BLOCK_HEADER;
+}
+
+/* Read an LZ4 length extension, adding it to *len. */
+static int lz4_stream_length(Lz4Stream *s, size_t *len)
+{
+	uint8_t b;
+
+	do {
+		if (s->in_pos >= s->block_end)
+			return -1;
+		b = s->src[s->in_pos++];
+		*len += b;
+	} while (b == 255);
+	return 0;
+}
+
+/* Copy a match that may overlap with the bytes it produces. */
+static void lz4_copy_match(uint8_t *d, size_t off, size_t n)
+{
+	const uint8_t *m = d - off;
+
+	if (off >= n) {
+		memcpy(d, m, n);
+		return;
+	}
+	/* Every chunk of off bytes only reads what is already written. */
+	for (size_t done = 0; done < n; done += off)
+		memcpy(d + done, m + done, MIN(off, n - done));
+}
+
+static int lz4_stream_step(Lz4Stream *s, size_t in_avail, size_t out_limit)
+{
+	const uint8_t *in = s->src;
+	size_t n;
+
+	switch (s->state) {
+	case STATE_HEADER:
+		return lz4_stream_header(s, in_avail);
+
+	case STATE_BLOCK_HEADER:
+		return lz4_stream_block_header(s, in_avail);
+
+	case STATE_RAW:
+		n = MIN(s->block_end - s->in_pos, out_limit - s->out_pos);
+		memcpy(s->dst + s->out_pos, in + s->in_pos, n);
+		s->in_pos += n;
+		s->out_pos += n;
+		if (s->in_pos == s->block_end)
+			lz4_stream_end_block(s);
+		return LZ4_STREAM_MORE;
+
+	case STATE_TOKEN:
+		s->token = in[s->in_pos++];
+		s->lit_left = s->token >> 4;
+		if (s->lit_left == 15 && lz4_stream_length(s, &s->lit_left))
+			return LZ4_STREAM_ERROR;
+		if (s->lit_left > s->block_end - s->in_pos)
+			return LZ4_STREAM_ERROR;
+		s->state = STATE_LITERALS;
+		return LZ4_STREAM_MORE;
+
+	case STATE_LITERALS:
+		n = MIN(s->lit_left, out_limit - s->out_pos);
+		memcpy(s->dst + s->out_pos, in + s->in_pos, n);
+		s->in_pos += n;
+		s->out_pos += n;
+		s->lit_left -= n;
+		if (s->lit_left)
+			return LZ4_STREAM_MORE;
+
+		/* The last sequence of a block has no match. */
+		if (s->in_pos == s->block_end) {
+			lz4_stream_end_block(s);
+			return LZ4_STREAM_MORE;
+		}
+		if (s->block_end - s->in_pos < 2)
+			return LZ4_STREAM_ERROR;
+		s->match_off = in[s->in_pos] | in[s->in_pos + 1] << 8;
+		s->in_pos += 2;
+		if (!s->match_off || s->match_off > s->out_pos)
+			return LZ4_STREAM_ERROR;
+		s->match_left = s->token & 0xf;
+		if (s->match_left == 15 &&
+		    lz4_stream_length(s, &s->match_left))
+			return LZ4_STREAM_ERROR;
+		s->match_left += LZ4_MIN_MATCH;
+		s->state = STATE_MATCH;
+		return LZ4_STREAM_MORE;
+
+	case STATE_MATCH:
+		n = MIN(s->match_left, out_limit - s->out_pos);
+		lz4_copy_match(s->dst + s->out_pos, s->match_off, n);
+		s->out_pos += n;
+		s->match_left -= n;
+		if (s->match_left)
+			return LZ4_STREAM_MORE;
+		/* Every block ends with literals. */
+		if (s->in_pos == s->block_end)
+			return LZ4_STREAM_ERROR;
+		s->state = STATE_TOKEN;
+		return LZ4_STREAM_MORE;
+
+	case STATE_DONE:
+		return LZ4_STREAM_DONE;
+
+	default:
+		return LZ4_STREAM_ERROR;
+	}
+}
+
+void lz4_stream_init(Lz4Stream *s, const void *src, size_t src_size,
+		     void *dst, size_t dst_size)
+{
+	memset(s, 0, sizeof(*s));
+	s->src = src;
+	s->src_size = src_size;
+	s->dst = dst;
+	s->dst_size = dst_size;
+	s->state = STATE_HEADER;
+}
+
+void lz4_stream_move_output(Lz4Stream *s, void *dst, size_t dst_size)
+{
+	memcpy(dst, s->dst, MIN(s->out_pos, dst_size));
+	s->dst = dst;
+	s->dst_size = dst_size;
+	if (s->out_pos > dst_size)
+		s->state = STATE_ERROR;
+}
+
+int lz4_stream_decode(Lz4Stream *s, size_t in_avail, size_t out_limit)
+{
+	in_avail = MIN(in_avail, s->src_size);
+	out_limit = MIN(out_limit, s->dst_size);
+
+	if (s->state == STATE_ERROR)
+		return LZ4_STREAM_ERROR;
+
+	while (1) {
+		size_t in_pos = s->in_pos;
+		size_t out_pos = s->out_pos;
+		int state = s->state;
+		int ret = lz4_stream_step(s, in_avail, out_limit);
+
+		if (ret == LZ4_STREAM_ERROR) {
+			s->state = STATE_ERROR;
+			return LZ4_STREAM_ERROR;
+		}
+		if (ret == LZ4_STREAM_DONE)
+			return LZ4_STREAM_DONE;
+
+		/* No progress means we need more input or output space. */
+		if (s->in_pos != in_pos || s->out_pos != out_pos ||
+		    s->state != state)
+			continue;
+		/* Stuck on a full output buffer, leave it to the caller to
+		 * complain, e.g. a partial decode may be all it wanted. */
+		if (s->out_pos == s->dst_size &&
+		    (state == STATE_RAW || state == STATE_LITERALS ||
+		     state == STATE_MATCH)) {
+			s->state = STATE_ERROR;
+			return LZ4_STREAM_ERROR;
+		}
+		return LZ4_STREAM_MORE;
+	}
+}
+
+typedef struct {
+	const uint8_t *src;
+	uint32_t size;
+	int raw;
+	uint8_t *dst;
+	size_t dst_size;
+	size_t out;		/* bytes produced, 0 on error */
+} Lz4Block;
+
+static void lz4_block_work(void *arg, int index)
+{
+	Lz4Block *block = (Lz4Block *)arg + index;
+	Lz4Stream s;
+
+	/* A stream positioned at the block that stops at its end. */
+	lz4_stream_init(&s, block->src, block->size, block->dst,
+			block->dst_size);
+	s.block_end = block->size;
+	s.state = block->raw ? STATE_RAW : STATE_TOKEN;
+
+	block->out = 0;
+	if (lz4_stream_decode(&s, block->size, block->dst_size) !=
+	    LZ4_STREAM_ERROR && s.state == STATE_BLOCK_HEADER)
+		block->out = s.out_pos;
+}
+
+size_t lz4_decode_parallel(const void *src, size_t src_size,
+			   void *dst, size_t dst_size)
+{
+	const uint8_t *in = src;
+	uint8_t flags;
+	int count = 0;
+
+	if (!parallel_cpus())
+		return 0;
+
+	int pos = lz4_parse_header(in, src_size, &flags);
+	if (pos <= 0 || !(flags & LZ4F_BLOCK_INDEP))
+		return 0;
+	/* The BD byte, only there once the header parsed. */
+	int max_id = (in[5] >> 4) & 7;
+	if (max_id < 4)
+		return 0;
+	size_t block_max = 1 << (8 + 2 * max_id);
+	size_t extra = flags & LZ4F_BLOCK_CHECKSUM ? 4 : 0;
+
+	/* Count the blocks and check that they are all there. */
+	for (size_t p = pos; ; count++) {
+		if (src_size - p < 4)
+			return 0;
+		uint32_t size = lz4_read_le32(in + p) & ~LZ4F_BLOCK_RAW;
+		if (!size)
+			break;
+		if (src_size - p - 4 < size + extra)
+			return 0;
+		p += 4 + size + extra;
+	}
+	if (count < 2 || (count - 1) * block_max >= dst_size)
+		return 0;
+
+	/*
+	 * Only the last block of a frame may decode to less than the maximum
+	 * block size, so block i goes to i * block_max. That's what the lz4
+	 * tool produces and it's verified below.
+	 */
+	Lz4Block *blocks = xmalloc(count * sizeof(*blocks));
+	for (int i = 0; i < count; i++) {
+		uint32_t header = lz4_read_le32(in + pos);
+
+		blocks[i].src = in + pos + 4;
+		blocks[i].size = header & ~LZ4F_BLOCK_RAW;
+		blocks[i].raw = !!(header & LZ4F_BLOCK_RAW);
+		blocks[i].dst = (uint8_t *)dst + i * block_max;
+		blocks[i].dst_size = MIN(block_max, dst_size - i * block_max);
+		pos += 4 + blocks[i].size + extra;
+	}
+
+	/* A stuck CPU may still write to blocks, leave it be. */
+	if (parallel_run(&lz4_block_work, blocks, count))
+		return 0;
+
+	size_t total = (count - 1) * block_max + blocks[count - 1].out;
+	for (int i = 0; i < count; i++)
+		if (!blocks[i].out || (i < count - 1 &&
+				       blocks[i].out != block_max))
+			total = 0;
+	free(blocks);
+	return total;
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright 2021 Google Inc.
+ *
+ * See file CREDITS for list of people who contributed to this
+ * project.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __BOOT_LZ4_STREAM_H__
+#define __BOOT_LZ4_STREAM_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Resumable decoder for the LZ4 frame format. Unlike ulz4fn() it can be run
+ * in steps: each call to lz4_stream_decode() consumes whatever complete
+ * blocks are within the input available so far and produces output up to a
+ * limit, then returns so the caller can do something else with the output
+ * or wait for more input. Input and output are single contiguous buffers,
+ * so earlier output stays in place for back references and nothing is
+ * copied through an intermediate buffer.
+ */
+typedef struct Lz4Stream {
+	const uint8_t *src;
+	size_t src_size;
+	size_t in_pos;
+	uint8_t *dst;
+	size_t dst_size;
+	size_t out_pos;
+
+	int state;
+	uint8_t flags;		/* frame descriptor FLG byte */
+	int block_raw;		/* current block is stored uncompressed */
+	size_t block_end;	/* input offset of the end of the block data */
+	uint8_t token;		/* token of the current sequence */
+	size_t lit_left;	/* literal bytes of the sequence still to copy */
+	size_t match_left;	/* match bytes of the sequence still to copy */
+	size_t match_off;
+} Lz4Stream;
+
+enum {
+	LZ4_STREAM_ERROR = -1,
+	LZ4_STREAM_MORE = 0,	/* hit the input or output limit */
+	LZ4_STREAM_DONE = 1,	/* reached the end of the frame */
+};
+
+void lz4_stream_init(Lz4Stream *s, const void *src, size_t src_size,
+		     void *dst, size_t dst_size);
+
+/*
+ * Switch to a new output buffer, copying what was decoded so far into it.
+ * Used to decode the start of the data somewhere temporary before the final
+ * destination is known.
+ */
+void lz4_stream_move_output(Lz4Stream *s, void *dst, size_t dst_size);
+
+/*
+ * Decode with the first in_avail bytes of the input available, writing no
+ * further than out_limit bytes into the output. Running out of output space
+ * at dst_size is an error, stopping at a smaller out_limit is not.
+ */
+int lz4_stream_decode(Lz4Stream *s, size_t in_avail, size_t out_limit);
+
+/*
+ * Decode a complete frame with independent blocks by spreading the blocks
+ * across CPUs with parallel_run(). Returns the decoded size, or 0 if the
+ * frame doesn't qualify, no secondary CPUs are available or decoding
+ * failed; the caller then falls back to the incremental decoder, which
+ * also reports real errors.
+ */
+size_t lz4_decode_parallel(const void *src, size_t src_size,
+			   void *dst, size_t dst_size);
+
+#endif /* __BOOT_LZ4_STREAM_H__ */
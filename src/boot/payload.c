@@ -17,15 +17,18 @@
 
 #include <stdbool.h>
 #include <libpayload.h>
+#include <lz4.h>
 #include <lzma.h>
 #include <vb2_sha.h>
 #include <cbfs.h>
 
 #include "arch/cache.h"
 #include "base/cleanup_funcs.h"
+#include "base/sha256.h"
 #include "drivers/flash/cbfs.h"
 #include "drivers/flash/flash.h"
 #include "image/fmap.h"
+#include "boot/lz4_stream.h"
 #include "boot/payload.h"
 #include "vboot/crossystem/crossystem.h"
 
@@ -119,6 +122,14 @@ static int payload_load(struct cbfs_payload *payload, void **entryp)
 					return -1;
 				}
 				break;
+			case CBFS_COMPRESS_LZ4:
+				if (!lz4_decode_parallel(src, src_len, dst,
+							 dst_len) &&
+				    !ulz4fn(src, src_len, dst, dst_len)) {
+					printf("LZ4: Decompression failed.\n");
+					return -1;
+				}
+				break;
 			default:
 				printf("Compression type %x not supported\n",
 				       comp);
@@ -180,20 +191,11 @@ int payload_run(const char *payload_name, int verify)
 	}
 
 	if (verify) {
-		uint8_t real_hash[VB2_SHA256_DIGEST_SIZE];
+		uint8_t real_hash[SHA256_DIGEST_SIZE];
 		uint8_t *expected_hash;
-		vb2_error_t rv;
 
 		/* Calculate hash of payload. */
-		rv = vb2_digest_buffer((const uint8_t *)payload,
-				       payload_size, VB2_HASH_SHA256,
-				       real_hash, sizeof(real_hash));
-		if (rv) {
-			printf("SHA-256 calculation failed for "
-			       "%s payload.\n", payload_name);
-			free(payload);
-			return 1;
-		}
+		sha256(payload, payload_size, real_hash);
 
 		/* Retrieve the expected hash of payload stored in AP-RW. */
 		expected_hash = get_payload_hash(payload_name);
@@ -47,9 +47,9 @@ static int ramoops_fixup(DeviceTreeFixup *fixup, DeviceTree *tree)
 		return 1;
 
 	// Eliminate any existing ramoops node.
-	DeviceTreeNode *node = dt_find_compat(tree->root, "ramoops");
+	DeviceTreeNode *node = dt_find_tree_compat(tree, "ramoops");
 	if (node)
-		list_remove(&node->list_node);
+		dt_remove_node(tree, node);
 
 	u32 addr_cells = 1, size_cells = 1;
 	dt_read_cell_props(reserved, &addr_cells, &size_cells);
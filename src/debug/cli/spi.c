@@ -69,6 +69,54 @@ static int do_spi_write(int argc, char * const argv[], int read_flag)
 	return length != flash_write(offset, length, mem_addr);
 }
 
+static int do_spi_cache(int argc, char * const argv[], int ignore)
+{
+	if (argc > 1)
+		return CMD_RET_USAGE;
+
+	if (argc && strcmp(argv[0], "reset"))
+		return CMD_RET_USAGE;
+
+	flash_cache_print_stats();
+	if (argc)
+		flash_cache_reset();
+	return 0;
+}
+
+static int do_spi_bench(int argc, char * const argv[], int ignore)
+{
+	unsigned offset, length, count = 1;
+	uint64_t start, total = 0;
+
+	if (argc != 2 && argc != 3)
+		return CMD_RET_USAGE;
+
+	offset = strtoul(argv[0], 0, 16);
+	length = strtoul(argv[1], 0, 16);
+	if (argc == 3)
+		count = strtoul(argv[2], 0, 10);
+	if (!length || !count)
+		return CMD_RET_USAGE;
+
+	for (unsigned i = 0; i < count; i++) {
+		/* Each pass has to come from the chip, not the cache. */
+		flash_cache_drop();
+
+		start = timer_us(0);
+		if (!flash_read(offset, length)) {
+			printf("read failed!\n");
+			return -1;
+		}
+		total += timer_us(start);
+	}
+
+	total = MAX(total, 1);
+	printf("Read %u KiB %u times in %llu us, %llu KiB/s\n",
+	       length / KiB, count, total,
+	       (uint64_t)length * count * USECS_PER_SEC / KiB / total);
+	return 0;
+}
+
 static int do_spi(cmd_tbl_t *cmdtp, int flag, int argc, char * const argv[])
 {
 	struct {
@@ -79,7 +127,9 @@ static int do_spi(cmd_tbl_t *cmdtp, int flag, int argc, char * const argv[])
 		{"read", 1, do_spi_read},
 		{"dump", 0, do_spi_read},
 		{"erase", 1, do_spi_erase},
-		{"write", 0, do_spi_write}
+		{"write", 0, do_spi_write},
+		{"cache", 0, do_spi_cache},
+		{"bench", 0, do_spi_bench}
 	};
 	int i;
 
@@ -104,4 +154,8 @@ U_BOOT_CMD(
 	"                           into RAM starting at 'addr'\n"
 	"spi write offset len addr - write 'len' bytes starting at 'offset'\n"
 	"                           from RAM starting at 'addr'\n"
+	"spi cache [reset]    - show read cache counters, optionally\n"
+	"                           dropping the cache and counters\n"
+	"spi bench offset len [n] - time reading 'len' bytes at 'offset'\n"
+	"                           from the chip, n times\n"
 );
@@ -10,7 +10,9 @@
 
 #include "base/list.h"
 #include "debug/cli/common.h"
+#include "drivers/storage/blockcache.h"
 #include "drivers/storage/blockdev.h"
+#include "drivers/storage/bouncebuf.h"
 
 typedef struct {
 
@@ -57,7 +59,7 @@ static int storage_read(int argc, char *const argv[])
 	}
 
 	bd = current_devices.known_devices[current_devices.curr_device];
-	i = bd->ops.read(&bd->ops, base_block, num_blocks, dest_addr);
+	i = blockcache_read(bd, base_block, num_blocks, dest_addr);
 	return i != num_blocks;
 }
 
@@ -79,7 +81,7 @@ static int storage_write(int argc, char *const argv[])
 	}
 
 	bd = current_devices.known_devices[current_devices.curr_device];
-	i = bd->ops.write(&bd->ops, base_block, num_blocks, src_addr);
+	i = blockcache_write(bd, base_block, num_blocks, src_addr);
 	return i != num_blocks;
 }
 
@@ -104,10 +106,148 @@ static int storage_erase(int argc, char *const argv[])
 		return CMD_RET_SUCCESS;
 	}
 
+	blockcache_invalidate(bd, base_block, num_blocks);
 	i = bd->ops.erase(&bd->ops, base_block, num_blocks);
 	return i != num_blocks;
 }
 
+static int storage_cache(int argc, char *const argv[])
+{
+	BlockDev *bd;
+
+	if ((current_devices.curr_device < 0) ||
+	    (current_devices.curr_device >= current_devices.total)) {
+		printf("Is storage subsystem initialized?");
+		return -1;
+	}
+
+	bd = current_devices.known_devices[current_devices.curr_device];
+	if (argc) {
+		if (!strcmp(argv[0], "on")) {
+			blockcache_enable(bd, 1);
+		} else if (!strcmp(argv[0], "off")) {
+			blockcache_enable(bd, 0);
+		} else if (!strcmp(argv[0], "reset")) {
+			bd->cache.hits = bd->cache.misses = 0;
+		} else {
+			printf("Unknown cache option %s\n", argv[0]);
+			return CMD_RET_USAGE;
+		}
+	}
+
+	printf("%s: cache %s, %u block hits, %u block misses\n", bd->name,
+	       bd->cache.enabled ? "on" : "off",
+	       bd->cache.hits, bd->cache.misses);
+	return CMD_RET_SUCCESS;
+}
+
+#define HAVE_BOUNCEBUF (CONFIG(DRIVER_SDHCI) || \
+			CONFIG(DRIVER_STORAGE_MMC_MTK) || \
+			CONFIG(DRIVER_STORAGE_MMC_MVMAP2315) || \
+			CONFIG(DRIVER_STORAGE_MMC_TEGRA))
+
+static int storage_dma(int argc, char *const argv[])
+{
+#if HAVE_BOUNCEBUF
+	if (argc) {
+		if (strcmp(argv[0], "reset"))
+			return CMD_RET_USAGE;
+		memset(&bounce_buffer_stats, 0, sizeof(bounce_buffer_stats));
+	}
+
+	printf("%llu bytes bounced, %llu bytes DMA'd in place\n",
+	       bounce_buffer_stats.bounced, bounce_buffer_stats.direct);
+#else
+	printf("No driver uses bounce buffers\n");
+#endif
+	return CMD_RET_SUCCESS;
+}
+
+typedef struct {
+	uint8_t *buffer;
+	uint64_t seen;
+	int out_of_order;
+} stream_check;
+
+static void storage_stream_observe(void *arg, const void *data, uint64_t size)
+{
+	stream_check *check = arg;
+
+	if (data != check->buffer + check->seen)
+		check->out_of_order = 1;
+	check->seen += size;
+}
+
+/*
+ * Read a range once through a plain stream and once through an observed
+ * one, the way vboot reads a kernel partition: a small header first, then
+ * the rest in one go. The observer must see every byte in order, and both
+ * reads must return the same data.
+ */
+static int storage_stream(int argc, char *const argv[])
+{
+	lba_t base_block = strtoull(argv[0], NULL, 0);
+	lba_t num_blocks = strtoull(argv[1], NULL, 0);
+	stream_check check = { 0 };
+	uint64_t size, head, plain, observed;
+	uint8_t *expected;
+	StreamOps *stream;
+	BlockDev *bd;
+	int ret = CMD_RET_FAILURE;
+
+	if ((current_devices.curr_device < 0) ||
+	    (current_devices.curr_device >= current_devices.total)) {
+		printf("Is storage subsystem initialized?");
+		return -1;
+	}
+
+	bd = current_devices.known_devices[current_devices.curr_device];
+	if (!bd->ops.new_stream) {
+		printf("%s doesn't support streams\n", bd->name);
+		return CMD_RET_FAILURE;
+	}
+
+	size = num_blocks * bd->block_size;
+	head = MIN(size, 64 * KiB);
+	expected = xmalloc(size);
+	check.buffer = xmalloc(size);
+
+	stream = bd->ops.new_stream(&bd->ops, base_block, num_blocks);
+	plain = stream->read(stream, head, expected);
+	if (plain == head)
+		plain += stream->read(stream, size - head, expected + head);
+	stream->close(stream);
+
+	stream = bd->ops.new_stream(&bd->ops, base_block, num_blocks);
+	observed = stream->read(stream, head, check.buffer);
+	check.seen = observed;
+	if (observed == head)
+		observed += stream_read_observed(stream, size - head,
+						 check.buffer + head,
+						 storage_stream_observe,
+						 &check);
+	stream->close(stream);
+
+	if (plain != size || observed != size)
+		printf("Short read: %llu plain, %llu observed of %llu bytes\n",
+		       plain, observed, size);
+	else if (check.seen != size)
+		printf("Observer saw %llu of %llu bytes\n", check.seen, size);
+	else if (check.out_of_order)
+		printf("Observer saw the data out of order\n");
+	else if (memcmp(expected, check.buffer, size))
+		printf("Observed read returned different data\n");
+	else
+		ret = CMD_RET_SUCCESS;
+
+	if (ret == CMD_RET_SUCCESS)
+		printf("%llu bytes streamed, observed reads match\n", size);
+
+	free(expected);
+	free(check.buffer);
+	return ret;
+}
+
 static int storage_dev(int argc, char *const argv[])
 {
 	int rv = 0;
@@ -266,9 +406,12 @@ typedef struct {
 } cmd_map;
 
 static const cmd_map cmdmap[] = {
+	{ "cache", storage_cache, 0, 1 },
 	{ "dev", storage_dev, 0, 1 },
+	{ "dma", storage_dma, 0, 1 },
 	{ "init", storage_init, 0, 0 },
 	{ "show", storage_show, 0, 0 },
+	{ "stream", storage_stream, 2, 2 },
 	{ "read", storage_read, 3, 3 },
 	{ "write", storage_write, 3, 3 },
 	{ "erase", storage_erase, 2, 2 },
@@ -297,10 +440,15 @@ U_BOOT_CMD(
 	storage, CONFIG_SYS_MAXARGS,	1,
 	"command for controlling onboard storage devices",
 	"\n"
+	" cache [on|off|reset] - show or control the default device's "
+	"block cache\n"
 	" dev [dev#] - display or set default storage device\n"
+	" dma [reset] - show bytes DMA'd in place and through bounce buffers\n"
 	" erase <base blk> <num blks> - erase in default device\n"
 	" init - initialize storage devices\n"
 	" show - show currently initialized devices\n"
+	" stream <base blk> <num blks> - check observed stream reads "
+	"against plain ones\n"
 	" read <base blk> <num blks> <dest addr> - read from default device\n"
 	" write <base blk> <num blks> <src addr> - write to default device\n"
 );
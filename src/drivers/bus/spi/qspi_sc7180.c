@@ -222,9 +222,9 @@ int spi_stop(SpiOps *me)
 	return 0;
 }
 
-int spi_xfer(SpiOps *me, void *in, const void *out, uint32_t size)
+static int qspi_xfer(SpiOps *me, void *in, const void *out, uint32_t size,
+		     QspiMode mode)
 {
-	QspiMode mode = SDR_1BIT;
 	uint8_t *data = (uint8_t *)(out ? out : in);
 	Sc7180Qspi *qspi_bus = container_of(me, Sc7180Qspi, ops);
 
@@ -246,6 +246,17 @@ int spi_xfer(SpiOps *me, void *in, const void *out, uint32_t size)
 	return 0;
 }
 
+int spi_xfer(SpiOps *me, void *in, const void *out, uint32_t size)
+{
+	return qspi_xfer(me, in, out, size, SDR_1BIT);
+}
+
+static int spi_xfer_multi(SpiOps *me, void *in, const void *out,
+			  uint32_t size, int width)
+{
+	return qspi_xfer(me, in, out, size, width == 4 ? SDR_4BIT : SDR_2BIT);
+}
+
 Sc7180Qspi *new_sc7180_qspi(uintptr_t base)
 {
 	Sc7180Qspi *qspi_bus = xzalloc(sizeof(*qspi_bus));
@@ -253,6 +264,8 @@ Sc7180Qspi *new_sc7180_qspi(uintptr_t base)
 	qspi_bus->ops.start = &spi_start;
 	qspi_bus->ops.stop  = &spi_stop;
 	qspi_bus->ops.transfer = &spi_xfer;
+	qspi_bus->ops.transfer_multi = &spi_xfer_multi;
+	qspi_bus->ops.multi_io = SPI_MULTI_IO_DUAL | SPI_MULTI_IO_QUAD;
 	qspi_bus->qspi_base = (Sc7180QspiRegs *)base;
 	return qspi_bus;
 }
@@ -16,12 +16,25 @@
 
 #include <stdint.h>
 
+/* Bus widths besides the plain single-bit one, for SpiOps.multi_io. */
+#define SPI_MULTI_IO_DUAL	(1 << 1)
+#define SPI_MULTI_IO_QUAD	(1 << 2)
+
 typedef struct SpiOps
 {
 	int (*start)(struct SpiOps *me);
 	int (*transfer)(struct SpiOps *me, void *in, const void *out,
 			uint32_t size);
 	int (*stop)(struct SpiOps *me);
+
+	/*
+	 * Optional: transfer size bytes in one direction over width (2 or
+	 * 4) data lines, as used by the dual and quad read commands of SPI
+	 * flashes. Only the widths set in multi_io may be used.
+	 */
+	int (*transfer_multi)(struct SpiOps *me, void *in, const void *out,
+			      uint32_t size, int width);
+	uint32_t multi_io;
 } SpiOps;
 
 #endif /* __DRIVERS_BUS_SPI_SPI_H__ */
@@ -146,44 +146,76 @@ static int fast_spi_flash_erase(FlashOps *me, uint32_t offset, uint32_t size)
 	return size;
 }
 
+/*
+ * Read through the hardware sequencer, one FDATA FIFO at a time. Unlike
+ * writes, reads may cross page boundaries, so cycles only stop short of a
+ * full FIFO at 4 KiB boundaries, which reads can't cross. The next cycle
+ * can't be started before the FIFO is drained since it reuses FDATA, but
+ * everything that doesn't depend on the data is set up ahead of the loop.
+ */
+static int fast_spi_flash_read_hwseq(FastSpiFlash *flash, uint8_t *data,
+				     uint32_t offset, uint32_t size)
+{
+	const uint32_t hsfsts = SPIBAR_HSFSTS_W1C_BITS |
+				SPIBAR_HSFSTS_CYCLE_READ | SPIBAR_HSFSTS_FGO;
+	void *faddr = (void *)(flash->mmio_base + SPIBAR_FADDR);
+	void *ctl = (void *)(flash->mmio_base + SPIBAR_HSFSTS_CTL);
+
+	while (size) {
+		size_t xfer_len = MIN(size, SPIBAR_FDATA_FIFO_SIZE);
+
+		xfer_len = MIN(xfer_len, SPIBAR_READ_BOUNDARY -
+				 offset % SPIBAR_READ_BOUNDARY);
+
+		write32(faddr, offset);
+		write32(ctl, hsfsts | SPIBAR_HSFSTS_FDBC(xfer_len - 1));
+		if (wait_for_hwseq_xfer(flash, offset) < 0)
+			return -1;
+
+		drain_xfer_fifo(flash, data, xfer_len);
+
+		offset += xfer_len;
+		data += xfer_len;
+		size -= xfer_len;
+	}
+
+	return 0;
+}
+
 static void *fast_spi_flash_read(FlashOps *me, uint32_t offset, uint32_t size)
 {
 	FastSpiFlash *flash = container_of(me, FastSpiFlash, ops);
 	uint8_t *data = flash->cache + offset;
-	uint8_t *odata = data;
+	uint32_t end = offset + size;
+	uint32_t mmio_start, mmio_end;
 
-	assert(offset + size <= flash->rom_size);
+	assert(end <= flash->rom_size);
 
 	/*
-	 * If the read is entirely within the memory map just copy the data
+	 * Whatever falls inside the memory mapped window is just copied, only
+	 * the parts before and after it go through the sequencer.
 	 *
-	 * We can't just return the pointer because the flash_rewrite operation
-	 * will modify this data
+	 * We can't just return a pointer into the window because the
+	 * flash_rewrite operation will modify this data.
 	 */
-	if (offset >= flash->mmio_offset && offset + size < flash->mmio_end) {
-		uintptr_t mmio_address =
-			(uintptr_t)(flash->mmio_address -
-				    flash->mmio_offset + offset);
-		memcpy(data, (void *)mmio_address, size);
+	mmio_start = MIN(MAX(offset, flash->mmio_offset), end);
+	mmio_end = MAX(MIN(end, flash->mmio_end), mmio_start);
 
-		return data;
-	}
+	if (fast_spi_flash_read_hwseq(flash, data, offset,
+				      mmio_start - offset) < 0)
+		return NULL;
 
-	while (size) {
-		size_t xfer_len = get_xfer_len(offset, size);
+	if (mmio_end > mmio_start)
+		memcpy(data + mmio_start - offset,
+		       (void *)(flash->mmio_address - flash->mmio_offset +
+				mmio_start),
+		       mmio_end - mmio_start);
 
-		if (exec_sync_hwseq_xfer(flash, SPIBAR_HSFSTS_CYCLE_READ,
-					 offset, xfer_len) < 0)
-			return NULL;
-
-		drain_xfer_fifo(flash, data, xfer_len);
-
-		offset += xfer_len;
-		data += xfer_len;
-		size -= xfer_len;
-	}
+	if (fast_spi_flash_read_hwseq(flash, data + mmio_end - offset,
+				      mmio_end, end - mmio_end) < 0)
+		return NULL;
 
-	return odata;
+	return data;
 }
 
 static int fast_spi_flash_write(FlashOps *me, const void *buffer,
@@ -325,6 +357,7 @@ FastSpiFlash *new_fast_spi_flash(uintptr_t mmio_base)
 	flash->ops.write_status = fast_spi_flash_write_status;
 	flash->ops.read_id = fast_spi_flash_read_id;
 
+	flash_cache_init(&flash->ops, flash->cache, rom_size);
 	fast_spi_fill_regions(flash);
 
 	return flash;
@@ -94,6 +94,8 @@
 
 #define SPIBAR_XFER_TIMEOUT_US		(5 * USECS_PER_SEC)
 #define SPIBAR_PAGE_SIZE		256
+/* Hardware sequencer reads can't cross this boundary. */
+#define SPIBAR_READ_BOUNDARY		(4 * KiB)
 
 #define  SPIBAR_BIOS_BFPREG		(0x0)
 #define  BFPREG_BASE_MASK		(0x7fff)
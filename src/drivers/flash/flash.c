@@ -17,20 +17,116 @@
 
 #include <libpayload.h>
 
+#include "base/cleanup_funcs.h"
 #include "drivers/flash/flash.h"
 
+#define CACHE_GRANULE	CONFIG_DRIVER_FLASH_CACHE_GRANULE
+
+_Static_assert(!(CACHE_GRANULE & (CACHE_GRANULE - 1)),
+	       "flash cache granule must be a power of two");
+
+static int cache_valid(FlashOps *ops, uint32_t granule)
+{
+	return ops->cache.valid[granule / 32] & (1U << (granule % 32));
+}
+
+static void cache_mark(FlashOps *ops, uint32_t first, uint32_t last,
+		       int valid)
+{
+	for (uint32_t i = first; i <= last; i++) {
+		if (valid)
+			ops->cache.valid[i / 32] |= 1U << (i % 32);
+		else
+			ops->cache.valid[i / 32] &= ~(1U << (i % 32));
+	}
+}
+
+void flash_cache_init(FlashOps *ops, void *buffer, uint32_t size)
+{
+	uint32_t granules = DIV_ROUND_UP(size, CACHE_GRANULE);
+
+	if (!CACHE_GRANULE || !size)
+		return;
+
+	ops->cache.buffer = buffer;
+	ops->cache.size = size;
+	ops->cache.valid = xzalloc(DIV_ROUND_UP(granules, 32) *
+				   sizeof(*ops->cache.valid));
+}
+
+void flash_cache_invalidate(FlashOps *ops, uint32_t offset, uint32_t size)
+{
+	if (!ops->cache.valid || !size || offset >= ops->cache.size)
+		return;
+
+	size = MIN(size, ops->cache.size - offset);
+	cache_mark(ops, offset / CACHE_GRANULE,
+		   (offset + size - 1) / CACHE_GRANULE, 0);
+}
+
+/* data is now in flash at offset, keep the granules it covers. */
+static void flash_cache_fill(FlashOps *ops, uint32_t offset, uint32_t size,
+			     const void *data)
+{
+	uint32_t first = DIV_ROUND_UP(offset, CACHE_GRANULE);
+	uint32_t end = offset + size;
+
+	if (!ops->cache.valid || end > ops->cache.size)
+		return;
+
+	if (data != ops->cache.buffer + offset)
+		memcpy(ops->cache.buffer + offset, data, size);
+
+	/* Only whole granules, except the last one of the flash. */
+	if (end != ops->cache.size)
+		end = ALIGN_DOWN(end, CACHE_GRANULE);
+	if (end > first * CACHE_GRANULE)
+		cache_mark(ops, first, (end - 1) / CACHE_GRANULE, 1);
+}
+
 void *flash_read_ops(FlashOps *ops, uint32_t offset, uint32_t size)
 {
 	die_if(!ops, "%s: No flash ops set.\n", __func__);
-	return ops->read(ops, offset, size);
+
+	if (!ops->cache.valid || !size || offset >= ops->cache.size ||
+	    size > ops->cache.size - offset) {
+		ops->cache.bytes_read += size;
+		return ops->read(ops, offset, size);
+	}
+
+	uint32_t first = offset / CACHE_GRANULE;
+	uint32_t last = (offset + size - 1) / CACHE_GRANULE;
+
+	while (first <= last && cache_valid(ops, first))
+		first++;
+	if (first > last) {
+		ops->cache.hits++;
+		return ops->cache.buffer + offset;
+	}
+	while (cache_valid(ops, last))
+		last--;
+
+	/* Fetch whole granules so that later reads nearby hit. */
+	uint32_t start = first * CACHE_GRANULE;
+	uint32_t end = MIN((last + 1) * CACHE_GRANULE, ops->cache.size);
+
+	ops->cache.misses++;
+	ops->cache.bytes_read += end - start;
+	if (!ops->read(ops, start, end - start))
+		return NULL;
+	cache_mark(ops, first, last, 1);
+
+	return ops->cache.buffer + offset;
 }
 
 int flash_write_ops(FlashOps *ops, uint32_t offset, uint32_t size,
 		    const void *buffer)
 {
 	die_if(!ops, "%s: No flash ops set.\n", __func__);
-	if (ops->write)
+	if (ops->write) {
+		flash_cache_invalidate(ops, offset, size);
 		return ops->write(ops, buffer, offset, size);
+	}
 
 	return 0;
 }
@@ -38,8 +134,10 @@ int flash_write_ops(FlashOps *ops, uint32_t offset, uint32_t size,
 int flash_erase_ops(FlashOps *ops, uint32_t offset, uint32_t size)
 {
 	die_if(!ops, "%s: No flash ops set.\n", __func__);
-	if (ops->erase)
+	if (ops->erase) {
+		flash_cache_invalidate(ops, offset, size);
 		return ops->erase(ops, offset, size);
+	}
 
 	return 0;
 }
@@ -79,6 +177,66 @@ static inline uint32_t flash_sector_size_ops(FlashOps *ops)
 	return ops->sector_size;
 }
 
+/* Program granularity of the NOR parts we drive. */
+#define FLASH_PAGE_SIZE	256
+
+/* Programming can only clear bits, anything else takes an erase first. */
+static int flash_needs_erase(const uint8_t *old, const uint8_t *new,
+			     uint32_t size)
+{
+	for (uint32_t i = 0; i < size; i++)
+		if ((old[i] & new[i]) != new[i])
+			return 1;
+	return 0;
+}
+
+static int flash_is_blank(const uint8_t *data, uint32_t size)
+{
+	for (uint32_t i = 0; i < size; i++)
+		if (data[i] != 0xff)
+			return 0;
+	return 1;
+}
+
+/*
+ * Program data to [offset, offset + size) a page at a time, skipping pages
+ * that already match old, or that are blank if old is NULL (just erased).
+ */
+static int flash_program_pages(FlashOps *ops, uint32_t offset, uint32_t size,
+			       const uint8_t *data, const uint8_t *old)
+{
+	uint32_t end = offset + size;
+
+	while (offset < end) {
+		uint32_t len = MIN(ALIGN_DOWN(offset, FLASH_PAGE_SIZE) +
+				   FLASH_PAGE_SIZE, end) - offset;
+		int ret;
+
+		if (old ? !memcmp(data, old, len) : flash_is_blank(data, len)) {
+			ops->rewrite.pages_skipped++;
+		} else {
+			ret = flash_write_ops(ops, offset, len, data);
+			if (ret != len) {
+				printf("rewriting failed in write ret=%d\n",
+				       ret);
+				return -1;
+			}
+		}
+
+		offset += len;
+		data += len;
+		if (old)
+			old += len;
+	}
+	return 0;
+}
+
+/*
+ * Compare against what the flash holds and only do what it takes to get
+ * there: pages that don't change are skipped, sectors where bits only go
+ * from 1 to 0 are programmed in place, and just the remaining sectors are
+ * erased and written back.
+ */
 int flash_rewrite_ops(FlashOps *ops, uint32_t start, uint32_t length,
 		      const void *buffer)
 {
@@ -86,33 +244,128 @@ int flash_rewrite_ops(FlashOps *ops, uint32_t start, uint32_t length,
 	uint32_t initial_start = ALIGN_DOWN(start, sector_size);
 	uint32_t final_end = ALIGN_UP(start + length, sector_size);
 	uint32_t full_length = final_end - initial_start;
-	if (initial_start != start || final_end != full_length) {
-		char *dev_buffer = flash_read_ops(ops, initial_start,
-						  full_length);
-		memcpy(dev_buffer + (start - initial_start), buffer, length);
-		buffer = dev_buffer;
-	}
-	int ret = flash_erase_ops(ops, initial_start, full_length);
-	if (ret != full_length) {
-		printf("rewriting SPI GPT failed in erase ret=%d\n", ret);
-		return ret;
+	uint32_t end = start + length;
+	const uint8_t *new = buffer;
+	uint8_t *old;
+	int force_erase;
+
+	old = flash_read_ops(ops, initial_start, full_length);
+	if (!old) {
+		printf("rewriting failed in read\n");
+		return -1;
 	}
-	ret = flash_write_ops(ops, initial_start, full_length, buffer);
-	if (ret != full_length) {
-		printf("rewriting failed in write ret=%d\n", ret);
-		/* Can't return ret directly because it might equal length
-		 * and be interpreted as success. */
-		return ret == length ? -1 : ret;
+
+	/* A buffer inside the read cache leaves nothing to compare against. */
+	force_erase = new >= old && new < old + full_length;
+
+	for (uint32_t sector = initial_start; sector < final_end;) {
+		uint32_t lo = MAX(start, sector);
+		uint32_t hi = MIN(end, sector + sector_size);
+		uint8_t *cur = old + (lo - initial_start);
+		const uint8_t *want = new + (lo - start);
+		uint32_t run_end;
+		int ret;
+
+		if (!force_erase && !flash_needs_erase(cur, want, hi - lo)) {
+			ops->rewrite.erases_avoided++;
+			if (flash_program_pages(ops, lo, hi - lo, want, cur))
+				return -1;
+			memcpy(cur, want, hi - lo);
+			sector += sector_size;
+			continue;
+		}
+
+		/*
+		 * Erase neighbouring sectors that need it in one go, so the
+		 * chip can use its larger block erases.
+		 */
+		for (run_end = sector + sector_size; run_end < final_end;
+		     run_end += sector_size) {
+			uint32_t next_hi = MIN(end, run_end + sector_size);
+
+			if (!force_erase &&
+			    !flash_needs_erase(old + (run_end - initial_start),
+					       new + (run_end - start),
+					       next_hi - run_end))
+				break;
+		}
+		hi = MIN(end, run_end);
+
+		/* Merge the new data into the sectors and write them back. */
+		memmove(cur, want, hi - lo);
+		ret = flash_erase_ops(ops, sector, run_end - sector);
+		if (ret != run_end - sector) {
+			printf("rewriting failed in erase ret=%d\n", ret);
+			return -1;
+		}
+		ops->rewrite.sectors_erased += (run_end - sector) / sector_size;
+		if (flash_program_pages(ops, sector, run_end - sector,
+					old + (sector - initial_start), NULL))
+			return -1;
+		sector = run_end;
 	}
+
+	flash_cache_fill(ops, initial_start, full_length, old);
 	return length;
 }
 
 static FlashOps *flash_ops;
 
+static int flash_cache_cleanup(struct CleanupFunc *cleanup, CleanupType type)
+{
+	flash_cache_print_stats();
+	return 0;
+}
+
+static CleanupFunc flash_cache_cleanup_func = {
+	.cleanup = &flash_cache_cleanup,
+	.types = CleanupOnHandoff | CleanupOnLegacy,
+};
+
 void flash_set_ops(FlashOps *ops)
 {
 	die_if(flash_ops, "Flash ops already set.\n");
 	flash_ops = ops;
+	if (ops->cache.valid)
+		list_insert_after(&flash_cache_cleanup_func.list_node,
+				  &cleanup_funcs);
+}
+
+void flash_cache_print_stats(void)
+{
+	if (!flash_ops)
+		return;
+
+	printf("Flash: %llu KiB read from the chip",
+	       flash_ops->cache.bytes_read / KiB);
+	if (flash_ops->cache.valid)
+		printf(", cache %u hits, %u misses",
+		       flash_ops->cache.hits, flash_ops->cache.misses);
+	printf(".\n");
+	if (flash_ops->rewrite.sectors_erased ||
+	    flash_ops->rewrite.erases_avoided)
+		printf("Flash: rewrites erased %u sectors, avoided %u erases, "
+		       "skipped %u pages.\n", flash_ops->rewrite.sectors_erased,
+		       flash_ops->rewrite.erases_avoided,
+		       flash_ops->rewrite.pages_skipped);
+}
+
+void flash_cache_drop(void)
+{
+	if (flash_ops)
+		flash_cache_invalidate(flash_ops, 0, flash_ops->cache.size);
+}
+
+void flash_cache_reset(void)
+{
+	if (!flash_ops)
+		return;
+
+	flash_cache_drop();
+	flash_ops->cache.hits = 0;
+	flash_ops->cache.misses = 0;
+	flash_ops->cache.bytes_read = 0;
+	memset(&flash_ops->rewrite, 0, sizeof(flash_ops->rewrite));
 }
 
 void *flash_read(uint32_t offset, uint32_t size)
@@ -59,6 +59,23 @@ typedef struct FlashOps
 	uint32_t sector_size;
 	/* Total number of sectors present */
 	uint32_t sector_count;
+
+	/* Read cache state, see flash_cache_init(). */
+	struct {
+		uint8_t *buffer;	/* what read() returns pointers into */
+		uint32_t size;
+		uint32_t *valid;	/* one bit per granule */
+		uint32_t hits;
+		uint32_t misses;
+		uint64_t bytes_read;	/* bytes fetched from the chip */
+	} cache;
+
+	/* What flash_rewrite_ops() did, and didn't have to do. */
+	struct {
+		uint32_t sectors_erased;
+		uint32_t erases_avoided;
+		uint32_t pages_skipped;	/* already held the new data */
+	} rewrite;
 } FlashOps;
 
 /* Functions operating on flash_ops */
@@ -82,6 +99,23 @@ int flash_erase_ops(FlashOps *ops, uint32_t offset, uint32_t size);
 int flash_rewrite_ops(FlashOps *ops, uint32_t start, uint32_t length,
 		      const void *buffer);
 
+/*
+ * Read cache. Drivers whose read() fills a buffer covering the whole flash
+ * and returns pointers into it pass that buffer to flash_cache_init(). From
+ * then on flash_read_ops() remembers which granules of the buffer hold
+ * current data and serves reads of those without going to the chip. Writes
+ * and erases through the functions above keep it up to date.
+ */
+void flash_cache_init(FlashOps *ops, void *buffer, uint32_t size);
+/* Forget the cached copy of a range, e.g. after changing it behind ops. */
+void flash_cache_invalidate(FlashOps *ops, uint32_t offset, uint32_t size);
+/* Print the read cache and rewrite counters of the main flash. */
+void flash_cache_print_stats(void);
+/* Drop everything cached for the main flash, keeping its counters. */
+void flash_cache_drop(void);
+/* Drop everything cached for the main flash and reset all its counters. */
+void flash_cache_reset(void);
+
 /* List of supported flashes terminated with a 0 filled element*/
 extern FlashProtectionMapping flash_protection_list[];
 
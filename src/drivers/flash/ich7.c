@@ -72,6 +72,7 @@ IchFlash *new_ich7_spi_flash(uint32_t rom_size)
 	flash->get_lock = &ich7_spi_get_lock;
 
 	flash->rom_size = rom_size;
+	flash_cache_init(&flash->ops, flash->cache, rom_size);
 
 	return flash;
 }
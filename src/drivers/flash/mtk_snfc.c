@@ -197,5 +197,6 @@ MtkNorFlash *new_mtk_nor_flash(uintptr_t reg_addr)
 	/* Provide sufficient alignment on the cache buffer so that the
 	   underlying SPI controllers can perform optimal DMA transfers. */
 	flash->buffer = xmemalign(1*KiB, rom_size);
+	flash_cache_init(&flash->ops, flash->buffer, rom_size);
 	return flash;
 }
@@ -26,34 +26,359 @@
 
 typedef enum {
 	ReadCommand = 3,
+	FastReadCommand = 0xb,
 	ReadSr1Command = 5,
+	ReadSr2Command = 0x35,
+	ReadSr2AltCommand = 0x3f,
+	ReadSfdpCommand = 0x5a,
 	WriteStatus = 1,
 	WriteCommand = 2,
 	WriteEnableCommand = 6,
+	ChipEraseCommand = 0xc7,
 	ReadId = 0x9f
 } SpiFlashCommands;
 
+/* Most mode and dummy bytes a read command may need. */
+#define SPI_FLASH_MAX_DUMMY	8
+
+#define SFDP_SIGNATURE		0x50444653	/* "SFDP" */
+#define SFDP_BASIC_TABLE_ID	0xff00
+
+/* Basic Flash Parameter Table fields, by dword index. */
+#define SFDP_DW1_ADDR_4BYTE_ONLY	(2 << 17)
+#define SFDP_DW1_ADDR_MASK		(3 << 17)
+#define SFDP_DW1_FAST_READ_112		(1 << 16)
+#define SFDP_DW1_FAST_READ_122		(1 << 20)
+#define SFDP_DW1_FAST_READ_144		(1 << 21)
+#define SFDP_DW1_FAST_READ_114		(1 << 22)
+#define SFDP_DW15_QER_SHIFT		20
+#define SFDP_DW15_QER_MASK		7
+
+/* Erase and program times: count + 1 units, max is 2 * (mult + 1) times. */
+#define SFDP_TIME(field, units)		((((field) & 0x1f) + 1) * (units))
+#define SFDP_MAX_TIME(typical, mult)	\
+	((uint64_t)(typical) * 2 * (((mult) & 0xf) + 1))
+
+static const uint32_t sfdp_erase_units_us[] = { 1000, 16000, 128000, 1000000 };
+static const uint32_t sfdp_chip_erase_units_us[] = {
+	16000, 256000, 4000000, 64000000
+};
+
+/*
+ * Run one command: send cmd, then read back data_size bytes if data isn't
+ * NULL. Everything is single bit.
+ */
+static int spi_flash_cmd(SpiFlash *flash, const void *cmd, uint32_t cmd_size,
+			 void *data, uint32_t data_size)
+{
+	int ret = -1;
+
+	if (flash->spi->start(flash->spi)) {
+		printf("%s: Failed to start transaction.\n", __func__);
+		return ret;
+	}
+
+	if (flash->spi->transfer(flash->spi, NULL, cmd, cmd_size)) {
+		printf("%s: Failed to send command %#x.\n", __func__,
+		       *(const uint8_t *)cmd);
+		goto fail;
+	}
+
+	if (data && flash->spi->transfer(flash->spi, data, NULL, data_size)) {
+		printf("%s: Failed to read %u bytes.\n", __func__, data_size);
+		goto fail;
+	}
+
+	ret = 0;
+ fail:
+	if (flash->spi->stop(flash->spi)) {
+		printf("%s: Failed to stop.\n", __func__);
+		ret = -1;
+	}
+	return ret;
+}
+
+static int spi_flash_read_reg(SpiFlash *flash, uint8_t command)
+{
+	uint8_t value;
+
+	if (spi_flash_cmd(flash, &command, sizeof(command),
+			  &value, sizeof(value)))
+		return -1;
+	return value;
+}
+
+static int spi_flash_read_sfdp(SpiFlash *flash, uint32_t offset, void *data,
+			       uint32_t size)
+{
+	/* Three address bytes and eight dummy clocks. */
+	uint8_t command[5] = { ReadSfdpCommand, offset >> 16, offset >> 8,
+			       offset, 0 };
+
+	return spi_flash_cmd(flash, command, sizeof(command), data, size);
+}
+
+/* Fetch the newest Basic Flash Parameter Table the part has, if any. */
+static void spi_flash_probe_sfdp(SpiFlash *flash)
+{
+	uint8_t header[8], table[SPI_FLASH_SFDP_DWORDS * 4];
+	uint32_t table_ptr = 0, table_dwords = 0;
+	int table_minor = -1;
+
+	if (spi_flash_read_sfdp(flash, 0, header, sizeof(header)) ||
+	    le32dec(header) != SFDP_SIGNATURE)
+		return;
+
+	/* Byte 6 is the number of parameter headers, minus one. */
+	for (int i = 0; i <= header[6]; i++) {
+		uint8_t param[8];
+
+		if (spi_flash_read_sfdp(flash, 8 + i * 8, param, sizeof(param)))
+			return;
+
+		/* ID in bytes 0 and 7, version minor.major in bytes 1-2. */
+		if ((param[0] | param[7] << 8) != SFDP_BASIC_TABLE_ID ||
+		    param[2] != 1 || param[1] < table_minor)
+			continue;
+
+		table_minor = param[1];
+		table_dwords = param[3];
+		table_ptr = param[4] | param[5] << 8 | param[6] << 16;
+	}
+
+	table_dwords = MIN(table_dwords, SPI_FLASH_SFDP_DWORDS);
+	if (!table_dwords ||
+	    spi_flash_read_sfdp(flash, table_ptr, table, table_dwords * 4))
+		return;
+
+	for (int i = 0; i < table_dwords; i++)
+		flash->sfdp[i] = le32dec(table + i * 4);
+	flash->sfdp_dwords = table_dwords;
+}
+
+static int spi_flash_width_ok(SpiFlash *flash, int width)
+{
+	switch (width) {
+	case 1:
+		return 1;
+	case 2:
+		return flash->spi->transfer_multi &&
+		       (flash->spi->multi_io & SPI_MULTI_IO_DUAL);
+	case 4:
+		return flash->spi->transfer_multi &&
+		       (flash->spi->multi_io & SPI_MULTI_IO_QUAD);
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Use a fast read described by one half of an SFDP read dword: dummy clocks
+ * in bits 4:0, mode clocks in 7:5 and the opcode in 15:8. The mode and dummy
+ * clocks go out on the address lines and have to add up to whole bytes.
+ */
+static int spi_flash_use_mode(SpiFlash *flash, int addr_width, int data_width,
+			      uint16_t params)
+{
+	uint32_t clocks = (params & 0x1f) + ((params >> 5) & 0x7);
+	uint32_t bits = clocks * addr_width;
+	uint8_t opcode = params >> 8;
+
+	if (!opcode || bits % 8 || bits / 8 > SPI_FLASH_MAX_DUMMY)
+		return 0;
+	if (!spi_flash_width_ok(flash, addr_width) ||
+	    !spi_flash_width_ok(flash, data_width))
+		return 0;
+
+	flash->read_mode.opcode = opcode;
+	flash->read_mode.addr_width = addr_width;
+	flash->read_mode.data_width = data_width;
+	flash->read_mode.dummy_bytes = bits / 8;
+	return 1;
+}
+
+/*
+ * Quad reads only work once the Quad Enable bit is set, and setting it is
+ * left to coreboot since it takes WP# and HOLD# away. DW15 says where it is.
+ */
+static int spi_flash_quad_enabled(SpiFlash *flash)
+{
+	int reg;
+
+	if (flash->sfdp_dwords < 15)
+		return 0;
+
+	switch ((flash->sfdp[14] >> SFDP_DW15_QER_SHIFT) &
+		SFDP_DW15_QER_MASK) {
+	case 0:
+		/* No QE bit, quad commands always work. */
+		return 1;
+	case 2:
+		reg = spi_flash_read_reg(flash, ReadSr1Command);
+		return reg >= 0 && (reg & (1 << 6));
+	case 5:
+	case 6:
+		reg = spi_flash_read_reg(flash, ReadSr2Command);
+		return reg >= 0 && (reg & (1 << 1));
+	case 3:
+		reg = spi_flash_read_reg(flash, ReadSr2AltCommand);
+		return reg >= 0 && (reg & (1 << 7));
+	default:
+		/*
+		 * 1 and 4 don't promise SR2 can be read with 0x35, and a
+		 * bad read could look like QE is set. Stay off quad.
+		 */
+		return 0;
+	}
+}
+
+static void spi_flash_add_erase(SpiFlash *flash, const SpiFlashErase *erase)
+{
+	int i = SPI_FLASH_ERASE_TYPES - 1;
+
+	if (flash->erase[i].size)
+		return;
+
+	/* Keep the list sorted, largest first. */
+	for (; i && flash->erase[i - 1].size < erase->size; i--)
+		flash->erase[i] = flash->erase[i - 1];
+	flash->erase[i] = *erase;
+}
+
+/*
+ * Collect the erase types (DW8-9) usable at our sector granularity, and
+ * the typical times of erases (DW10) and page programs and chip erase
+ * (DW11). Without SFDP only the sector erase from coreboot is known.
+ */
+static void spi_flash_probe_erase(SpiFlash *flash)
+{
+	uint32_t sector_size = flash->ops.sector_size;
+	uint32_t *dw = flash->sfdp;
+	SpiFlashErase sector = flash->erase[0];
+	int have_sector = 0;
+
+	if (flash->sfdp_dwords < 9)
+		return;
+
+	memset(flash->erase, 0, sizeof(flash->erase));
+	for (int i = 0; i < 4; i++) {
+		uint16_t type = dw[7 + i / 2] >> (i % 2 * 16);
+		SpiFlashErase erase = { .opcode = type >> 8 };
+
+		if (!(type & 0xff) || (type & 0xff) >= 32 || !erase.opcode)
+			continue;
+		erase.size = 1U << (type & 0xff);
+		if (erase.size % sector_size)
+			continue;
+
+		if (flash->sfdp_dwords >= 10) {
+			uint32_t time = dw[9] >> (4 + i * 7);
+
+			erase.time.typical_us = SFDP_TIME(time,
+				sfdp_erase_units_us[(time >> 5) & 3]);
+			erase.time.max_us = SFDP_MAX_TIME(
+				erase.time.typical_us, dw[9]);
+		}
+		have_sector |= erase.size == sector_size;
+		spi_flash_add_erase(flash, &erase);
+	}
+	if (!have_sector)
+		spi_flash_add_erase(flash, &sector);
+
+	if (flash->sfdp_dwords < 11)
+		return;
+
+	flash->program_time.typical_us =
+		SFDP_TIME(dw[10] >> 8, dw[10] & (1 << 13) ? 64 : 8);
+	flash->program_time.max_us =
+		SFDP_MAX_TIME(flash->program_time.typical_us, dw[10]);
+	flash->chip_erase_time.typical_us = SFDP_TIME(dw[10] >> 24,
+		sfdp_chip_erase_units_us[(dw[10] >> 29) & 3]);
+	/* Chip erase shares the erase multiplier in DW10, not DW11's. */
+	flash->chip_erase_time.max_us =
+		SFDP_MAX_TIME(flash->chip_erase_time.typical_us, dw[9]);
+}
+
+/*
+ * Pick the fastest read both the part and the controller can do, and the
+ * erases and timings to use.
+ */
+static void spi_flash_probe(SpiFlash *flash)
+{
+	uint32_t *dw = flash->sfdp;
+
+	flash->probed = 1;
+	spi_flash_probe_sfdp(flash);
+	spi_flash_probe_erase(flash);
+	if (flash->sfdp_dwords < 4 ||
+	    (dw[0] & SFDP_DW1_ADDR_MASK) == SFDP_DW1_ADDR_4BYTE_ONLY)
+		return;
+
+	int quad = spi_flash_quad_enabled(flash);
+
+	if ((quad && (dw[0] & SFDP_DW1_FAST_READ_144) &&
+	     spi_flash_use_mode(flash, 4, 4, dw[2])) ||
+	    (quad && (dw[0] & SFDP_DW1_FAST_READ_114) &&
+	     spi_flash_use_mode(flash, 1, 4, dw[2] >> 16)) ||
+	    ((dw[0] & SFDP_DW1_FAST_READ_122) &&
+	     spi_flash_use_mode(flash, 2, 2, dw[3] >> 16)) ||
+	    ((dw[0] & SFDP_DW1_FAST_READ_112) &&
+	     spi_flash_use_mode(flash, 1, 2, dw[3]))) {
+		printf("SPI flash: %d-%d-%d read, opcode %#x\n",
+		       1, flash->read_mode.addr_width,
+		       flash->read_mode.data_width, flash->read_mode.opcode);
+		return;
+	}
+
+	/* Every SFDP part has Fast Read, eight dummy clocks. */
+	spi_flash_use_mode(flash, 1, 1, FastReadCommand << 8 | 8);
+}
+
 static void *spi_flash_read(FlashOps *me, uint32_t offset, uint32_t size)
 {
 	SpiFlash *flash = container_of(me, SpiFlash, ops);
+	SpiFlashReadMode *mode = &flash->read_mode;
 	uint8_t *data = flash->cache + offset;
+	/* Mode bits and dummies are sent as zeroes. */
+	uint8_t command[4 + SPI_FLASH_MAX_DUMMY] = {};
+	uint32_t addr_size;
+	int ret;
 
 	assert(offset + size <= flash->rom_size);
 
+	if (!flash->probed)
+		spi_flash_probe(flash);
+
 	if (flash->spi->start(flash->spi)) {
 		printf("%s: Failed to start flash transaction.\n", __func__);
 		return NULL;
 	}
 
-	uint32_t command = htobe32((ReadCommand << 24) | offset);
-
-	if (flash->spi->transfer(flash->spi, NULL, &command, sizeof(command))) {
+	command[0] = mode->opcode;
+	command[1] = offset >> 16;
+	command[2] = offset >> 8;
+	command[3] = offset;
+	addr_size = 3 + mode->dummy_bytes;
+
+	if (mode->addr_width == 1)
+		ret = flash->spi->transfer(flash->spi, NULL, command,
+					   1 + addr_size);
+	else
+		ret = flash->spi->transfer(flash->spi, NULL, command, 1) ||
+		      flash->spi->transfer_multi(flash->spi, NULL, command + 1,
+						 addr_size, mode->addr_width);
+	if (ret) {
 		printf("%s: Failed to send read command.\n", __func__);
 		flash->spi->stop(flash->spi);
 		return NULL;
 	}
 
-	if (flash->spi->transfer(flash->spi, data, NULL, size)) {
+	if (mode->data_width == 1)
+		ret = flash->spi->transfer(flash->spi, data, NULL, size);
+	else
+		ret = flash->spi->transfer_multi(flash->spi, data, NULL, size,
+						 mode->data_width);
+	if (ret) {
 		printf("%s: Failed to receive %u bytes.\n", __func__, size);
 		flash->spi->stop(flash->spi);
 		return NULL;
@@ -85,10 +410,12 @@ static int toggle_cs(SpiFlash *flash, const char *phase)
 	return 0;
 }
 
-/* Allow up to 2s for a transaction to complete
- * This value is used for both write and erase */
+/* Allow at least 2s for a transaction to complete, or the worst case
+ * time from SFDP if that is longer. Status is checked about eight times
+ * over the typical time of the operation. */
 #define POLL_INTERVAL_US 10
-#define MAX_POLL_CYCLES (2000000/POLL_INTERVAL_US)
+#define MAX_POLL_INTERVAL_US (50 * 1000)
+#define MIN_POLL_TIMEOUT_US (2 * 1000 * 1000)
 #define SPI_FLASH_STATUS_WIP (1 << 0)
 #define SPANSION_FLASH_ERASE_ERR (1 << 5)
 #define SPANSION_FLASH_PROG_ERR (1 << 6)
@@ -135,11 +462,21 @@ static int check_error(SpiFlash *flash, uint8_t status)
  * Poll device status register until write/erase operation has completed or
  * timed out. Returns zero on success.
  */
-static int operation_failed(SpiFlash *flash, const char *opname)
+static int operation_failed(SpiFlash *flash, const char *opname,
+			    const SpiFlashOpTime *time)
 {
+	uint32_t interval = POLL_INTERVAL_US;
+	uint64_t timeout = MIN_POLL_TIMEOUT_US;
+	uint64_t start = timer_us(0);
 	uint8_t value;
 	int i = 0;
 
+	if (time && time->typical_us) {
+		interval = MIN(MAX(interval, time->typical_us / 8),
+			       MAX_POLL_INTERVAL_US);
+		timeout = MAX(timeout, time->max_us);
+	}
+
 	if (toggle_cs(flash, opname))
 		return -1;
 
@@ -150,7 +487,8 @@ static int operation_failed(SpiFlash *flash, const char *opname)
 		return -1;
 	}
 
-	while (i++ < MAX_POLL_CYCLES) {
+	do {
+		i++;
 		if (flash->spi->transfer(flash->spi, &value,
 					 NULL, sizeof(value))) {
 			printf("%s: Failed to read status after %d cycles.\n",
@@ -167,8 +505,8 @@ static int operation_failed(SpiFlash *flash, const char *opname)
 			return 0;
 		}
 
-		udelay(POLL_INTERVAL_US);
-	}
+		udelay(interval);
+	} while (timer_us(start) < timeout);
 	printf("%s: timeout waiting for %s completion\n", __func__, opname);
 	return -1;
 }
@@ -181,7 +519,7 @@ static int operation_failed(SpiFlash *flash, const char *opname)
  */
 static int spi_flash_modify(SpiFlash *flash, const void *buffer,
 			    uint32_t offset, uint32_t size, uint8_t opcode,
-			    const char *opname)
+			    const char *opname, const SpiFlashOpTime *time)
 {
 	union {
 		uint8_t bytes[4]; // We're using 3 byte addresses.
@@ -216,8 +554,10 @@ static int spi_flash_modify(SpiFlash *flash, const void *buffer,
 			break;
 
 		stop_needed = 1;
+		/* Chip erase takes no address, and is ignored with one. */
 		command.whole = htobe32((opcode << 24) | offset);
-		if (flash->spi->transfer(flash->spi, NULL, &command, 4)) {
+		if (flash->spi->transfer(flash->spi, NULL, &command,
+					 opcode == ChipEraseCommand ? 1 : 4)) {
 			printf("%s: Failed to send %s command.\n",
 			       __func__, opname);
 			break;
@@ -230,7 +570,7 @@ static int spi_flash_modify(SpiFlash *flash, const void *buffer,
 		}
 
 		stop_needed = 1;
-		if (!operation_failed(flash, opname))
+		if (!operation_failed(flash, opname, time))
 			rv = size;
 
 	} while(0);
@@ -252,6 +592,9 @@ static int spi_flash_write(FlashOps *me, const void *buffer,
 
 	assert(offset + size <= flash->rom_size);
 
+	if (!flash->probed)
+		spi_flash_probe(flash);
+
 	/* Write in chunks guaranteed not to cross page boundaries, */
 	while (size) {
 		uint32_t write_size, page_offset;
@@ -261,7 +604,8 @@ static int spi_flash_write(FlashOps *me, const void *buffer,
 			SPI_FLASH_WRITE_PAGE_LIMIT - page_offset : size;
 
 		if (spi_flash_modify(flash, buffer, offset, write_size,
-				     WriteCommand, "write") !=
+				     WriteCommand, "write",
+				     &flash->program_time) !=
 		    write_size)
 			break;
 
@@ -285,45 +629,40 @@ static int spi_flash_erase(FlashOps *me, uint32_t start, uint32_t size)
 		return -1;
 	}
 	assert(start + size <= flash->rom_size);
-	int offset;
-	for (offset = 0; offset < size; offset += sector_size) {
+
+	if (!flash->probed)
+		spi_flash_probe(flash);
+
+	if (start == 0 && size == flash->rom_size &&
+	    flash->chip_erase_time.typical_us) {
+		if (spi_flash_modify(flash, NULL, 0, 0, ChipEraseCommand,
+				     "chip erase", &flash->chip_erase_time))
+			return -1;
+		return size;
+	}
+
+	/* Always use the largest erase that fits, down to one sector. */
+	int offset = 0;
+	while (offset < size) {
+		const SpiFlashErase *erase = flash->erase;
+
+		while ((start + offset) % erase->size ||
+		       size - offset < erase->size)
+			erase++;
+
 		if (spi_flash_modify(flash, NULL, start + offset, 0,
-				     flash->erase_cmd, "erase"))
+				     erase->opcode, "erase", &erase->time))
 			break;
+		offset += erase->size;
 	}
 	return offset;
 }
 
 static int spi_flash_read_status(FlashOps *me)
 {
-	int ret = -1;
 	SpiFlash *flash = container_of(me, SpiFlash, ops);
 
-	uint8_t command;
-
-	if (flash->spi->start(flash->spi)) {
-		printf("%s: Failed to start transaction.\n", __func__);
-		return ret;
-	}
-
-	command = ReadSr1Command;
-	if (flash->spi->transfer(flash->spi, NULL, &command, sizeof(command))) {
-		printf("%s: Failed to send register read command.\n", __func__);
-		goto fail;
-	}
-
-	if (flash->spi->transfer(flash->spi, &command, NULL, sizeof(command))) {
-		printf("%s: Failed to read status.\n", __func__);
-		goto fail;
-	}
-
-	ret = command;
- fail:
-	if (flash->spi->stop(flash->spi)) {
-		printf("%s: Failed to stop.\n", __func__);
-		ret = -1;
-	}
-	return ret;
+	return spi_flash_read_reg(flash, ReadSr1Command);
 }
 
 static int spi_flash_write_status(FlashOps *me, uint8_t status)
@@ -345,7 +684,7 @@ static int spi_flash_write_status(FlashOps *me, uint8_t status)
 		goto fail;
 	}
 
-	if (operation_failed(flash, "WREN") != 0)
+	if (operation_failed(flash, "WREN", NULL) != 0)
 		goto fail;
 
 	/*
@@ -363,7 +702,7 @@ static int spi_flash_write_status(FlashOps *me, uint8_t status)
 		goto fail;
 	}
 
-	if (operation_failed(flash, "WRSTATUS") == 0)
+	if (operation_failed(flash, "WRSTATUS", NULL) == 0)
 		ret = 0;
 
  fail:
@@ -427,8 +766,14 @@ SpiFlash *new_spi_flash(SpiOps *spi)
 	flash->spi = spi;
 	flash->rom_size = rom_size;
 	flash->erase_cmd = erase_cmd;
+	flash->erase[0].size = sector_size;
+	flash->erase[0].opcode = erase_cmd;
+	flash->read_mode.opcode = ReadCommand;
+	flash->read_mode.addr_width = 1;
+	flash->read_mode.data_width = 1;
 	/* Provide sufficient alignment on the cache buffer so that the
 	 * underlying SPI controllers can perform optimal DMA transfers. */
 	flash->cache = xmemalign(1*KiB, rom_size);
+	flash_cache_init(&flash->ops, flash->cache, rom_size);
 	return flash;
 }
@@ -25,6 +25,36 @@
 struct SpiOps;
 typedef struct SpiOps SpiOps;
 
+/* How to issue a read: opcode, then address and data on 1, 2 or 4 lines. */
+typedef struct
+{
+	uint8_t opcode;
+	uint8_t addr_width;
+	uint8_t data_width;
+	uint8_t dummy_bytes;	/* mode and dummy clocks, at addr_width */
+} SpiFlashReadMode;
+
+/* Typical and worst case duration of a program or erase, 0 if unknown. */
+typedef struct
+{
+	uint32_t typical_us;
+	uint64_t max_us;
+} SpiFlashOpTime;
+
+/* One of the erase commands of the part. */
+typedef struct
+{
+	uint32_t size;		/* 0 for unused entries */
+	uint8_t opcode;
+	SpiFlashOpTime time;
+} SpiFlashErase;
+
+/* SFDP describes up to four, plus the sector erase coreboot reports. */
+#define SPI_FLASH_ERASE_TYPES	5
+
+/* Basic Flash Parameter Table dwords we know how to use (JESD216B). */
+#define SPI_FLASH_SFDP_DWORDS	16
+
 typedef struct
 {
 	FlashOps ops;
@@ -32,6 +62,16 @@ typedef struct
 	uint32_t rom_size;
 	uint8_t erase_cmd;
 	uint8_t *cache;
+
+	int probed;
+	SpiFlashReadMode read_mode;
+	uint8_t sfdp_dwords;	/* 0 if the part has no SFDP */
+	uint32_t sfdp[SPI_FLASH_SFDP_DWORDS];
+
+	/* Largest first, all multiples of ops.sector_size. */
+	SpiFlashErase erase[SPI_FLASH_ERASE_TYPES];
+	SpiFlashOpTime chip_erase_time;	/* chip erase only used if known */
+	SpiFlashOpTime program_time;	/* per page */
 } SpiFlash;
 
 SpiFlash *new_spi_flash(SpiOps *spi);
@@ -32,6 +32,22 @@ static int psci_off(PowerOps *me)
 	halt();
 }
 
+int psci_cpu_on(uint64_t mpidr, uintptr_t entry, uint64_t context)
+{
+	return smc(PSCI_CPU_ON, mpidr, entry, context);
+}
+
+void psci_cpu_off(void)
+{
+	smc(PSCI_CPU_OFF, 0, 0, 0);
+	halt();
+}
+
+int psci_affinity_info(uint64_t mpidr)
+{
+	return smc(PSCI_AFFINITY_INFO, mpidr, 0, 0);
+}
+
 PowerOps psci_power_ops = {
 	.cold_reboot = &psci_reset,
 	.power_off = &psci_off,
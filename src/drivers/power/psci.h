@@ -18,8 +18,23 @@
 #ifndef __DRIVERS_POWER_PSCI_H__
 #define __DRIVERS_POWER_PSCI_H__
 
+#include <stdint.h>
+
 #include "drivers/power/power.h"
 
 PowerOps psci_power_ops;
 
+enum {
+	PSCI_RET_SUCCESS = 0,
+	PSCI_AFFINITY_ON = 0,
+	PSCI_AFFINITY_OFF = 1,
+};
+
+/* Start the CPU with the given MPIDR at entry, with context in x0. */
+int psci_cpu_on(uint64_t mpidr, uintptr_t entry, uint64_t context);
+/* Power off the calling CPU. */
+void psci_cpu_off(void) __attribute__((noreturn));
+/* Return PSCI_AFFINITY_ON/OFF or another state for the CPU. */
+int psci_affinity_info(uint64_t mpidr);
+
 #endif /* __DRIVERS_POWER_PSCI_H__ */
@@ -154,16 +154,23 @@ static int ahci_fill_sg(AhciSg *sg, void *buf, int len)
 }
 
 
-static void ahci_fill_cmd_slot(AhciIoPort *pp, uint32_t opts)
+static void *ahci_cmd_tbl(AhciIoPort *pp, int slot)
 {
-	pp->cmd_slot->opts = htolel(opts);
-	pp->cmd_slot->status = 0;
-	pp->cmd_slot->tbl_addr = htolel((uint32_t)(uintptr_t)pp->cmd_tbl);
-	pp->cmd_slot->tbl_addr_hi = 0;
+	return (uint8_t *)pp->cmd_tbl + slot * AHCI_CMD_TBL_SZ;
 }
 
+static void ahci_fill_cmd_slot(AhciIoPort *pp, int slot, uint32_t opts)
+{
+	AhciCommandHeader *hdr = &pp->cmd_slot[slot];
+
+	hdr->opts = htolel(opts);
+	hdr->status = 0;
+	hdr->tbl_addr = htolel((uint32_t)(uintptr_t)ahci_cmd_tbl(pp, slot));
+	hdr->tbl_addr_hi = 0;
+}
 
-static int ahci_port_start(AhciIoPort *port, int index)
+
+static int ahci_port_start(AhciIoPort *port, int index, int n_slots)
 {
 	uint8_t *port_mmio = port->port_mmio;
 
@@ -176,19 +183,20 @@ static int ahci_port_start(AhciIoPort *port, int index)
 		return -1;
 	}
 
-	uint8_t *mem = memalign(2048, AHCI_PORT_PRIV_DMA_SZ);
+	uint8_t *mem = memalign(2048, AHCI_PORT_PRIV_DMA_SZ(n_slots));
 	if (!mem) {
 		printf("No mem for table!\n");
 		return -1;
 	}
-	memset(mem, 0, AHCI_PORT_PRIV_DMA_SZ);
+	memset(mem, 0, AHCI_PORT_PRIV_DMA_SZ(n_slots));
+	port->n_slots = n_slots;
 
 	/*
-	 * First item in chunk of DMA memory: 32-slot command table,
+	 * First item in chunk of DMA memory: 32-slot command list,
 	 * 32 bytes each in size
 	 */
 	port->cmd_slot = (AhciCommandHeader *)mem;
-	mem += (AHCI_CMD_SLOT_SZ + 224);
+	mem += AHCI_CMD_LIST_SZ;
 
 	/*
 	 * Second item: Received-FIS area
@@ -197,13 +205,11 @@ static int ahci_port_start(AhciIoPort *port, int index)
 	mem += AHCI_RX_FIS_SZ;
 
 	/*
-	 * Third item: data area for storing a single command
-	 * and its scatter-gather table
+	 * Third item: data area for storing one command and its
+	 * scatter-gather table per command slot
 	 */
 	port->cmd_tbl = mem;
-	mem += AHCI_CMD_TBL_HDR;
-
-	port->cmd_tbl_sg = (AhciSg *)mem;
+	port->cmd_tbl_sg = (AhciSg *)(mem + AHCI_CMD_TBL_HDR);
 	writel_with_flush((uintptr_t)port->cmd_slot, port_mmio + PORT_LST_ADDR);
 	writel_with_flush((uintptr_t)0, port_mmio + PORT_LST_ADDR_HI);
 
@@ -236,7 +242,7 @@ static int ahci_device_data_io(AhciIoPort *port, void *fis, int fis_len,
 	if (buf && buf_len)
 		sg_count = ahci_fill_sg(port->cmd_tbl_sg, buf, buf_len);
 	uint32_t opts = (fis_len >> 2) | (sg_count << 16) | (is_write << 6);
-	ahci_fill_cmd_slot(port, opts);
+	ahci_fill_cmd_slot(port, 0, opts);
 
 	writel_with_flush(1, port_mmio + PORT_CMD_ISSUE);
 
@@ -250,92 +256,428 @@ static int ahci_device_data_io(AhciIoPort *port, void *fis, int fis_len,
 }
 
 /*
- * In the general case of generic rotating media it makes sense to have a
- * flush capability. It probably even makes sense in the case of SSDs because
- * one cannot always know for sure what kind of internal cache/flush mechanism
- * is embodied therein.  Because writing to the disk in u-boot is very rare,
- * this flush command will be invoked after every block write.
+ * Some controllers limit number of blocks they can read/write at once.
+ * Contemporary SSD devices work much faster if the read/write size is aligned
+ * to a power of 2. Default to the largest count a 48-bit command can carry,
+ * 65536 blocks (encoded as 0), which the PRDT covers with a few 4MB entries.
+ * This can be overwritten if needed.
  */
-static int ahci_io_flush(AhciIoPort *port)
+#ifndef MAX_SATA_BLOCKS_READ_WRITE
+#define MAX_SATA_BLOCKS_READ_WRITE	0x10000
+#endif
+
+/* Largest number of blocks one command's PRDT can describe. */
+static uint32_t ahci_max_blocks(SataDrive *drive)
+{
+	uint32_t sg_blocks = AHCI_MAX_SG * MAX_DATA_BYTE_COUNT /
+			     drive->dev.block_size;
+
+	return MIN(MAX_SATA_BLOCKS_READ_WRITE, sg_blocks);
+}
+
+static void ahci_port_stop(AhciIoPort *port)
+{
+	uint8_t *port_mmio = port->port_mmio;
+	uint32_t port_cmd = readl(port_mmio + PORT_CMD);
+
+	writel_with_flush(port_cmd & ~PORT_CMD_START, port_mmio + PORT_CMD);
+	if (WAIT_WHILE((readl(port_mmio + PORT_CMD) & PORT_CMD_LIST_ON), 500))
+		printf("AHCI: port %d command list did not stop.\n",
+		       port->index);
+}
+
+static void ahci_port_restart(AhciIoPort *port)
+{
+	uint8_t *port_mmio = port->port_mmio;
+
+	uint32_t port_scr_err = readl(port_mmio + PORT_SCR_ERR);
+	if (port_scr_err)
+		writel(port_scr_err, port_mmio + PORT_SCR_ERR);
+	uint32_t port_irq_stat = readl(port_mmio + PORT_IRQ_STAT);
+	if (port_irq_stat)
+		writel(port_irq_stat, port_mmio + PORT_IRQ_STAT);
+
+	writel_with_flush(readl(port_mmio + PORT_CMD) | PORT_CMD_START,
+			  port_mmio + PORT_CMD);
+}
+
+/* Reset the link of a stopped port and wait for the drive to be ready. */
+static void ahci_port_comreset(AhciIoPort *port)
 {
+	uint8_t *port_mmio = port->port_mmio;
+	uint32_t port_scr_ctl = readl(port_mmio + PORT_SCR_CTL) & ~0xf;
+
+	printf("AHCI: resetting the link on port %d.\n", port->index);
+
+	// DET = 1 sends COMRESET for as long as it is set, at least 1ms.
+	writel_with_flush(port_scr_ctl | 0x1, port_mmio + PORT_SCR_CTL);
+	mdelay(1);
+	writel_with_flush(port_scr_ctl, port_mmio + PORT_SCR_CTL);
+
+	if (WAIT_WHILE((readl(port_mmio + PORT_SCR_STAT) & 0xf) != 0x3,
+		       100)) {
+		printf("AHCI: no link on port %d after reset.\n",
+		       port->index);
+		return;
+	}
+
+	// The reset leaves SError bits set that keep PxTFD from updating.
+	writel(readl(port_mmio + PORT_SCR_ERR), port_mmio + PORT_SCR_ERR);
+	for (int i = 0; i < wait_ms_spinup; i++) {
+		if (!(readl(port_mmio + PORT_TFDATA) &
+		      (ATA_STAT_BUSY | ATA_STAT_DRQ)))
+			return;
+		mdelay(1);
+	}
+	printf("AHCI: drive on port %d still busy after reset.\n",
+	       port->index);
+}
+
+/*
+ * A drive that saw a queued command fail accepts no more commands until
+ * the host has read the NCQ Command Error log page, which also tells which
+ * tag failed and why.
+ */
+static int ahci_read_ncq_error_log(AhciIoPort *port)
+{
+	uint8_t *port_mmio = port->port_mmio;
+	uint16_t log[256];
+	uint8_t *page = (uint8_t *)log;
 	uint8_t fis[20];
 
-	// Set up the FIS.
 	memset(fis, 0, 20);
 	fis[0] = 0x27;		 // Host to device FIS.
 	fis[1] = 1 << 7;	 // Command FIS.
-	fis[2] = ATA_CMD_FLUSH_CACHE_EXT;
-
-	if (ahci_device_data_io(port, fis, 20, NULL, 0, 1,
-				wait_ms_flush) < 0) {
-		printf("AHCI: Flush command failed.\n");
+	fis[2] = ATA_CMD_READ_LOG_EXT;
+	fis[4] = ATA_LOG_NCQ_ERROR;	 // Log address.
+	fis[12] = 1;		 // Page count.
+
+	if (ahci_device_data_io(port, fis, 20, log, sizeof(log), 0,
+				wait_ms_dataio) ||
+	    (readl(port_mmio + PORT_TFDATA) & (ATA_STAT_BUSY | ATA_STAT_DRQ |
+					       ATA_STAT_ERR))) {
+		printf("AHCI: can't read the NCQ error log on port %d.\n",
+		       port->index);
 		return -1;
 	}
 
+	if (!(page[0] & ATA_NCQ_LOG_NQ))
+		printf("AHCI: port %d tag %d failed, status %#x, "
+		       "error %#x.\n", port->index,
+		       page[0] & ATA_NCQ_LOG_TAG_MASK, page[2], page[3]);
 	return 0;
 }
 
 /*
- * Some controllers limit number of blocks they can read/write at once.
- * Contemporary SSD devices work much faster if the read/write size is aligned
- * to a power of 2.  Let's set default to 128 and allowing to be overwritten if
- * needed.
+ * Stop and restart the port's command engine. This aborts every outstanding
+ * command and clears PxSACT/PxCI, which is the only way out of a failed
+ * queued command. A drive left with BSY or DRQ set gets a COMRESET while
+ * the engine is stopped. After an NCQ error the drive's error log is read
+ * to get it to accept commands again, with a COMRESET if that fails too.
  */
-#ifndef MAX_SATA_BLOCKS_READ_WRITE
-#define MAX_SATA_BLOCKS_READ_WRITE	0x80
-#endif
+static void ahci_port_recover(AhciIoPort *port, int ncq_error)
+{
+	uint8_t *port_mmio = port->port_mmio;
 
-static int ahci_read_write(SataDrive *drive, lba_t start, uint16_t count,
-			   void *buf, int is_write)
+	ahci_port_stop(port);
+	if (readl(port_mmio + PORT_TFDATA) & (ATA_STAT_BUSY | ATA_STAT_DRQ)) {
+		// A reset also clears the drive's NCQ error state.
+		ahci_port_comreset(port);
+		ncq_error = 0;
+	}
+	ahci_port_restart(port);
+
+	if (ncq_error && ahci_read_ncq_error_log(port)) {
+		ahci_port_stop(port);
+		ahci_port_comreset(port);
+		ahci_port_restart(port);
+	}
+}
+
+static void ahci_fill_fpdma_fis(uint8_t *fis, lba_t start, uint32_t count,
+				int tag, int is_write)
 {
-	uint8_t fis[20];
+	memset(fis, 0, 20);
+	fis[0] = 0x27;		 // Host to device FIS.
+	fis[1] = 1 << 7;	 // Command FIS.
+	fis[2] = is_write ? ATA_CMD_WRITE_FPDMA_QUEUED :
+		ATA_CMD_READ_FPDMA_QUEUED;
+
+	// Block count goes in the features registers.
+	fis[3] = (count >> 0) & 0xff;
+	fis[11] = (count >> 8) & 0xff;
+
+	fis[4] = (start >> 0) & 0xff;
+	fis[5] = (start >> 8) & 0xff;
+	fis[6] = (start >> 16) & 0xff;
+	fis[7] = 1 << 6; /* device reg: set LBA mode */
+	fis[8] = (start >> 24) & 0xff;
+	fis[9] = (start >> 32) & 0xff;
+	fis[10] = (start >> 40) & 0xff;
+
+	// The tag goes in the sector count register.
+	fis[12] = tag << 3;
+}
 
-	// Set up the FIS.
+static void ahci_fill_dma_fis(uint8_t *fis, lba_t start, uint32_t count,
+			      int is_write)
+{
 	memset(fis, 0, 20);
 	fis[0] = 0x27;		 // Host to device FIS.
 	fis[1] = 1 << 7;	 // Command FIS.
-	// Command byte
-	fis[2] = is_write ? ATA_CMD_WRITE_SECTORS_EXT :
-		ATA_CMD_READ_SECTORS_EXT;
-
-	while (count) {
-		uint16_t tblocks = MIN(MAX_SATA_BLOCKS_READ_WRITE, count);
-		uintptr_t tsize = tblocks * drive->dev.block_size;
-
-		// LBA48 SATA command using 32bit address range.
-		fis[3] = 0xe0; /* features */
-		fis[4] = (start >> 0) & 0xff;
-		fis[5] = (start >> 8) & 0xff;
-		fis[6] = (start >> 16) & 0xff;
-		fis[7] = 1 << 6; /* device reg: set LBA mode */
-		fis[8] = ((start >> 24) & 0xff);
-
-		// Block count.
-		fis[12] = (tblocks >> 0) & 0xff;
-		fis[13] = (tblocks >> 8) & 0xff;
-
-		// Read/write from AHCI.
-		if (ahci_device_data_io(drive->port, fis, sizeof(fis), buf,
-					tsize, is_write, wait_ms_dataio)) {
-			printf("AHCI: %s command failed.\n",
-			      is_write ? "write" : "read");
-			return -1;
+	// Command byte. DMA lets the HBA move the whole multi-entry PRDT
+	// without a PIO Setup FIS handshake per DRQ block.
+	fis[2] = is_write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT;
+
+	// LBA48 SATA command.
+	fis[3] = 0xe0; /* features */
+	fis[4] = (start >> 0) & 0xff;
+	fis[5] = (start >> 8) & 0xff;
+	fis[6] = (start >> 16) & 0xff;
+	fis[7] = 1 << 6; /* device reg: set LBA mode */
+	fis[8] = (start >> 24) & 0xff;
+	fis[9] = (start >> 32) & 0xff;
+	fis[10] = (start >> 40) & 0xff;
+
+	// Block count, 0 means 65536.
+	fis[12] = (count >> 0) & 0xff;
+	fis[13] = (count >> 8) & 0xff;
+}
+
+/*
+ * Hand chunks of the queued requests to the HBA. With Native Command
+ * Queuing every tag the drive and HBA support is kept busy with a READ/WRITE
+ * FPDMA QUEUED command; the drive clears a tag's PxSACT bit through a Set
+ * Device Bits FIS once the command is done, at which point the tag is
+ * refilled with the next chunk. Without NCQ only slot 0 is used.
+ */
+static void ahci_issue_requests(AhciIoPort *port)
+{
+	uint8_t *port_mmio = port->port_mmio;
+	uint32_t all_tags = !port->ncq_depth ? 1 :
+			    port->ncq_depth == 32 ? ~0U :
+			    (1U << port->ncq_depth) - 1;
+	uint32_t issue = 0;
+	BlockDevRequest *req;
+
+	// Drop stale status so only errors from this batch are seen.
+	if (!port->busy) {
+		uint32_t port_irq_stat = readl(port_mmio + PORT_IRQ_STAT);
+		if (port_irq_stat)
+			writel(port_irq_stat, port_mmio + PORT_IRQ_STAT);
+	}
+
+	list_for_each(req, port->requests, list_node) {
+		SataDrive *drive = container_of(req->dev, SataDrive, dev);
+		unsigned block_size = drive->dev.block_size;
+
+		while (!req->status && req->submitted < req->count &&
+		       (port->busy | issue) != all_tags) {
+			int tag = __ffs(~(port->busy | issue) & all_tags);
+			uint32_t tblocks = MIN(ahci_max_blocks(drive),
+					       req->count - req->submitted);
+			uintptr_t tsize = tblocks * block_size;
+			lba_t start = req->start + req->submitted;
+			uint8_t *buf = (uint8_t *)req->buffer +
+				       req->submitted * block_size;
+			uint8_t *tbl = ahci_cmd_tbl(port, tag);
+
+			if (port->ncq_depth)
+				ahci_fill_fpdma_fis(tbl, start, tblocks, tag,
+						    req->is_write);
+			else
+				ahci_fill_dma_fis(tbl, start, tblocks,
+						  req->is_write);
+			int sg_count = ahci_fill_sg(
+				(AhciSg *)(tbl + AHCI_CMD_TBL_HDR), buf, tsize);
+			if (sg_count < 0) {
+				// Let the commands already issued finish.
+				req->status = -1;
+				break;
+			}
+			ahci_fill_cmd_slot(port, tag, (20 >> 2) |
+					   (sg_count << 16) |
+					   (req->is_write << 6));
+
+			port->tag_req[tag] = req;
+			issue |= 1U << tag;
+			req->submitted += tblocks;
+			req->pending++;
 		}
 
-		// Flush writes.
-		if (is_write) {
-			if (ahci_io_flush(drive->port) < 0)
-				return -1;
+		if ((port->busy | issue) == all_tags)
+			break;
+	}
+
+	if (issue) {
+		// PxSACT must be set before a queued command is issued.
+		if (port->ncq_depth)
+			writel(issue, port_mmio + PORT_SCR_ACT);
+		writel_with_flush(issue, port_mmio + PORT_CMD_ISSUE);
+		port->busy |= issue;
+	}
+}
+
+/* Abort everything in flight on the port and fail the requests it was for. */
+static void ahci_fail_busy(AhciIoPort *port, int ncq_error)
+{
+	ahci_port_recover(port, ncq_error);
+	while (port->busy) {
+		int tag = __ffs(port->busy);
+		BlockDevRequest *req = port->tag_req[tag];
+
+		req->status = -1;
+		req->pending--;
+		port->tag_req[tag] = NULL;
+		port->busy &= ~(1U << tag);
+	}
+}
+
+/* Retire finished commands and requests without waiting, then refill. */
+static void ahci_port_poll(AhciIoPort *port)
+{
+	uint8_t *port_mmio = port->port_mmio;
+	BlockDevRequest *req;
+
+	if (port->busy) {
+		uint32_t port_irq_stat = readl(port_mmio + PORT_IRQ_STAT);
+		uint32_t active = readl(port_mmio + PORT_SCR_ACT) |
+				  readl(port_mmio + PORT_CMD_ISSUE);
+		uint32_t done = port->busy & ~active;
+
+		// Commands that got through count even if another failed.
+		if (done) {
+			port->busy &= ~done;
+			while (done) {
+				int tag = __ffs(done);
+				port->tag_req[tag]->pending--;
+				port->tag_req[tag] = NULL;
+				done &= ~(1U << tag);
+			}
+			port->last_progress = timer_us(0);
+		}
+
+		if (port_irq_stat & PORT_IRQ_FATAL) {
+			printf("AHCI: port %d I/O failed, TFD %#x.\n",
+			       port->index, readl(port_mmio + PORT_TFDATA));
+			ahci_fail_busy(port, port->ncq_depth &&
+				       (port_irq_stat & PORT_IRQ_TF_ERR));
+		} else if (port->busy && timer_us(port->last_progress) >
+			   wait_ms_dataio * USECS_PER_MSEC) {
+			printf("AHCI: I/O timeout!\n");
+			ahci_fail_busy(port, 0);
 		}
+	}
+
+	// Complete requests with nothing left to do.
+	ListNode *node = port->requests.next;
+	while (node) {
+		req = container_of(node, BlockDevRequest, list_node);
+		node = node->next;
+		if (req->pending)
+			continue;
+		if (!req->status && req->submitted < req->count)
+			continue;
+		list_remove(&req->list_node);
+		blockdev_complete(req, req->status);
+	}
+
+	ahci_issue_requests(port);
+}
+
+static int ahci_submit(BlockDevOps *me, BlockDevRequest *req)
+{
+	SataDrive *drive = container_of(me, SataDrive, dev.ops);
+	AhciIoPort *port = drive->port;
 
-		buf = (uint8_t *)buf + tsize;
-		count -= tblocks;
-		start += tblocks;
+	uint32_t port_status = readl(port->port_mmio + PORT_SCR_STAT);
+	if ((port_status & 0xf) != 0x3) {
+		printf("No link on port %d!\n", port->index);
+		return -1;
 	}
 
+	if (!port->busy)
+		port->last_progress = timer_us(0);
+	list_append(&req->list_node, &port->requests);
+	ahci_issue_requests(port);
 	return 0;
 }
 
+static void ahci_poll(BlockDevOps *me)
+{
+	SataDrive *drive = container_of(me, SataDrive, dev.ops);
+
+	ahci_port_poll(drive->port);
+}
+
+/* Commands already handed to the HBA are left to finish. */
+static void ahci_cancel(BlockDevOps *me, BlockDevRequest *req)
+{
+	req->status = -1;
+}
+
+static int ahci_read_write(SataDrive *drive, lba_t start, lba_t count,
+			   void *buf, int is_write)
+{
+	BlockDevRequest req = {
+		.start = start,
+		.count = count,
+		.buffer = buf,
+		.is_write = is_write,
+	};
+
+	if (blockdev_submit(&drive->dev, &req) ||
+	    blockdev_wait(&drive->dev, &req)) {
+		printf("AHCI: %s command failed.\n",
+		       is_write ? "write" : "read");
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * In the general case of generic rotating media it makes sense to have a
+ * flush capability. It probably even makes sense in the case of SSDs because
+ * one cannot always know for sure what kind of internal cache/flush mechanism
+ * is embodied therein. This flush command is invoked once at the end of every
+ * write call, or, with CONFIG_DRIVER_AHCI_WRITE_BACK, only once when
+ * depthcharge cleans up before leaving.
+ */
+static int ahci_io_flush(AhciIoPort *port)
+{
+	uint8_t fis[20];
+
+	// The flush goes through slot 0, wait for queued requests first.
+	while (port->busy || port->requests.next)
+		ahci_port_poll(port);
+
+	// Set up the FIS.
+	memset(fis, 0, 20);
+	fis[0] = 0x27;		 // Host to device FIS.
+	fis[1] = 1 << 7;	 // Command FIS.
+	fis[2] = ATA_CMD_FLUSH_CACHE_EXT;
+
+	if (ahci_device_data_io(port, fis, 20, NULL, 0, 1,
+				wait_ms_flush) < 0) {
+		printf("AHCI: Flush command failed.\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Flush the write cache now, or just note that it is dirty in write-back
+ * mode so that ahci_exit() flushes it. */
+static int ahci_write_done(AhciIoPort *port)
+{
+	if (CONFIG(DRIVER_AHCI_WRITE_BACK)) {
+		port->dirty = 1;
+		return 0;
+	}
+	return ahci_io_flush(port);
+}
+
 static lba_t ahci_read(BlockDevOps *me, lba_t start, lba_t count, void *buffer)
 {
 	SataDrive *drive = container_of(me, SataDrive, dev.ops);
@@ -350,7 +692,8 @@ static lba_t ahci_write(BlockDevOps *me, lba_t start, lba_t count,
 			const void *buffer)
 {
 	SataDrive *drive = container_of(me, SataDrive, dev.ops);
-	if (ahci_read_write(drive, start, count, (void *)buffer, 1)) {
+	if (ahci_read_write(drive, start, count, (void *)buffer, 1) ||
+	    ahci_write_done(drive->port)) {
 		printf("AHCI: Write failed.\n");
 		return -1;
 	}
@@ -416,19 +759,17 @@ static int ahci_identify(AhciIoPort *port, AtaIdentify *id)
 	return ret;
 }
 
-static int ahci_read_capacity(AhciIoPort *port, lba_t *cap,
+static int ahci_read_capacity(AhciIoPort *port, AtaIdentify *id, lba_t *cap,
 			      unsigned *block_size)
 {
-	AtaIdentify id;
-
-	if (ahci_identify(port, &id))
+	if (ahci_identify(port, id))
 		return -1;
 
 	uint32_t cap32;
-	memcpy(&cap32, &id.sectors28, sizeof(cap32));
+	memcpy(&cap32, &id->sectors28, sizeof(cap32));
 	*cap = letohl(cap32);
 	if (*cap == 0xfffffff) {
-		memcpy(cap, id.sectors48, sizeof(*cap));
+		memcpy(cap, id->sectors48, sizeof(*cap));
 		*cap = letohll(*cap);
 	}
 
@@ -448,6 +789,13 @@ static int ahci_exit(struct CleanupFunc *cleanup, CleanupType type)
 		return 0;
 	}
 
+	/* Commit anything still sitting in a drive's write cache. */
+	for (int p = 0; p < AHCI_MAX_PORTS; p++) {
+		AhciIoPort *port = &ctrlr->ports[p];
+		if (port->dirty && ahci_io_flush(port) == 0)
+			port->dirty = 0;
+	}
+
 	host_impl_bitmap = readl(mmio + HOST_PORTS_IMPL);
 
 	printf("Clear pending AHCI interrupt status.\n");
@@ -645,16 +993,25 @@ static int ahci_ctrlr_init(BlockDevCtrlrOps *me)
 	for (int i = 0; i < sizeof(linkmap) * 8; i++) {
 		if (((linkmap >> i) & 0x1)) {
 			AhciIoPort *port = &ctrlr->ports[i];
-			if (ahci_port_start(port, i)) {
+			if (ahci_port_start(port, i,
+					    HOST_CAP_NCS(ctrlr->cap))) {
 				printf("Can not start port %d\n", i);
 				continue;
 			}
+			AtaIdentify id;
 			lba_t cap;
 			unsigned block_size;
-			if (ahci_read_capacity(port, &cap, &block_size)) {
+			if (ahci_read_capacity(port, &id, &cap, &block_size)) {
 				printf("Can't read port %d's capacity.\n", i);
 				continue;
 			}
+			if ((ctrlr->cap & HOST_CAP_NCQ) &&
+			    (le16toh(id.sata_capabilities) & ATA_SATA_CAP_NCQ)) {
+				port->ncq_depth = MIN(port->n_slots,
+					ATA_QUEUE_DEPTH(le16toh(id.queue_depth)));
+				printf("Port %d NCQ depth %d.\n", i,
+				       port->ncq_depth);
+			}
 
 			SataDrive *sata_drive = xzalloc(sizeof(*sata_drive));
 			static const int name_size = 18;
@@ -663,12 +1020,17 @@ static int ahci_ctrlr_init(BlockDevCtrlrOps *me)
 			sata_drive->dev.ops.read = &ahci_read;
 			sata_drive->dev.ops.write = &ahci_write;
 			sata_drive->dev.ops.new_stream = &new_simple_stream;
+			sata_drive->dev.ops.submit = &ahci_submit;
+			sata_drive->dev.ops.poll = &ahci_poll;
+			sata_drive->dev.ops.cancel = &ahci_cancel;
 			sata_drive->dev.name = name;
 			sata_drive->dev.removable = 0;
 			sata_drive->dev.block_size = block_size;
 			sata_drive->dev.block_count = cap;
 			sata_drive->ctrlr = ctrlr;
 			sata_drive->port = port;
+			sata_drive->dev.readahead_blocks =
+				ahci_max_blocks(sata_drive);
 			list_insert_after(&sata_drive->dev.list_node,
 					  &fixed_block_devices);
 		}
@@ -679,6 +1041,8 @@ static int ahci_ctrlr_init(BlockDevCtrlrOps *me)
 	CleanupFunc *cleanup = xzalloc(sizeof(*cleanup));
 	cleanup->cleanup = &ahci_exit;
 	cleanup->types = CleanupOnHandoff | CleanupOnLegacy;
+	if (CONFIG(DRIVER_AHCI_WRITE_BACK))
+		cleanup->types |= CleanupOnReboot | CleanupOnPowerOff;
 	cleanup->data = ctrlr;
 	list_insert_after(&cleanup->list_node, &cleanup_funcs);
 
@@ -27,13 +27,16 @@
 
 #define AHCI_PCI_BAR		0x24
 #define AHCI_MAX_SG		56 /* hardware max is 64K */
+#define AHCI_MAX_CMD_SLOTS	32
 #define AHCI_CMD_SLOT_SZ	32
+#define AHCI_CMD_LIST_SZ	(AHCI_MAX_CMD_SLOTS * AHCI_CMD_SLOT_SZ)
 #define AHCI_RX_FIS_SZ		256
 #define AHCI_CMD_TBL_HDR	0x80
 #define AHCI_CMD_TBL_CDB	0x40
-#define AHCI_CMD_TBL_SZ		AHCI_CMD_TBL_HDR + (AHCI_MAX_SG * 16)
-#define AHCI_PORT_PRIV_DMA_SZ	AHCI_CMD_SLOT_SZ + AHCI_CMD_TBL_SZ	\
-				+ AHCI_RX_FIS_SZ
+#define AHCI_CMD_TBL_SZ		(AHCI_CMD_TBL_HDR + (AHCI_MAX_SG * 16))
+/* Command list, received FIS area and one command table per slot */
+#define AHCI_PORT_PRIV_DMA_SZ(slots)	(AHCI_CMD_LIST_SZ + AHCI_RX_FIS_SZ \
+					 + (slots) * AHCI_CMD_TBL_SZ)
 #define AHCI_CMD_ATAPI		(1 << 5)
 #define AHCI_CMD_WRITE		(1 << 6)
 #define AHCI_CMD_PREFETCH	(1 << 7)
@@ -50,6 +53,10 @@
 #define HOST_VERSION		0x10 /* AHCI spec. version compliancy */
 #define HOST_CAP2		0x24 /* host capabilities, extended */
 
+/* HOST_CAP bits */
+#define HOST_CAP_NCQ		(1 << 30) /* native command queuing */
+#define HOST_CAP_NCS(cap)	((((cap) >> 8) & 0x1f) + 1) /* command slots */
+
 /* HOST_CTL bits */
 #define HOST_RESET		(1 << 0)  /* reset controller; self-clear */
 #define HOST_IRQ_EN		(1 << 1)  /* global IRQ enable */
@@ -92,8 +99,8 @@
 #define PORT_IRQ_PIOS_FIS	(1 << 1) /* PIO Setup FIS rx'd */
 #define PORT_IRQ_D2H_REG_FIS	(1 << 0) /* D2H Register FIS rx'd */
 
-#define PORT_IRQ_FATAL		PORT_IRQ_TF_ERR | PORT_IRQ_HBUS_ERR	\
-				| PORT_IRQ_HBUS_DATA_ERR | PORT_IRQ_IF_ERR
+#define PORT_IRQ_FATAL		(PORT_IRQ_TF_ERR | PORT_IRQ_HBUS_ERR	\
+				| PORT_IRQ_HBUS_DATA_ERR | PORT_IRQ_IF_ERR)
 
 #define DEF_PORT_IRQ		PORT_IRQ_FATAL | PORT_IRQ_PHYRDY	\
 				| PORT_IRQ_CONNECT | PORT_IRQ_SG_DONE	\
@@ -167,10 +174,20 @@ typedef struct AhciIoPort {
 	void *scr_addr;
 	void *port_mmio;
 	AhciCommandHeader *cmd_slot;
+	/* Command table of slot 0; one table per slot follows it. */
 	AhciSg *cmd_tbl_sg;
 	void *cmd_tbl;
 	void *rx_fis;
 	int index;
+	int n_slots;	// command slots with a command table
+	int ncq_depth;	// tags usable for NCQ, 0 if unsupported
+	int dirty;	// written since the last cache flush
+
+	// Asynchronous request state.
+	ListNode requests;	// requests with blocks left or tags busy
+	BlockDevRequest *tag_req[AHCI_MAX_CMD_SLOTS];
+	uint32_t busy;		// tags issued and not yet completed
+	uint64_t last_progress;	// timer_us() of the last completion
 } AhciIoPort;
 
 typedef struct AhciCtrlr {
@@ -45,6 +45,8 @@ typedef enum AtaCommand {
 	ATA_CMD_WRITE_LOG_EXT = 0x3f,
 	ATA_CMD_READ_VERIFY_SECTORS = 0x40,
 	ATA_CMD_READ_VERIFY_SECTORS_EXT = 0x42,
+	ATA_CMD_READ_FPDMA_QUEUED = 0x60,
+	ATA_CMD_WRITE_FPDMA_QUEUED = 0x61,
 	ATA_CMD_WRITE_UNCORRECTABLE_EXT = 0x45,
 	ATA_CMD_READ_LOG_DMA_EXT = 0x47,
 	ATA_CMD_CONFIGURE_STREAM = 0x51,
@@ -116,6 +118,17 @@ typedef enum AtaMajorRevision {
 	ATA_MAJOR_ATA8	= (1 << 8),
 } AtaMajorRevision;
 
+/* AtaIdentify.sata_capabilities bits */
+#define ATA_SATA_CAP_NCQ	(1 << 8)
+/* AtaIdentify.queue_depth holds the maximum queue depth - 1 */
+#define ATA_QUEUE_DEPTH(x)	(((x) & 0x1f) + 1)
+
+/* NCQ Command Error log, read with READ LOG EXT after a queued command
+ * failed. Byte 0 holds the failed tag, bytes 2 and 3 its status and error. */
+#define ATA_LOG_NCQ_ERROR	0x10
+#define ATA_NCQ_LOG_NQ		(1 << 7)	/* error wasn't for a queued command */
+#define ATA_NCQ_LOG_TAG_MASK	0x1f
+
 typedef struct AtaIdentify {
 	uint16_t config;
 	uint16_t word1;
@@ -143,7 +156,8 @@ typedef struct AtaIdentify {
 	uint16_t word69_70[2];
 	uint16_t word71_74[4];
 	uint16_t queue_depth;
-	uint16_t word76_79[4];
+	uint16_t sata_capabilities;
+	uint16_t word77_79[3];
 	uint16_t major_version;
 	uint16_t minor_version;
 	uint16_t command_sets[2];
@@ -0,0 +1,167 @@
+/*
+ * Copyright 2021 Google Inc.
+ *
+ * See file CREDITS for list of people who contributed to this
+ * project.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but without any warranty; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <libpayload.h>
+
+#include "drivers/storage/blockcache.h"
+
+#define BLOCKCACHE_ENTRIES	CONFIG_DRIVER_STORAGE_BLOCK_CACHE_ENTRIES
+/* Reads larger than this are bulk data and would only flush the cache. */
+#define BLOCKCACHE_MAX_READ	(BLOCKCACHE_ENTRIES / 2)
+
+typedef struct {
+	BlockDev *dev;		/* NULL if the entry is free */
+	lba_t lba;
+	uint32_t last_use;
+	unsigned size;		/* size of data, may be larger than needed */
+	uint8_t *data;
+} BlockCacheEntry;
+
+static BlockCacheEntry *entries;
+static uint32_t use_clock;
+
+static BlockCacheEntry *blockcache_find(BlockDev *dev, lba_t lba)
+{
+	for (int i = 0; i < BLOCKCACHE_ENTRIES; i++)
+		if (entries[i].dev == dev && entries[i].lba == lba)
+			return &entries[i];
+	return NULL;
+}
+
+/* Return the entry for (dev, lba), recycling the least recently used one. */
+static BlockCacheEntry *blockcache_get(BlockDev *dev, lba_t lba)
+{
+	BlockCacheEntry *entry = blockcache_find(dev, lba);
+
+	if (!entry) {
+		entry = &entries[0];
+		for (int i = 0; i < BLOCKCACHE_ENTRIES; i++) {
+			if (!entries[i].dev) {
+				entry = &entries[i];
+				break;
+			}
+			if (entries[i].last_use < entry->last_use)
+				entry = &entries[i];
+		}
+		entry->dev = dev;
+		entry->lba = lba;
+	}
+
+	if (entry->size < dev->block_size) {
+		free(entry->data);
+		entry->data = xmalloc(dev->block_size);
+		entry->size = dev->block_size;
+	}
+	return entry;
+}
+
+static void blockcache_touch(BlockCacheEntry *entry)
+{
+	entry->last_use = ++use_clock;
+}
+
+lba_t blockcache_read(BlockDev *dev, lba_t start, lba_t count, void *buffer)
+{
+	BlockDevOps *ops = &dev->ops;
+	unsigned bs = dev->block_size;
+	uint8_t *dest = buffer;
+	lba_t i;
+
+	if (!dev->cache.enabled || count > BLOCKCACHE_MAX_READ)
+		return ops->read(ops, start, count, buffer);
+
+	for (i = 0; i < count; i++)
+		if (!blockcache_find(dev, start + i))
+			break;
+
+	if (i == count) {
+		for (i = 0; i < count; i++) {
+			BlockCacheEntry *entry = blockcache_find(dev, start + i);
+			memcpy(dest + i * bs, entry->data, bs);
+			blockcache_touch(entry);
+		}
+		dev->cache.hits += count;
+		return count;
+	}
+
+	/* Any miss costs a device command, so fetch the whole range. */
+	lba_t read = ops->read(ops, start, count, buffer);
+	/* Some drivers return (lba_t)-1 on errors. */
+	if (read > count)
+		return 0;
+	for (i = 0; i < read; i++) {
+		BlockCacheEntry *entry = blockcache_get(dev, start + i);
+		memcpy(entry->data, dest + i * bs, bs);
+		blockcache_touch(entry);
+	}
+	dev->cache.misses += count;
+	return read;
+}
+
+lba_t blockcache_write(BlockDev *dev, lba_t start, lba_t count,
+		       const void *buffer)
+{
+	BlockDevOps *ops = &dev->ops;
+	const uint8_t *src = buffer;
+
+	lba_t written = ops->write(ops, start, count, buffer);
+	if (!dev->cache.enabled)
+		return written;
+	if (written > count) {
+		blockcache_invalidate(dev, start, count);
+		return 0;
+	}
+
+	for (lba_t i = 0; i < written; i++) {
+		BlockCacheEntry *entry = blockcache_find(dev, start + i);
+		if (entry)
+			memcpy(entry->data, src + i * dev->block_size,
+			       dev->block_size);
+	}
+	/* Whatever the device did with the rest is unknown now. */
+	if (written < count)
+		blockcache_invalidate(dev, start + written, count - written);
+	return written;
+}
+
+void blockcache_invalidate(BlockDev *dev, lba_t start, lba_t count)
+{
+	if (!entries)
+		return;
+
+	for (int i = 0; i < BLOCKCACHE_ENTRIES; i++)
+		if (entries[i].dev == dev && entries[i].lba >= start &&
+		    entries[i].lba - start < count)
+			entries[i].dev = NULL;
+}
+
+void blockcache_drop(BlockDev *dev)
+{
+	blockcache_invalidate(dev, 0, ~(lba_t)0);
+}
+
+void blockcache_enable(BlockDev *dev, int enable)
+{
+	if (!BLOCKCACHE_ENTRIES)
+		return;
+
+	if (enable && !entries)
+		entries = xzalloc(BLOCKCACHE_ENTRIES * sizeof(*entries));
+	if (!enable)
+		blockcache_drop(dev);
+	dev->cache.enabled = enable;
+}
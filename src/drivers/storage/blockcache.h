@@ -0,0 +1,46 @@
+/*
+ * Copyright 2021 Google Inc.
+ *
+ * See file CREDITS for list of people who contributed to this
+ * project.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but without any warranty; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __DRIVERS_STORAGE_BLOCKCACHE_H__
+#define __DRIVERS_STORAGE_BLOCKCACHE_H__
+
+#include "drivers/storage/blockdev.h"
+
+/*
+ * A small LRU cache of single blocks keyed by (device, lba), shared by all
+ * devices that set cache.enabled. It is meant for the small, repeated
+ * GPT and vboot header reads; large reads go straight to the device.
+ * Writes go through to the device and update the cached copies.
+ *
+ * The helpers below can be used for any device, they fall back to the
+ * plain ops when the cache is disabled.
+ */
+
+lba_t blockcache_read(BlockDev *dev, lba_t start, lba_t count, void *buffer);
+lba_t blockcache_write(BlockDev *dev, lba_t start, lba_t count,
+		       const void *buffer);
+
+/* Turn caching on or off for dev. Turning it off drops dev's blocks. */
+void blockcache_enable(BlockDev *dev, int enable);
+
+/* Drop the cached copies of count blocks from start, e.g. after an erase. */
+void blockcache_invalidate(BlockDev *dev, lba_t start, lba_t count);
+
+/* Drop everything cached for dev. Must be called before dev is freed. */
+void blockcache_drop(BlockDev *dev);
+
+#endif /* __DRIVERS_STORAGE_BLOCKCACHE_H__ */
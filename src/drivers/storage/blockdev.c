@@ -27,20 +27,57 @@ ListNode removable_block_devices;
 ListNode fixed_block_dev_controllers;
 ListNode removable_block_dev_controllers;
 
+/* Piece size for observed stream reads. */
+#define STREAM_OBSERVE_CHUNK	(1 * MiB)
+
 typedef struct {
 	StreamOps stream;
 	BlockDev *blockdev;
 	lba_t current_sector;
 	lba_t end_sector;
+
+	/* Asynchronous read of the chunk expected next, if one is running */
+	BlockDevRequest ahead;
+	int ahead_busy;
+	void *ahead_buf;
+	uint64_t ahead_buf_size;
 } SimpleStream;
 
+/*
+ * Readahead windows are filled with reads of the same size one after the
+ * other, so on devices with asynchronous I/O start reading the next one
+ * while the caller works on this one.
+ */
+static void simple_stream_prefetch(SimpleStream *stream, uint64_t sectors)
+{
+	BlockDev *blockdev = stream->blockdev;
+	uint64_t size = sectors * blockdev->block_size;
+
+	if (!blockdev->ops.submit || size > STREAM_MAX_WINDOW)
+		return;
+	sectors = MIN(sectors, stream->end_sector - stream->current_sector);
+	if (!sectors)
+		return;
+
+	if (stream->ahead_buf_size < size) {
+		free(stream->ahead_buf);
+		stream->ahead_buf = xmemalign(ARCH_DMA_MINALIGN, size);
+		stream->ahead_buf_size = size;
+	}
+
+	stream->ahead.start = stream->current_sector;
+	stream->ahead.count = sectors;
+	stream->ahead.buffer = stream->ahead_buf;
+	stream->ahead.is_write = 0;
+	stream->ahead_busy = !blockdev_submit(blockdev, &stream->ahead);
+}
+
 uint64_t simple_stream_read(StreamOps *me, uint64_t count, void *buffer)
 {
 	SimpleStream *stream = container_of(me, SimpleStream, stream);
 	unsigned block_size = stream->blockdev->block_size;
 
-	/* TODO(dehrenberg): implement buffering so that unaligned reads are
-	 * possible because alignment constraints are obscure */
+	/* Unaligned reads are handled by the buffered stream on top. */
 	if (count & (block_size - 1)) {
 		printf("read_stream_simple(%lld) not LBA multiple\n", count);
 		return 0;
@@ -54,19 +91,131 @@ uint64_t simple_stream_read(StreamOps *me, uint64_t count, void *buffer)
 		return 0;
 	}
 
-	int ret = stream->blockdev->ops.read(&stream->blockdev->ops,
-					     stream->current_sector, sectors,
-					     buffer);
+	if (stream->ahead_busy) {
+		stream->ahead_busy = 0;
+		if (stream->ahead.start == stream->current_sector &&
+		    stream->ahead.count == sectors) {
+			if (blockdev_wait(stream->blockdev, &stream->ahead) == 0) {
+				memcpy(buffer, stream->ahead_buf, count);
+				stream->current_sector += sectors;
+				simple_stream_prefetch(stream, sectors);
+				return count;
+			}
+			/* Fall back to a plain read to report the error. */
+		} else {
+			blockdev_cancel(stream->blockdev, &stream->ahead);
+		}
+	}
+
+	lba_t ret = stream->blockdev->ops.read(&stream->blockdev->ops,
+					       stream->current_sector, sectors,
+					       buffer);
 	if (ret != sectors)
-		return ret;
+		return ret > sectors ? 0 : ret * block_size;
 
 	stream->current_sector += sectors;
+	simple_stream_prefetch(stream, sectors);
 	return count;
 }
 
+static int simple_stream_start(SimpleStream *stream, BlockDevRequest *req,
+			       lba_t start, lba_t count, void *buffer)
+{
+	if (!count)
+		return 0;
+	req->start = start;
+	req->count = count;
+	req->buffer = buffer;
+	req->is_write = 0;
+	return !blockdev_submit(stream->blockdev, req);
+}
+
+/*
+ * Large observed reads go straight into the caller's buffer in chunks, two
+ * of them in flight at a time: func works on one chunk while the device is
+ * transferring the next two.
+ */
+static uint64_t simple_stream_read_observed(StreamOps *me, uint64_t count,
+					    void *buffer, StreamDataFunc func,
+					    void *arg)
+{
+	SimpleStream *stream = container_of(me, SimpleStream, stream);
+	BlockDev *blockdev = stream->blockdev;
+	unsigned block_size = blockdev->block_size;
+	lba_t chunk = STREAM_OBSERVE_CHUNK / block_size;
+	lba_t sectors = count / block_size;
+	lba_t start = stream->current_sector;
+	lba_t next = 0, done = 0, n;
+	uint8_t *dest = buffer;
+	BlockDevRequest reqs[2];
+	int busy[2];
+	int i;
+
+	if (!blockdev->ops.submit || count <= STREAM_OBSERVE_CHUNK ||
+	    (count & (block_size - 1)) ||
+	    sectors > stream->end_sector - start) {
+		uint64_t got = simple_stream_read(me, count, buffer);
+		if (got && got <= count)
+			func(arg, buffer, got);
+		return got;
+	}
+
+	if (stream->ahead_busy) {
+		stream->ahead_busy = 0;
+		blockdev_cancel(blockdev, &stream->ahead);
+	}
+
+	for (i = 0; i < 2; i++) {
+		n = MIN(chunk, sectors - next);
+		busy[i] = simple_stream_start(stream, &reqs[i], start + next,
+					      n, dest + next * block_size);
+		if (busy[i])
+			next += n;
+	}
+
+	for (i = 0; done < sectors && busy[i]; i ^= 1) {
+		busy[i] = 0;
+		if (blockdev_wait(blockdev, &reqs[i]))
+			break;
+
+		/* Keep the device busy while func runs. */
+		lba_t got = reqs[i].count;
+		n = MIN(chunk, sectors - next);
+		busy[i] = simple_stream_start(stream, &reqs[i], start + next,
+					      n, dest + next * block_size);
+		if (busy[i])
+			next += n;
+
+		func(arg, dest + done * block_size, got * block_size);
+		done += got;
+	}
+
+	for (i = 0; i < 2; i++)
+		if (busy[i])
+			blockdev_cancel(blockdev, &reqs[i]);
+
+	/* Failed or rejected requests: do the rest the plain way. */
+	if (done < sectors) {
+		lba_t ret = blockdev->ops.read(&blockdev->ops, start + done,
+					       sectors - done,
+					       dest + done * block_size);
+		if (ret > sectors - done)
+			ret = 0;
+		if (ret)
+			func(arg, dest + done * block_size, ret * block_size);
+		done += ret;
+	}
+
+	stream->current_sector += done;
+	return done * block_size;
+}
+
 static void simple_stream_close(StreamOps *me)
 {
 	SimpleStream *stream = container_of(me, SimpleStream, stream);
+	if (stream->ahead_busy)
+		blockdev_cancel(stream->blockdev, &stream->ahead);
+	free(stream->ahead_buf);
 	free(stream);
 }
 
@@ -79,9 +228,93 @@ StreamOps *new_simple_stream(BlockDevOps *me, lba_t start, lba_t count)
 	stream->end_sector = start + count;
 	stream->stream.read = simple_stream_read;
 	stream->stream.close = simple_stream_close;
+	stream->stream.read_observed = simple_stream_read_observed;
 	/* Check that block size is a power of 2 */
 	assert((blockdev->block_size & (blockdev->block_size - 1)) == 0);
-	return &stream->stream;
+	return new_buffered_stream(&stream->stream,
+				   count * blockdev->block_size,
+				   blockdev->block_size,
+				   blockdev->readahead_blocks *
+				   blockdev->block_size);
+}
+
+int blockdev_submit(BlockDev *dev, BlockDevRequest *req)
+{
+	req->dev = dev;
+	req->done = 0;
+	req->status = 0;
+	req->submitted = 0;
+	req->pending = 0;
+
+	if (!req->count) {
+		blockdev_complete(req, 0);
+		return 0;
+	}
+
+	if (dev->ops.submit)
+		return dev->ops.submit(&dev->ops, req);
+
+	/* No asynchronous support, do the transfer right away. */
+	lba_t ret;
+	if (req->is_write) {
+		if (!dev->ops.write)
+			return -1;
+		ret = dev->ops.write(&dev->ops, req->start, req->count,
+				     req->buffer);
+	} else {
+		ret = dev->ops.read(&dev->ops, req->start, req->count,
+				    req->buffer);
+	}
+	blockdev_complete(req, ret == req->count ? 0 : -1);
+	return 0;
+}
+
+void blockdev_complete(BlockDevRequest *req, int status)
+{
+	req->status = status;
+	req->done = 1;
+	list_append(&req->list_node, &req->dev->completed);
+}
+
+/* Take req off completed, clearing its links so that's only done once. */
+static void blockdev_unlink_completed(BlockDevRequest *req)
+{
+	if (!req->list_node.prev)
+		return;
+	list_remove(&req->list_node);
+	req->list_node.prev = NULL;
+	req->list_node.next = NULL;
+}
+
+BlockDevRequest *blockdev_poll(BlockDev *dev)
+{
+	if (dev->ops.poll)
+		dev->ops.poll(&dev->ops);
+
+	ListNode *node = dev->completed.next;
+	if (!node)
+		return NULL;
+	BlockDevRequest *req = container_of(node, BlockDevRequest, list_node);
+	blockdev_unlink_completed(req);
+	return req;
+}
+
+int blockdev_wait(BlockDev *dev, BlockDevRequest *req)
+{
+	while (!req->done) {
+		/* Drivers time out stuck requests from their poll hook. */
+		assert(dev->ops.poll);
+		dev->ops.poll(&dev->ops);
+	}
+	blockdev_unlink_completed(req);
+	return req->status;
+}
+
+void blockdev_cancel(BlockDev *dev, BlockDevRequest *req)
+{
+	if (!req->done && dev->ops.cancel)
+		dev->ops.cancel(&dev->ops, req);
+	blockdev_wait(dev, req);
 }
 
 int get_all_bdevs(blockdev_type_t type, ListNode **bdevs)
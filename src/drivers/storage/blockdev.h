@@ -25,6 +25,31 @@
 
 typedef uint64_t lba_t;
 
+/*
+ * An asynchronous read or write. The caller fills in the first group of
+ * fields and passes the request to blockdev_submit(). The request, and the
+ * buffer, belong to the device until blockdev_poll() or blockdev_wait()
+ * hands it back.
+ */
+typedef struct BlockDevRequest {
+	lba_t start;
+	lba_t count;
+	void *buffer;
+	int is_write;
+	void *cookie;		/* for the caller, never touched by drivers */
+
+	int done;
+	int status;		/* 0 = success, else error or cancelled */
+
+	/* Driver bookkeeping while the request is in flight. A non-zero
+	 * status before done means the request failed or was cancelled and
+	 * no further commands are to be issued for it. */
+	struct BlockDev *dev;
+	lba_t submitted;	/* blocks handed to the hardware so far */
+	uint32_t pending;	/* hardware commands not yet completed */
+	ListNode list_node;
+} BlockDevRequest;
+
 struct HealthInfo;
 typedef struct BlockDevOps {
 	lba_t (*read)(struct BlockDevOps *me, lba_t start, lba_t count,
@@ -38,6 +63,18 @@ typedef struct BlockDevOps {
 				 lba_t count);
 	// Return 0 = success, 1 = error.
 	int (*get_health_info)(struct BlockDevOps *me, struct HealthInfo *info);
+
+	/*
+	 * Optional asynchronous interface, used through blockdev_submit()
+	 * and friends, which fall back to read/write when it's missing.
+	 * submit queues req and returns 0, or non-zero if it was rejected.
+	 * poll must not block: it advances the hardware and passes finished
+	 * requests to blockdev_complete(). cancel stops issuing commands for
+	 * req, which still completes once its outstanding commands are done.
+	 */
+	int (*submit)(struct BlockDevOps *me, BlockDevRequest *req);
+	void (*poll)(struct BlockDevOps *me);
+	void (*cancel)(struct BlockDevOps *me, BlockDevRequest *req);
 } BlockDevOps;
 
 typedef struct BlockDev {
@@ -51,7 +88,18 @@ typedef struct BlockDev {
 	 * that the block_count value applies for both read/write and streams */
 	lba_t block_count;		/* size addressable by read/write */
 	lba_t stream_block_count;	/* size addressible by new_stream */
-
+	/* Readahead window for streams, usually the largest transfer the
+	 * device does in one command. 0 picks a default. */
+	lba_t readahead_blocks;
+
+	/* Block cache state, see blockcache.h. */
+	struct {
+		int enabled;
+		uint32_t hits;
+		uint32_t misses;
+	} cache;
+
+	ListNode completed;		/* finished asynchronous requests */
 	ListNode list_node;
 } BlockDev;
 
@@ -79,6 +127,17 @@ extern ListNode removable_block_dev_controllers;
 
 StreamOps *new_simple_stream(BlockDevOps *me, lba_t start, lba_t count);
 
+/* Queue an asynchronous request. Returns 0 if it was accepted. */
+int blockdev_submit(BlockDev *dev, BlockDevRequest *req);
+/* Advance the device, return a finished request or NULL if there is none. */
+BlockDevRequest *blockdev_poll(BlockDev *dev);
+/* Poll until req has finished and return its status. */
+int blockdev_wait(BlockDev *dev, BlockDevRequest *req);
+/* Stop req as soon as possible, returns once the device is done with it. */
+void blockdev_cancel(BlockDev *dev, BlockDevRequest *req);
+/* Called by drivers when req has finished. */
+void blockdev_complete(BlockDevRequest *req, int status);
+
 typedef enum {
 	BLOCKDEV_FIXED,
 	BLOCKDEV_REMOVABLE,
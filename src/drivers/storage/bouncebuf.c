@@ -31,6 +31,8 @@
 
 static int _debug = 0;
 
+struct bounce_buffer_stats bounce_buffer_stats;
+
 static int addr_aligned(struct bounce_buffer *state)
 {
 	const uint32_t align_mask = ARCH_DMA_MINALIGN - 1;
@@ -62,6 +64,9 @@ int bounce_buffer_start(struct bounce_buffer *state, void *data,
 	state->len = len;
 	state->len_aligned = ROUND(len, ARCH_DMA_MINALIGN);
 	state->flags = flags;
+	state->head_len = 0;
+	state->tail_len = 0;
+	state->split = 0;
 
 	if (!addr_aligned(state)) {
 		state->bounce_buffer = memalign(ARCH_DMA_MINALIGN,
@@ -72,6 +77,9 @@ int bounce_buffer_start(struct bounce_buffer *state, void *data,
 		if (state->flags & GEN_BB_READ)
 			memcpy(state->bounce_buffer, state->user_buffer,
 				state->len);
+		bounce_buffer_stats.bounced += len;
+	} else {
+		bounce_buffer_stats.direct += len;
 	}
 
 	/*
@@ -83,8 +91,99 @@ int bounce_buffer_start(struct bounce_buffer *state, void *data,
 	return 0;
 }
 
+int bounce_buffer_start_split(struct bounce_buffer *state, void *data,
+			      size_t len, unsigned int flags,
+			      size_t dma_align)
+{
+	const uintptr_t align_mask = ARCH_DMA_MINALIGN - 1;
+	uintptr_t addr = (uintptr_t)data;
+	size_t head = -addr & align_mask;
+	size_t tail = (addr + len) & align_mask;
+	uint8_t *user = data;
+
+	// Whole buffer aligned, too small to split or unusable for the engine
+	if ((!head && !tail) || len < head + tail + ARCH_DMA_MINALIGN ||
+	    (addr & (dma_align - 1)) || (len & (dma_align - 1)))
+		return bounce_buffer_start(state, data, len, flags);
+
+	state->user_buffer = data;
+	state->len = len;
+	state->len_aligned = 2 * ARCH_DMA_MINALIGN;
+	state->flags = flags;
+	state->head_len = head;
+	state->tail_len = tail;
+	state->split = 1;
+
+	state->bounce_buffer = memalign(ARCH_DMA_MINALIGN, state->len_aligned);
+	if (!state->bounce_buffer)
+		return -1;
+
+	if (flags & GEN_BB_READ) {
+		memcpy(state->bounce_buffer, user, head);
+		memcpy((uint8_t *)state->bounce_buffer + ARCH_DMA_MINALIGN,
+		       user + len - tail, tail);
+	}
+	bounce_buffer_stats.bounced += head + tail;
+	bounce_buffer_stats.direct += len - head - tail;
+
+	dcache_clean_invalidate_by_mva(state->bounce_buffer,
+				       state->len_aligned);
+	dcache_clean_invalidate_by_mva(user + head, len - head - tail);
+	return 0;
+}
+
+int bounce_buffer_segments(struct bounce_buffer *state,
+			   struct bounce_segment seg[3])
+{
+	uint8_t *user = state->user_buffer;
+	uint8_t *bounce = state->bounce_buffer;
+	int n = 0;
+
+	if (!state->split) {
+		seg[0].addr = state->bounce_buffer;
+		seg[0].len = state->len;
+		return 1;
+	}
+
+	if (state->head_len) {
+		seg[n].addr = bounce;
+		seg[n++].len = state->head_len;
+	}
+	seg[n].addr = user + state->head_len;
+	seg[n++].len = state->len - state->head_len - state->tail_len;
+	if (state->tail_len) {
+		seg[n].addr = bounce + ARCH_DMA_MINALIGN;
+		seg[n++].len = state->tail_len;
+	}
+	return n;
+}
+
+static int bounce_buffer_stop_split(struct bounce_buffer *state)
+{
+	uint8_t *user = state->user_buffer;
+	uint8_t *bounce = state->bounce_buffer;
+	size_t head = state->head_len;
+	size_t tail = state->tail_len;
+
+	if (state->flags & GEN_BB_WRITE) {
+		dcache_invalidate_by_mva(bounce, state->len_aligned);
+		dcache_invalidate_by_mva(user + head,
+					 state->len - head - tail);
+		memcpy(user, bounce, head);
+		memcpy(user + state->len - tail, bounce + ARCH_DMA_MINALIGN,
+		       tail);
+	}
+
+	free(state->bounce_buffer);
+
+	return 0;
+}
+
 int bounce_buffer_stop(struct bounce_buffer *state)
 {
+	if (state->split)
+		return bounce_buffer_stop_split(state);
+
 	if (state->flags & GEN_BB_WRITE) {
 		// Invalidate cache so that CPU can see any newly DMA'd data
 		dcache_invalidate_by_mva(state->bounce_buffer,
@@ -66,8 +66,32 @@ struct bounce_buffer {
 	size_t len_aligned;
 	/* Copy of flags parameter passed to start() */
 	unsigned int flags;
+	/*
+	 * Only set by bounce_buffer_start_split(): the number of bytes at
+	 * the start and end of user_buffer that go through bounce_buffer.
+	 * The head lives at bounce_buffer, the tail DMA_MINALIGN bytes
+	 * later, everything in between is used in place. Both are 0 when
+	 * the whole buffer is used directly or bounced.
+	 */
+	size_t head_len;
+	size_t tail_len;
+	int split;
+};
+
+/* One piece of memory a DMA engine has to transfer, in order. */
+struct bounce_segment {
+	void *addr;
+	size_t len;
+};
+
+/* Bytes that went through a bounce buffer and bytes DMA'd in place. */
+struct bounce_buffer_stats {
+	uint64_t bounced;
+	uint64_t direct;
 };
 
+extern struct bounce_buffer_stats bounce_buffer_stats;
+
 /**
  * bounce_buffer_start() -- Start the bounce buffer session
  * state:	stores state passed between bounce_buffer_{start,stop}
@@ -77,6 +101,23 @@ struct bounce_buffer {
  */
 int bounce_buffer_start(struct bounce_buffer *state, void *data,
 			size_t len, unsigned int flags);
+/**
+ * bounce_buffer_start_split() -- Start a bounce buffer session for a DMA
+ * engine that takes a list of segments (e.g. a scatter/gather chain).
+ * Only the partial cache lines at the head and tail of an unaligned buffer
+ * are bounced, the aligned middle is transferred in place. Falls back to
+ * bounce_buffer_start() if data isn't aligned to dma_align, the smallest
+ * address alignment the engine accepts.
+ */
+int bounce_buffer_start_split(struct bounce_buffer *state, void *data,
+			      size_t len, unsigned int flags,
+			      size_t dma_align);
+/**
+ * bounce_buffer_segments() -- Get the memory to hand to the DMA engine.
+ * Fills up to three segments in transfer order, returns how many.
+ */
+int bounce_buffer_segments(struct bounce_buffer *state,
+			   struct bounce_segment seg[3]);
 /**
  * bounce_buffer_stop() -- Finish the bounce buffer session
  * state:	stores state passed between bounce_buffer_{start,stop}
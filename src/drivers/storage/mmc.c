@@ -1206,6 +1206,13 @@ static int mmc_startup(MmcMedia *media)
 
 			media->supported_driver_strengths =
 				ext_csd[EXT_CSD_DRIVER_STRENGTH];
+
+			/* Packed headers are one 512 byte block. */
+			if (ext_csd[EXT_CSD_REV] >= EXT_CSD_REV_1_6 &&
+			    !(ext_csd[EXT_CSD_DATA_SECTOR_SIZE] & 1))
+				media->max_packed_writes = MIN(
+					ext_csd[EXT_CSD_MAX_PACKED_WRITES],
+					MMC_PACKED_MAX_ENTRIES);
 		}
 	}
 
@@ -1218,6 +1225,12 @@ static int mmc_startup(MmcMedia *media)
 
 	media->dev.block_count = media->capacity / media->read_bl_len;
 	media->dev.block_size = media->read_bl_len;
+	media->dev.readahead_blocks = media->ctrlr->b_max;
+
+	if (IS_SD(media))
+		media->cmd23 = !!(media->scr[0] & SD_SCR_CMD23_SUPPORT);
+	else
+		media->cmd23 = media->version >= MMC_VERSION_3;
 
 	printf("Man %06x Snr %u ",
 	       media->cid[0] >> 24,
@@ -1337,8 +1350,7 @@ static inline MmcCtrlr *mmc_ctrlr(MmcMedia *media)
 	return media->ctrlr;
 }
 
-static int block_mmc_setup(BlockDevOps *me, lba_t start, lba_t count,
-			   int is_read)
+int block_mmc_setup(BlockDevOps *me, lba_t start, lba_t count, int is_read)
 {
 	MmcMedia *media = mmc_media(me);
 	MmcCtrlr *ctrlr = mmc_ctrlr(media);
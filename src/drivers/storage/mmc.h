@@ -82,6 +82,7 @@
 #define MMC_CMD_READ_SINGLE_BLOCK	17
 #define MMC_CMD_READ_MULTIPLE_BLOCK	18
 #define MMC_SEND_TUNING_BLOCK_HS200	21
+#define MMC_CMD_SET_BLOCK_COUNT		23
 #define MMC_CMD_WRITE_SINGLE_BLOCK	24
 #define MMC_CMD_WRITE_MULTIPLE_BLOCK	25
 #define MMC_CMD_ERASE_GROUP_START	35
@@ -91,6 +92,20 @@
 #define MMC_CMD_SPI_READ_OCR		58
 #define MMC_CMD_SPI_CRC_ON_OFF		59
 
+#define MMC_CMD23_ARG_PACKED		(1 << 30)
+
+/*
+ * Packed write header, the first block of a packed CMD25. Word 0 holds the
+ * entry count, direction and version, then every entry takes two words, its
+ * own CMD23 and CMD25 arguments, starting at word 2.
+ */
+#define MMC_PACKED_CMD_VER		1
+#define MMC_PACKED_CMD_WR		2
+#define MMC_PACKED_HDR(n)		(((n) << 16) | \
+					 (MMC_PACKED_CMD_WR << 8) | \
+					 MMC_PACKED_CMD_VER)
+#define MMC_PACKED_MAX_ENTRIES		63	/* what fits in 512 bytes */
+
 #define MMC_TRIM_ARG			0x1
 #define MMC_SECURE_ERASE_ARG		0x80000000
 
@@ -105,6 +120,7 @@
 #define SD_CMD_APP_SEND_SCR		51
 
 /* SCR definitions in different words */
+#define SD_SCR_CMD23_SUPPORT	(1 << 1)
 #define SD_HIGHSPEED_BUSY	0x00020000
 #define SD_HIGHSPEED_SUPPORTED	0x00020000
 
@@ -155,6 +171,7 @@
 /*
  * EXT_CSD fields
  */
+#define EXT_CSD_DATA_SECTOR_SIZE	61	/* R */
 #define EXT_CSD_PARTITIONING_SUPPORT	160	/* RO */
 #define EXT_CSD_ERASE_GROUP_DEF		175	/* R/W */
 #define EXT_CSD_PART_CONF		179	/* R/W */
@@ -173,6 +190,7 @@
 #define EXT_CSD_DEVICE_LIFE_TIME_EST_TYP_B	269	/* RO */
 #define EXT_CSD_VENDOR_HEALTH_REPORT_FIRST	270	/* RO */
 #define EXT_CSD_VENDOR_HEALTH_REPORT_LAST	301	/* RO */
+#define EXT_CSD_MAX_PACKED_WRITES		500	/* RO */
 
 #define EXT_CSD_VENDOR_HEALTH_REPORT_SIZE                                      \
 	(EXT_CSD_VENDOR_HEALTH_REPORT_LAST -                                   \
@@ -371,6 +389,11 @@ typedef struct MmcMedia {
 
 	/* BIT(0) = B, BIT(1) = A, BIT(2) = C, BIT(3) = D */
 	uint8_t supported_driver_strengths;
+
+	/* Card takes SET_BLOCK_COUNT (CMD23) ahead of multi-block I/O. */
+	int cmd23;
+	/* Most writes one packed command may carry, 0 if not supported. */
+	uint8_t max_packed_writes;
 } MmcMedia;
 
 int mmc_busy_wait_io(volatile uint32_t *address, uint32_t *output,
@@ -380,6 +403,8 @@ int mmc_busy_wait_io_until(volatile uint32_t *address, uint32_t *output,
 
 int mmc_setup_media(MmcCtrlr *ctrlr);
 
+/* Check the range and set the block length, returns 1 on success. */
+int block_mmc_setup(BlockDevOps *me, lba_t start, lba_t count, int is_read);
 lba_t block_mmc_read(BlockDevOps *me, lba_t start, lba_t count, void *buffer);
 lba_t block_mmc_write(BlockDevOps *me, lba_t start, lba_t count,
 		      const void *buffer);
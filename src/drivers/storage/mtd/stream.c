@@ -44,9 +44,7 @@ static uint64_t read_mtd_stream(StreamOps *dev, uint64_t count,
 	MtdDev *mtd = mtd_stream->mtd;
 	assert(mtd != NULL);
 
-	/* TODO(dehrenberg): before any release is made:
-	 * Implement unaligned reads in a generic way, in a buffer managed by
-	 * the general MTD layer. */
+	/* Unaligned reads are handled by the buffered stream on top. */
 	if (count % mtd->writesize != 0) {
 		printf("misaligned stream read, count=0x%llx, writesize=0x%x",
 		       count, mtd->writesize);
@@ -60,13 +58,14 @@ static uint64_t read_mtd_stream(StreamOps *dev, uint64_t count,
 		stream_debug("Iteration 0x%llx 0x%llx 0x%llx %p\n",
 			     remaining, mtd_stream->offset, mtd_stream->limit,
 			     cur_buffer);
-		assert(remaining + mtd_stream->offset <= mtd_stream->limit);
-		if (remaining + mtd_stream->offset == mtd_stream->limit) {
+		/* Skipped bad blocks make the usable size smaller than the
+		 * partition, so a readahead may run off the end. */
+		if (mtd_stream->offset >= mtd_stream->limit) {
 			printf(
-			       "read out of bounds remaining=0x%llx offset=0x%llx limit=0x%llx",
+			       "read out of bounds remaining=0x%llx offset=0x%llx limit=0x%llx\n",
 			       remaining, mtd_stream->offset,
 			       mtd_stream->limit);
-			return 0;
+			return count - remaining;
 		}
 
 		/* Skip a bad block */
@@ -81,9 +80,10 @@ static uint64_t read_mtd_stream(StreamOps *dev, uint64_t count,
 
 		/* Read up to the end of the current erase block or to
 		 * the end of the user request, whichever comes first. */
-		int length = MIN(ALIGN_UP(mtd_stream->offset + 1,
-					  mtd->erasesize),
-				 mtd_stream->offset + remaining)
+		int length = MIN(MIN(ALIGN_UP(mtd_stream->offset + 1,
+					      mtd->erasesize),
+				     mtd_stream->offset + remaining),
+				 mtd_stream->limit)
 				- mtd_stream->offset;
 		unsigned int retlen;
 		int ret = mtd->read(mtd, mtd_stream->offset, length, &retlen,
@@ -139,7 +139,8 @@ static StreamOps *open_mtd_stream(StreamCtrlr *me, uint64_t offset,
 	dev->mtd = ctrlr->mtd_ctrlr->dev;
 	dev->offset = offset;
 	dev->limit = offset + size;
-	return &dev->ops;
+	return new_buffered_stream(&dev->ops, size, info->writesize,
+				   info->erasesize);
 }
 
 static uint64_t size_mtd_stream(StreamCtrlr *me)
@@ -19,30 +19,34 @@
  * changes rather than utilizing interrupts. The initialization functions are
  * processed one at a time, therefore the Admin Queue pair only supports depth
  * 2.
- * This driver is limited to a single IO queue pair (in addition to the
- * mandatory Admin queue pair). The IO queue depth is configurable, but has
- * shallow defaults to minimize host memory consumption. This driver only
- * supports a maximum of one PRP List, limiting the maximum transfer size to
- * 2MB (assuming 4KB memory pages).
+ * This driver requests up to CONFIG_DRIVER_STORAGE_NVME_IO_QUEUES IO queue
+ * pairs (in addition to the mandatory Admin queue pair) and uses as many as
+ * the controller grants. The IO queue depth is set by Kconfig and clamped to
+ * the controller's MQES. Each command may use a chain of up to MAX_PRP_LISTS
+ * PRP Lists, so the maximum transfer size is the smaller of MDTS and roughly
+ * 8MB (assuming 4KB memory pages). When Identify Controller reports SGL
+ * support, the (physically contiguous) data buffer of each command is
+ * instead described by a single SGL Data Block descriptor.
  *
  * Operation:
  * At initialization this driver allocates a pool of host memory and overlays
- * the queue pair structures. It also statically allocates a block of memory
- * for a PRP List, avoiding the need to allocate/free memory at IO time.
- * Each identified NVMe namespace has a corresponding depthcharge BlockDev
- * structure, effectively creating a new "drive" visible to higher levels.
+ * the queue pair structures. Once MDTS is known it also allocates a pool of
+ * PRP Lists, one chain per IO command id, avoiding the need to allocate/free
+ * memory at IO time. Each identified NVMe namespace has a corresponding
+ * depthcharge BlockDev structure, effectively creating a new "drive" visible
+ * to higher levels.
  *
  * The depthcharge read/write callbacks split host requests into chunks
  * satisfying the NVMe device's maximum transfer size limitations. Then they
- * call the corresponding _internal_ functions to facilitate formatting of the
- * NVMe structures in host memory. After all of the commands have been created
- * in host memory the Submission Queue tail pointer is updated allowing the
- * drive to process the newly submitted commands. Queuing commands allows the
- * drive to internally optimize accesses, increasing performance. Finally, the
- * Completion Queue phase bit is polled until it inverts, indicating that the
- * command has completed. If the SQ is full, outstanding commands will be
- * completed before the _internal_ function proceeds. This situation reduces
- * effective performance and should be avoided by increasing SQ/CQ depth.
+ * call nvme_internal_rw() to format the NVMe structures in host memory, on
+ * whichever IO queue has the fewest commands in flight. Once as many
+ * commands as the queues allow have been created the Submission Queue tail
+ * pointers are updated allowing the drive to process them. Whenever all
+ * queues are full, the Completion Queues are polled for at least one phase
+ * change and every command that has completed by then is retired; its
+ * command id and PRP Lists are immediately reused for the next chunk. This
+ * keeps the drive busy with a deep queue for the whole request instead of
+ * draining it completely before refilling.
  */
 
 #include <assert.h>
@@ -261,6 +265,9 @@ static NVME_STATUS nvme_complete_cmds_polled(NvmeCtrlr *ctrlr,
 		/* Dump completion entry status for debugging. */
 		DEBUG(nvme_dump_status(cq);)
 
+		if (qid == NVME_ADMIN_QUEUE_INDEX)
+			ctrlr->admin_cdw0 = cq->cdw0;
+
 		/* Update the doorbell, queue phase, and queue command id if necessary */
 		if (++(ctrlr->cq_h_dbl[qid]) > (cqsize-1)) {
 			ctrlr->cq_h_dbl[qid] = 0;
@@ -357,6 +364,14 @@ static NVME_STATUS nvme_set_queue_count(NvmeCtrlr *ctrlr, uint16_t count) {
 				NVME_ASQ_SIZE,
 				NVME_ACQ_SIZE,
 				NVME_GENERIC_TIMEOUT);
+	if (NVME_ERROR(status))
+		return status;
+
+	/* The controller may grant fewer queues than requested. Dword 0
+	 * holds 0's based NSQA in 15:0 and NCQA in 31:16 */
+	ctrlr->num_io_queues = MIN(count + 1,
+				   MIN((ctrlr->admin_cdw0 & 0xffff) + 1,
+				       (ctrlr->admin_cdw0 >> 16) + 1));
 
 	return status;
 }
@@ -422,17 +437,41 @@ static NVME_STATUS nvme_create_sq(NvmeCtrlr *ctrlr, uint16_t qid, uint16_t qsize
 	return status;
 }
 
+/* Deletes a single IO submission or completion queue, by opcode
+ * Deleting an SQ aborts the commands still outstanding on it.
+ */
+static NVME_STATUS nvme_delete_queue(NvmeCtrlr *ctrlr, uint8_t opc, uint16_t qid) {
+	NVME_SQ *sq;
+
+	sq  = ctrlr->sq_buffer[NVME_ADMIN_QUEUE_INDEX] + ctrlr->sq_t_dbl[NVME_ADMIN_QUEUE_INDEX];
+
+	memset(sq, 0, sizeof(NVME_SQ));
+
+	sq->opc = opc;
+	sq->cid = ctrlr->cid[NVME_ADMIN_QUEUE_INDEX]++;
+	sq->cdw10 = NVME_ADMIN_DELIOQ_QID(qid);
+
+	return nvme_do_one_cmd_synchronous(ctrlr,
+				NVME_ADMIN_QUEUE_INDEX,
+				NVME_ASQ_SIZE,
+				NVME_ACQ_SIZE,
+				NVME_GENERIC_TIMEOUT);
+}
+
 /* Generate PRPs for a single virtual memory buffer
- * prp_list: pre-allocated prp list buffer
+ * prp_list: pre-allocated, physically contiguous prp list buffers
+ * num_lists: number of lists available at prp_list for chaining
  * prp: pointer to SQ PRP array
  * buffer: host buffer for request
  * size: number of bytes in request
  */
-static NVME_STATUS nvme_fill_prp(PrpList *prp_list, uint64_t *prp, void *buffer, uint64_t size)
+static NVME_STATUS nvme_fill_prp(PrpList *prp_list, uint32_t num_lists,
+				 uint64_t *prp, void *buffer, uint64_t size)
 {
 	uint64_t offset = (uintptr_t)buffer & (NVME_PAGE_SIZE - 1);
 	uint64_t xfer_pages;
 	uintptr_t buffer_phys = virt_to_phys(buffer);
+	uint32_t entry_index = 0;
 
 	/* PRP0 is always the (potentially unaligned) start of the buffer */
 	prp[0] = buffer_phys;
@@ -448,230 +487,415 @@ static NVME_STATUS nvme_fill_prp(PrpList *prp_list, uint64_t *prp, void *buffer,
 		return NVME_SUCCESS;
 	}
 
-	/* Case 2: Need to build up to one PRP List */
+	/* Case 2: Need to build up a chain of PRP Lists */
 	xfer_pages = (ALIGN((size + offset), NVME_PAGE_SIZE) >> NVME_PAGE_SHIFT);
 	/* Don't count first prp entry as it is the beginning of buffer */
 	xfer_pages--;
-	/* Make sure this transfer fits into one PRP list */
-	if (xfer_pages > (NVME_MAX_XFER_BYTES/NVME_PAGE_SIZE))
+	/* Make sure this transfer fits into the available PRP lists. The
+	 * final list doesn't need a chain pointer, so it holds one extra. */
+	if (xfer_pages > (num_lists * PRP_DATA_ENTRIES_PER_LIST) + 1)
 		return NVME_INVALID_PARAMETER;
 
-	/* Fill the PRP List */
+	/* Fill the PRP List(s) */
 	prp[1] = (uintptr_t)virt_to_phys(prp_list);
-	for (uint32_t entry_index = 0; entry_index < xfer_pages; entry_index++) {
-		prp_list->prp_entry[entry_index] = buffer_phys;
+	while (xfer_pages) {
+		if (entry_index == PRP_DATA_ENTRIES_PER_LIST && xfer_pages > 1) {
+			/* Chain to the next list in the pool */
+			prp_list->prp_entry[entry_index] =
+				(uintptr_t)virt_to_phys(prp_list + 1);
+			prp_list++;
+			entry_index = 0;
+			continue;
+		}
+		prp_list->prp_entry[entry_index++] = buffer_phys;
 		buffer_phys += NVME_PAGE_SIZE;
+		xfer_pages--;
 	}
 	return NVME_SUCCESS;
 }
 
-/* Sets up read operation for up to max_transfer blocks */
-static NVME_STATUS nvme_internal_read(NvmeDrive *drive, void *buffer, lba_t start, lba_t count)
+/* Total number of IO command ids, shared by all IO queues */
+static uint16_t nvme_io_cids(NvmeCtrlr *ctrlr)
+{
+	return ctrlr->io_depth * ctrlr->num_io_queues;
+}
+
+/* Returns the PRP List chain reserved for a command id. The admin queue uses
+ * the chain past the last IO command id. */
+static PrpList *nvme_prp_lists(NvmeCtrlr *ctrlr, uint16_t cid)
+{
+	return ctrlr->prp_pool + (cid * ctrlr->prp_lists_per_cmd);
+}
+
+/* Number of IO commands submitted but not yet completed */
+static uint16_t nvme_io_inflight(NvmeCtrlr *ctrlr)
+{
+	return nvme_io_cids(ctrlr) - ctrlr->num_free_cids;
+}
+
+/* Ring the SQ doorbell of every IO queue that has new commands */
+static void nvme_ring_io_doorbells(NvmeCtrlr *ctrlr)
+{
+	for (uint16_t qid = NVME_IO_QUEUE_INDEX;
+	     qid <= ctrlr->num_io_queues; qid++) {
+		if (ctrlr->sq_t_rung[qid] == ctrlr->sq_t_dbl[qid])
+			continue;
+		nvme_ring_sq_doorbell(ctrlr, qid);
+		ctrlr->sq_t_rung[qid] = ctrlr->sq_t_dbl[qid];
+	}
+}
+
+/* Retire every completed command on one IO queue without waiting
+ * Rings the CQ doorbell once for the batch.
+ *
+ * ctrlr: NVMe controller handle
+ * qid: Queue Identifier of the IO queue pair
+ * returns: number of commands retired
+ */
+static uint16_t nvme_reap_io_queue(NvmeCtrlr *ctrlr, uint16_t qid)
+{
+	uint16_t reaped = 0;
+	BlockDevRequest *req;
+	NVME_CQ *cq;
+
+	while (ctrlr->inflight[qid]) {
+		cq = ctrlr->cq_buffer[qid] + ctrlr->cq_h_dbl[qid];
+		if ((readw(&(cq->flags)) & NVME_CQ_FLAGS_PHASE) == ctrlr->pt[qid])
+			break;
+
+		/* Dump completion entry status for debugging. */
+		DEBUG(nvme_dump_status(cq);)
+
+		req = NULL;
+		if (cq->cid < nvme_io_cids(ctrlr)) {
+			req = ctrlr->cid_req[cq->cid];
+			ctrlr->cid_req[cq->cid] = NULL;
+			/* Return the command id (and its PRP Lists) to the pool */
+			ctrlr->free_cids[ctrlr->num_free_cids++] = cq->cid;
+		}
+
+		if (NVME_CQ_FLAGS_SC(cq->flags) || NVME_CQ_FLAGS_SCT(cq->flags) ||
+		    !req) {
+			printf("nvme_reap_io_queue: qid %u cid %u failed, flags 0x%x\n",
+			       qid, cq->cid, cq->flags);
+			if (req)
+				req->status = -1;
+		}
+		if (req)
+			req->pending--;
+		ctrlr->inflight[qid]--;
+
+		/* Update SQ head pointer */
+		ctrlr->sqhd[qid] = cq->sqhd;
+		/* Update the doorbell and queue phase if necessary */
+		if (++(ctrlr->cq_h_dbl[qid]) > (ctrlr->iocq_sz - 1)) {
+			ctrlr->cq_h_dbl[qid] = 0;
+			ctrlr->pt[qid] ^= 1;
+		}
+		reaped++;
+	}
+
+	/* Ring the completion queue doorbell register*/
+	if (reaped)
+		writel_with_flush(ctrlr->cq_h_dbl[qid], ctrlr->ctrlr_regs + NVME_CQHDBL_OFFSET(qid, NVME_CAP_DSTRD(ctrlr->cap)));
+
+	return reaped;
+}
+
+/* Returns whether a data buffer can be described by one SGL Data Block */
+static int nvme_can_use_sgl(NvmeCtrlr *ctrlr, void *buffer, uint64_t size)
+{
+	switch (ctrlr->sgl_support) {
+	case NVME_SGLS_SUPPORT_ANY:
+		return 1;
+	case NVME_SGLS_SUPPORT_DWORD:
+		return !((uintptr_t)buffer & 0x3) && !(size & 0x3);
+	default:
+		return 0;
+	}
+}
+
+/* Picks the IO queue with the fewest commands in flight that has room */
+static uint16_t nvme_pick_io_queue(NvmeCtrlr *ctrlr)
+{
+	uint16_t best = 0;
+
+	for (uint16_t qid = NVME_IO_QUEUE_INDEX;
+	     qid <= ctrlr->num_io_queues; qid++) {
+		if (ctrlr->inflight[qid] >= ctrlr->io_depth)
+			continue;
+		if (!best || ctrlr->inflight[qid] < ctrlr->inflight[best])
+			best = qid;
+	}
+	return best;
+}
+
+/* Sets up read or write operation for up to max_transfer blocks of req
+ * Command is added to the host SQ, the doorbell is not rung.
+ */
+static NVME_STATUS nvme_internal_rw(NvmeDrive *drive, BlockDevRequest *req,
+				    uint8_t opc, void *buffer, lba_t start,
+				    lba_t count)
 {
 	NvmeCtrlr *ctrlr = drive->ctrlr;
+	uint64_t size = count * drive->dev.block_size;
 	NVME_SQ *sq;
+	uint16_t cid, qid;
 	int status = NVME_SUCCESS;
 
 	if (count == 0)
 		return NVME_INVALID_PARAMETER;
+	qid = nvme_pick_io_queue(ctrlr);
+	if (qid == 0 || ctrlr->num_free_cids == 0)
+		return NVME_OUT_OF_RESOURCES;
 
-	/* If queue is full, need to complete inflight commands before submitting more */
-	if ((ctrlr->sq_t_dbl[NVME_IO_QUEUE_INDEX] + 1) % ctrlr->iosq_sz == ctrlr->sqhd[NVME_IO_QUEUE_INDEX]) {
-		DEBUG(printf("nvme_internal_read: Too many outstanding commands. Completing in-flights\n");)
-		/* Submit commands to controller */
-		nvme_ring_sq_doorbell(ctrlr, NVME_IO_QUEUE_INDEX);
-		/* Complete submitted command(s) */
-		status = nvme_complete_cmds_polled(ctrlr,
-				NVME_IO_QUEUE_INDEX,
-				NVME_CCQ_SIZE,
-				NVME_GENERIC_TIMEOUT);
-		if (NVME_ERROR(status)) {
-			printf("nvme_internal_read: error %d completing outstanding commands\n",status);
-			return status;
-		}
-	}
+	cid = ctrlr->free_cids[ctrlr->num_free_cids - 1];
 
-	sq  = ctrlr->sq_buffer[NVME_IO_QUEUE_INDEX] + ctrlr->sq_t_dbl[NVME_IO_QUEUE_INDEX];
+	sq  = ctrlr->sq_buffer[qid] + ctrlr->sq_t_dbl[qid];
 
 	memset(sq, 0, sizeof(NVME_SQ));
 
-	sq->opc = NVME_IO_READ_OPC;
-	sq->cid = ctrlr->cid[NVME_IO_QUEUE_INDEX]++;
+	sq->opc = opc;
+	sq->cid = cid;
 	sq->nsid = drive->namespace_id;
 
-	status = nvme_fill_prp(ctrlr->prp_list[sq->cid], sq->prp, buffer, count * drive->dev.block_size);
-	if (NVME_ERROR(status)) {
-		printf("nvme_internal_read: error %d generating PRP(s)\n",status);
-		return status;
+	if (nvme_can_use_sgl(ctrlr, buffer, size)) {
+		/* The buffer is physically contiguous, one descriptor covers it */
+		sq->flags = NVME_SQ_FLAGS_PSDT_SGL;
+		sq->sgl.addr = (uintptr_t)virt_to_phys(buffer);
+		sq->sgl.length = size;
+		sq->sgl.id = NVME_SGL_TYPE_DATA_BLOCK;
+	} else {
+		status = nvme_fill_prp(nvme_prp_lists(ctrlr, cid),
+				       ctrlr->prp_lists_per_cmd, sq->prp,
+				       buffer, size);
+		if (NVME_ERROR(status)) {
+			printf("nvme_internal_rw: error %d generating PRP(s)\n",status);
+			return status;
+		}
 	}
 
 	sq->cdw10 = start;
 	sq->cdw11 = (start >> 32);
 	sq->cdw12 = (count - 1) & 0xFFFF;
 
-	status = nvme_submit_cmd(ctrlr, NVME_IO_QUEUE_INDEX, ctrlr->iosq_sz);
+	status = nvme_submit_cmd(ctrlr, qid, ctrlr->iosq_sz);
+	if (NVME_ERROR(status))
+		return status;
 
-	return status;
+	ctrlr->num_free_cids--;
+	ctrlr->inflight[qid]++;
+	ctrlr->cid_req[cid] = req;
+	return NVME_SUCCESS;
 }
 
-/* Read operation entrypoint
- * Cut operation into max_transfer chunks and do it
+/* Read/write engine
+ * Cut every queued request into max_transfer chunks and hand them to the
+ * IO queues while command ids are free. Requests are served in order, so
+ * the next one only starts once the ones before it are fully issued.
  */
-static lba_t nvme_read(BlockDevOps *me, lba_t start, lba_t count, void *buffer)
+static void nvme_issue_requests(NvmeCtrlr *ctrlr)
 {
-	NvmeDrive *drive = container_of(me, NvmeDrive, dev.ops);
-	NvmeCtrlr *ctrlr = drive->ctrlr;
-	uint64_t max_transfer_blocks = 0;
-	uint32_t block_size = drive->dev.block_size;
-	lba_t orig_count = count;
-	int status = NVME_SUCCESS;
+	BlockDevRequest *req;
+
+	list_for_each(req, ctrlr->requests, list_node) {
+		NvmeDrive *drive = container_of(req->dev, NvmeDrive, dev);
+		uint32_t block_size = drive->dev.block_size;
+		uint64_t max_transfer_blocks = ctrlr->max_xfer_bytes / block_size;
+		uint8_t opc = req->is_write ? NVME_IO_WRITE_OPC :
+					      NVME_IO_READ_OPC;
+
+		while (!req->status && req->submitted < req->count) {
+			if (ctrlr->num_free_cids == 0)
+				break;
+
+			lba_t chunk = MIN(req->count - req->submitted,
+					  max_transfer_blocks);
+			DEBUG(printf("nvme_issue_requests: opc %d of %llu blocks\n", opc, (unsigned long long)chunk);)
+			if (NVME_ERROR(nvme_internal_rw(drive, req, opc,
+					req->buffer + req->submitted * block_size,
+					req->start + req->submitted, chunk))) {
+				req->status = -1;
+				break;
+			}
+			req->submitted += chunk;
+			req->pending++;
+		}
 
-	DEBUG(printf("nvme_read: Reading from namespace %d\n",drive->namespace_id);)
+		if (ctrlr->num_free_cids == 0)
+			break;
+	}
 
-	if (ctrlr->controller_data->mdts != 0)
-		max_transfer_blocks = ((1 << (ctrlr->controller_data->mdts)) * (1 << NVME_CAP_MPSMIN(ctrlr->cap))) / block_size;
-	/* Artificially limit max_transfer_blocks to 1 PRP List */
-	if ( (max_transfer_blocks == 0) ||
-			(max_transfer_blocks > (NVME_MAX_XFER_BYTES * block_size)))
-		max_transfer_blocks = NVME_MAX_XFER_BYTES / block_size;
-
-	while (count > 0) {
-		if (count > max_transfer_blocks) {
-			DEBUG(printf("nvme_read: partial read of %llu blocks\n",(unsigned long long)max_transfer_blocks);)
-			status = nvme_internal_read(drive, buffer, start, max_transfer_blocks);
-			count -= max_transfer_blocks;
-			buffer += max_transfer_blocks*block_size;
-			start += max_transfer_blocks;
-		} else {
-			DEBUG(printf("nvme_read: final read of %llu blocks\n",(unsigned long long)count);)
-			status = nvme_internal_read(drive, buffer, start, count);
-			count = 0;
-		}
+	/* Submit queued commands to controller */
+	nvme_ring_io_doorbells(ctrlr);
+}
+
+/* Drop every IO command the controller hasn't completed
+ * The IO queues are deleted, which aborts whatever is still on them, and
+ * created again empty. Once that's done the controller no longer touches
+ * the commands' buffers and their command ids can be reused. A controller
+ * that won't even do that is disabled.
+ */
+static NVME_STATUS nvme_reset_io_queues(NvmeCtrlr *ctrlr)
+{
+	NVME_STATUS status = NVME_SUCCESS;
+	uint16_t qid;
+
+	for (qid = NVME_IO_QUEUE_INDEX; qid <= ctrlr->num_io_queues; qid++) {
+		status = nvme_delete_queue(ctrlr, NVME_ADMIN_DELIOSQ_OPC, qid);
 		if (NVME_ERROR(status))
 			break;
+		status = nvme_delete_queue(ctrlr, NVME_ADMIN_DELIOCQ_OPC, qid);
+		if (NVME_ERROR(status))
+			break;
+	}
+
+	for (qid = NVME_IO_QUEUE_INDEX;
+	     !NVME_ERROR(status) && qid <= ctrlr->num_io_queues; qid++) {
+		ctrlr->sq_t_dbl[qid] = 0;
+		ctrlr->sq_t_rung[qid] = 0;
+		ctrlr->sqhd[qid] = 0;
+		ctrlr->cq_h_dbl[qid] = 0;
+		ctrlr->pt[qid] = 0;
+		ctrlr->inflight[qid] = 0;
+		memset(ctrlr->cq_buffer[qid], 0,
+		       ctrlr->iocq_sz * sizeof(NVME_CQ));
+
+		status = nvme_create_cq(ctrlr, qid, ctrlr->iocq_sz);
+		if (!NVME_ERROR(status))
+			status = nvme_create_sq(ctrlr, qid, ctrlr->iosq_sz);
 	}
 
 	if (NVME_ERROR(status)) {
-		printf("nvme_read: error %d\n",status);
-		return -1;
+		printf("nvme_reset_io_queues: error %d, disabling controller\n",
+		       status);
+		nvme_disable_controller(ctrlr);
+		ctrlr->enabled = 0;
+		for (qid = NVME_IO_QUEUE_INDEX;
+		     qid <= ctrlr->num_io_queues; qid++)
+			ctrlr->inflight[qid] = 0;
 	}
 
-	/* Submit commands to controller */
-	nvme_ring_sq_doorbell(ctrlr, NVME_IO_QUEUE_INDEX);
-	/* Complete submitted command(s) */
-	nvme_complete_cmds_polled(ctrlr,
-			NVME_IO_QUEUE_INDEX,
-			NVME_CCQ_SIZE,
-			NVME_GENERIC_TIMEOUT);
+	/* All IO command ids are free again */
+	ctrlr->num_free_cids = nvme_io_cids(ctrlr);
+	for (uint16_t cid = 0; cid < ctrlr->num_free_cids; cid++) {
+		ctrlr->free_cids[cid] = ctrlr->num_free_cids - 1 - cid;
+		ctrlr->cid_req[cid] = NULL;
+	}
+
+	return status;
+}
 
-	DEBUG(printf("nvme_read: lba = 0x%08x, Original = 0x%08x, Remaining = 0x%08x, BlockSize = 0x%x Status = %d\n", (uint32_t)start, (uint32_t)orig_count, (uint32_t)count, block_size, status);)
+/* Poll for completion of IO commands from HW without waiting
+ * Retires completed commands on every IO queue, completes requests that
+ * are done and refills the queues.
+ */
+static void nvme_io_poll(NvmeCtrlr *ctrlr)
+{
+	BlockDevRequest *req;
+	uint16_t progress = 0;
+
+	for (uint16_t qid = NVME_IO_QUEUE_INDEX;
+	     qid <= ctrlr->num_io_queues; qid++)
+		progress += nvme_reap_io_queue(ctrlr, qid);
+
+	if (progress || !nvme_io_inflight(ctrlr)) {
+		ctrlr->last_progress = timer_us(0);
+	} else if (timer_us(ctrlr->last_progress) >
+		   NVME_GENERIC_TIMEOUT * USECS_PER_MSEC) {
+		printf("nvme_io_poll: ERROR - timeout\n");
+		/* Stop the controller working on them, then fail every request */
+		nvme_reset_io_queues(ctrlr);
+		list_for_each(req, ctrlr->requests, list_node) {
+			req->status = -1;
+			req->pending = 0;
+		}
+		ctrlr->last_progress = timer_us(0);
+	}
 
-	return orig_count - count;
+	/* Complete requests with nothing left to do */
+	ListNode *node = ctrlr->requests.next;
+	while (node) {
+		req = container_of(node, BlockDevRequest, list_node);
+		node = node->next;
+		if (req->pending)
+			continue;
+		if (!req->status && req->submitted < req->count)
+			continue;
+		list_remove(&req->list_node);
+		blockdev_complete(req, req->status);
+	}
+
+	nvme_issue_requests(ctrlr);
 }
 
-/* Sets up write operation for up to max_transfer blocks */
-static NVME_STATUS nvme_internal_write(NvmeDrive *drive, void *buffer, lba_t start, lba_t count)
+/* Asynchronous request entrypoint */
+static int nvme_submit(BlockDevOps *me, BlockDevRequest *req)
 {
+	NvmeDrive *drive = container_of(me, NvmeDrive, dev.ops);
 	NvmeCtrlr *ctrlr = drive->ctrlr;
-	NVME_SQ *sq;
-	int status = NVME_SUCCESS;
-
-	if (count == 0)
-		return NVME_INVALID_PARAMETER;
 
-	/* If queue is full, need to complete inflight commands before submitting more */
-	if ((ctrlr->sq_t_dbl[NVME_IO_QUEUE_INDEX] + 1) % ctrlr->iosq_sz == ctrlr->sqhd[NVME_IO_QUEUE_INDEX]) {
-		DEBUG(printf("nvme_internal_write: Too many outstanding commands. Completing in-flights\n");)
-		/* Submit commands to controller */
-		nvme_ring_sq_doorbell(ctrlr, NVME_IO_QUEUE_INDEX);
-		/* Complete submitted command(s) */
-		status = nvme_complete_cmds_polled(ctrlr,
-				NVME_IO_QUEUE_INDEX,
-				NVME_CCQ_SIZE,
-				NVME_GENERIC_TIMEOUT);
-		if (NVME_ERROR(status)) {
-			printf("nvme_internal_read: error %d completing outstanding commands\n",status);
-			return status;
-		}
-	}
+	if (!ctrlr->enabled)
+		return -1;
+	if (!nvme_io_inflight(ctrlr))
+		ctrlr->last_progress = timer_us(0);
+	list_append(&req->list_node, &ctrlr->requests);
+	nvme_issue_requests(ctrlr);
+	return 0;
+}
 
-	sq  = ctrlr->sq_buffer[NVME_IO_QUEUE_INDEX] + ctrlr->sq_t_dbl[NVME_IO_QUEUE_INDEX];
+static void nvme_poll(BlockDevOps *me)
+{
+	NvmeDrive *drive = container_of(me, NvmeDrive, dev.ops);
 
-	memset(sq, 0, sizeof(NVME_SQ));
+	nvme_io_poll(drive->ctrlr);
+}
 
-	sq->opc = NVME_IO_WRITE_OPC;
-	sq->cid = ctrlr->cid[NVME_IO_QUEUE_INDEX]++;
-	sq->nsid = drive->namespace_id;
+/* Commands already handed to the controller are left to finish */
+static void nvme_cancel(BlockDevOps *me, BlockDevRequest *req)
+{
+	req->status = -1;
+}
 
-	status = nvme_fill_prp(ctrlr->prp_list[sq->cid], sq->prp, buffer, count * drive->dev.block_size);
-	if (NVME_ERROR(status)) {
-		printf("nvme_internal_write: error %d generating PRP(s)\n",status);
-		return status;
+static lba_t nvme_rw(NvmeDrive *drive, uint8_t opc, lba_t start, lba_t count,
+		     void *buffer)
+{
+	BlockDevRequest req = {
+		.start = start,
+		.count = count,
+		.buffer = buffer,
+		.is_write = opc == NVME_IO_WRITE_OPC,
+	};
+
+	if (blockdev_submit(&drive->dev, &req) ||
+	    blockdev_wait(&drive->dev, &req)) {
+		printf("nvme_rw: error, lba = 0x%08x, count = 0x%08x\n",
+		       (uint32_t)start, (uint32_t)count);
+		return -1;
 	}
 
-	sq->cdw10 = start;
-	sq->cdw11 = (start >> 32);
-	sq->cdw12 = (count - 1) & 0xFFFF;
+	return count;
+}
 
-	status = nvme_submit_cmd(ctrlr, NVME_IO_QUEUE_INDEX, ctrlr->iosq_sz);
+/* Read operation entrypoint */
+static lba_t nvme_read(BlockDevOps *me, lba_t start, lba_t count, void *buffer)
+{
+	NvmeDrive *drive = container_of(me, NvmeDrive, dev.ops);
 
-	return status;
+	DEBUG(printf("nvme_read: Reading from namespace %d\n",drive->namespace_id);)
+
+	return nvme_rw(drive, NVME_IO_READ_OPC, start, count, buffer);
 }
 
-/* Write operation entrypoint
- * Cut operation into max_transfer chunks and do it
- */
+/* Write operation entrypoint */
 static lba_t nvme_write(BlockDevOps *me, lba_t start, lba_t count,
 						const void *buffer)
 {
 	NvmeDrive *drive = container_of(me, NvmeDrive, dev.ops);
-	NvmeCtrlr *ctrlr = drive->ctrlr;
-	uint64_t max_transfer_blocks = 0;
-	uint32_t block_size = drive->dev.block_size;
-	lba_t orig_count = count;
-	int status = NVME_SUCCESS;
 
 	DEBUG(printf("nvme_write: Writing to namespace %d\n",drive->namespace_id);)
 
-	if (ctrlr->controller_data->mdts != 0)
-		max_transfer_blocks = ((1 << (ctrlr->controller_data->mdts)) * (1 << NVME_CAP_MPSMIN(ctrlr->cap))) / block_size;
-	/* Artificially limit max_transfer_blocks to 1 PRP List */
-	if ( (max_transfer_blocks == 0) ||
-			(max_transfer_blocks > (NVME_MAX_XFER_BYTES * block_size)))
-		max_transfer_blocks = NVME_MAX_XFER_BYTES / block_size;
-
-	while (count > 0) {
-		if (count > max_transfer_blocks) {
-			DEBUG(printf("nvme_write: partial write of %llu blocks\n",(unsigned long long)max_transfer_blocks);)
-			status = nvme_internal_write(drive, (void *)buffer, start, max_transfer_blocks);
-			count -= max_transfer_blocks;
-			buffer += max_transfer_blocks*block_size;
-			start += max_transfer_blocks;
-		} else {
-			DEBUG(printf("nvme_write final write of %llu blocks\n",(unsigned long long)count);)
-			status = nvme_internal_write(drive, (void *)buffer, start, count);
-			count = 0;
-		}
-		if (NVME_ERROR(status))
-			break;
-	}
-
-	if (NVME_ERROR(status)) {
-		printf("nvme_write: error %d\n",status);
-		return -1;
-	}
-
-	/* Submit commands to controller */
-	nvme_ring_sq_doorbell(ctrlr, NVME_IO_QUEUE_INDEX);
-	/* Complete submitted command(s) */
-	nvme_complete_cmds_polled(ctrlr,
-			NVME_IO_QUEUE_INDEX,
-			NVME_CCQ_SIZE,
-			NVME_GENERIC_TIMEOUT);
-
-	DEBUG(printf("nvme_write: lba = 0x%08x, Original = 0x%08x, Remaining = 0x%08x, BlockSize = 0x%x Status = %d\n", (uint32_t)start, (uint32_t)orig_count, (uint32_t)count, block_size, status);)
-
-	return orig_count - count;
+	return nvme_rw(drive, NVME_IO_WRITE_OPC, start, count, (void *)buffer);
 }
 
 static NVME_STATUS nvme_read_log_page(NvmeDrive *drive, int log_page_id,
@@ -711,7 +935,8 @@ static NVME_STATUS nvme_read_log_page(NvmeDrive *drive, int log_page_id,
 	sq->cdw11 = dword_len_u;
 
 	NVME_STATUS status =
-		nvme_fill_prp(ctrlr->prp_list[sq->cid], sq->prp, data, size);
+		nvme_fill_prp(nvme_prp_lists(ctrlr, nvme_io_cids(ctrlr)),
+			      ctrlr->prp_lists_per_cmd, sq->prp, data, size);
 	if (NVME_ERROR(status)) {
 		printf("%s: error %d generating PRP(s)\n", __func__, status);
 		return status;
@@ -809,11 +1034,15 @@ static NVME_STATUS nvme_create_drive(NvmeCtrlr *ctrlr, uint32_t namespace_id,
 	nvme_drive->dev.ops.read = &nvme_read;
 	nvme_drive->dev.ops.write = &nvme_write;
 	nvme_drive->dev.ops.new_stream = &new_simple_stream;
+	nvme_drive->dev.ops.submit = &nvme_submit;
+	nvme_drive->dev.ops.poll = &nvme_poll;
+	nvme_drive->dev.ops.cancel = &nvme_cancel;
 	nvme_drive->dev.ops.get_health_info = &nvme_read_smart_log;
 	nvme_drive->dev.name = name;
 	nvme_drive->dev.removable = 0;
 	nvme_drive->dev.block_size = block_size;
 	nvme_drive->dev.block_count = block_count;
+	nvme_drive->dev.readahead_blocks = ctrlr->max_xfer_bytes / block_size;
 	nvme_drive->ctrlr = ctrlr;
 	nvme_drive->namespace_id = namespace_id;
 
@@ -991,7 +1220,9 @@ static int nvme_shutdown(struct CleanupFunc *cleanup, CleanupType type)
 	}
 	free(prev);
 	free(ctrlr->controller_data);
-	free(ctrlr->prp_list);
+	free(ctrlr->prp_pool);
+	free(ctrlr->free_cids);
+	free(ctrlr->cid_req);
 	free(ctrlr->buffer);
 	free(ctrlr);
 	return 0;
@@ -1058,27 +1289,24 @@ static int nvme_ctrlr_init(BlockDevCtrlrOps *me)
 	/* Calculate max io sq/cq sizes based on MQES */
 	ctrlr->iosq_sz = (NVME_CSQ_SIZE > NVME_CAP_MQES(ctrlr->cap)) ? NVME_CAP_MQES(ctrlr->cap) : NVME_CSQ_SIZE;
 	ctrlr->iocq_sz = (NVME_CCQ_SIZE > NVME_CAP_MQES(ctrlr->cap)) ? NVME_CAP_MQES(ctrlr->cap) : NVME_CCQ_SIZE;
+	/* A full queue has one empty slot, so that bounds commands in flight */
+	ctrlr->io_depth = MIN(ctrlr->iosq_sz, ctrlr->iocq_sz) - 1;
 	DEBUG(printf("iosq_sz = %u, iocq_sz = %u\n",ctrlr->iosq_sz,ctrlr->iocq_sz);)
 
-	/* Allocate enough PRP List memory for max queue depth commands */
-	for (unsigned int list_index = 0; list_index < ctrlr->iosq_sz; list_index++) {
-		ctrlr->prp_list[list_index] = dma_memalign(NVME_PAGE_SIZE, NVME_PAGE_SIZE);
-		if (!(ctrlr->prp_list[list_index])) {
-			printf("NVMe driver failed to allocate prp list %u memory\n",list_index);
-			status = NVME_OUT_OF_RESOURCES;
-			goto exit;
-		}
-		memset(ctrlr->prp_list[list_index], 0, NVME_PAGE_SIZE);
-	}
-
-	/* Allocate queue memory block */
-	ctrlr->buffer = dma_memalign(NVME_PAGE_SIZE, (NVME_NUM_QUEUES * 2) * NVME_PAGE_SIZE);
+	/* Allocate queue memory block: admin SQ and CQ take a page each,
+	 * IO queues are rounded up to whole pages. Room is reserved for the
+	 * maximum number of IO queue pairs the driver may be granted. */
+	size_t iosq_bytes = ALIGN_UP(ctrlr->iosq_sz * sizeof(NVME_SQ), NVME_PAGE_SIZE);
+	size_t iocq_bytes = ALIGN_UP(ctrlr->iocq_sz * sizeof(NVME_CQ), NVME_PAGE_SIZE);
+	size_t buffer_bytes = 2 * NVME_PAGE_SIZE +
+			      NVME_NUM_IO_QUEUES * (iosq_bytes + iocq_bytes);
+	ctrlr->buffer = dma_memalign(NVME_PAGE_SIZE, buffer_bytes);
 	if (!(ctrlr->buffer)) {
 		printf("NVMe driver failed to allocate queue buffer\n");
 		status = NVME_OUT_OF_RESOURCES;
 		goto exit;
 	}
-	memset(ctrlr->buffer, 0, (NVME_NUM_QUEUES * 2) * NVME_PAGE_SIZE);
+	memset(ctrlr->buffer, 0, buffer_bytes);
 
 	/* Disable controller */
 	status = nvme_disable_controller(ctrlr);
@@ -1097,10 +1325,10 @@ static int nvme_ctrlr_init(BlockDevCtrlrOps *me)
 	#if NVME_ACQ_SIZE != 2
 	#error "Unsupported Admin CQ size defined"
 	#endif
-	#if (NVME_CSQ_SIZE < 2) || (NVME_CSQ_SIZE > (NVME_PAGE_SIZE / 64))
+	#if (NVME_CSQ_SIZE < 2)
 	#error "Unsupported IO SQ size defined"
 	#endif
-	#if (NVME_CCQ_SIZE < 2) || (NVME_CCQ_SIZE > (NVME_PAGE_SIZE / 64))
+	#if (NVME_CCQ_SIZE < 2)
 	#error "Unsupported IO CQ size defined"
 	#endif
 
@@ -1114,10 +1342,12 @@ static int nvme_ctrlr_init(BlockDevCtrlrOps *me)
 	acq  = (uintptr_t)virt_to_phys(ctrlr->buffer + NVME_PAGE_SIZE);
 	ctrlr->cq_buffer[NVME_ADMIN_QUEUE_INDEX] = (NVME_CQ *)(ctrlr->buffer + NVME_PAGE_SIZE);
 	/* Address of I/O submission & completion queues */
-	ctrlr->sq_buffer[NVME_IO_QUEUE_INDEX] =
-		(NVME_SQ *)(ctrlr->buffer + 2 * NVME_PAGE_SIZE);
-	ctrlr->cq_buffer[NVME_IO_QUEUE_INDEX] =
-		(NVME_CQ *)(ctrlr->buffer + 3 * NVME_PAGE_SIZE);
+	for (uint16_t qid = NVME_IO_QUEUE_INDEX; qid <= NVME_NUM_IO_QUEUES; qid++) {
+		uint8_t *pair = ctrlr->buffer + 2 * NVME_PAGE_SIZE +
+				(qid - 1) * (iosq_bytes + iocq_bytes);
+		ctrlr->sq_buffer[qid] = (NVME_SQ *)pair;
+		ctrlr->cq_buffer[qid] = (NVME_CQ *)(pair + iosq_bytes);
+	}
 
 	DEBUG(printf("Private->Buffer = [%p]\n", (void *)virt_to_phys(ctrlr->buffer));)
 	DEBUG(printf("Admin Queue Attributes = [%X]\n", aqa);)
@@ -1144,20 +1374,63 @@ static int nvme_ctrlr_init(BlockDevCtrlrOps *me)
 	if (NVME_ERROR(status))
 		goto exit;
 
-	/* Create IO queue pair */
-	status = nvme_create_cq(ctrlr, NVME_IO_QUEUE_INDEX, ctrlr->iocq_sz);
-	if (NVME_ERROR(status))
-		goto exit;
+	DEBUG(printf("Using %u IO queue pair(s)\n", ctrlr->num_io_queues);)
 
-	status = nvme_create_sq(ctrlr, NVME_IO_QUEUE_INDEX, ctrlr->iosq_sz);
-	if (NVME_ERROR(status))
-		goto exit;
+	/* Create IO queue pairs */
+	for (uint16_t qid = NVME_IO_QUEUE_INDEX;
+	     qid <= ctrlr->num_io_queues; qid++) {
+		status = nvme_create_cq(ctrlr, qid, ctrlr->iocq_sz);
+		if (NVME_ERROR(status))
+			goto exit;
+
+		status = nvme_create_sq(ctrlr, qid, ctrlr->iosq_sz);
+		if (NVME_ERROR(status))
+			goto exit;
+	}
+
+	/* All IO command ids start out free */
+	ctrlr->num_free_cids = nvme_io_cids(ctrlr);
+	ctrlr->free_cids = xmalloc(ctrlr->num_free_cids *
+				   sizeof(*ctrlr->free_cids));
+	for (uint16_t cid = 0; cid < ctrlr->num_free_cids; cid++)
+		ctrlr->free_cids[cid] = ctrlr->num_free_cids - 1 - cid;
+	ctrlr->cid_req = xzalloc(ctrlr->num_free_cids *
+				 sizeof(*ctrlr->cid_req));
 
 	/* Identify */
 	status = nvme_identify(ctrlr);
 	if (NVME_ERROR(status))
 		goto exit;
 
+	/* Size transfers to MDTS, limited by what our PRP List chains cover */
+	ctrlr->max_xfer_bytes = NVME_MAX_XFER_BYTES;
+	if (ctrlr->controller_data->mdts != 0 &&
+	    ctrlr->controller_data->mdts + NVME_CAP_MPSMIN(ctrlr->cap) < 32)
+		ctrlr->max_xfer_bytes = MIN(ctrlr->max_xfer_bytes,
+			(1U << ctrlr->controller_data->mdts) <<
+			NVME_CAP_MPSMIN(ctrlr->cap));
+	/* An unaligned buffer spills into one extra page, which is exactly
+	 * the page covered by PRP0, so one entry per page of max_xfer_bytes */
+	uint32_t max_entries = ctrlr->max_xfer_bytes >> NVME_PAGE_SHIFT;
+	ctrlr->prp_lists_per_cmd = MAX(1, DIV_ROUND_UP(max_entries - 1,
+						       PRP_DATA_ENTRIES_PER_LIST));
+	DEBUG(printf("max_xfer_bytes = %u, prp_lists_per_cmd = %u\n",ctrlr->max_xfer_bytes,ctrlr->prp_lists_per_cmd);)
+
+	/* Use a single SGL Data Block instead of PRPs when supported */
+	ctrlr->sgl_support = NVME_SGLS_SUPPORT(ctrlr->controller_data->sgls);
+	DEBUG(printf("sgl_support = %u\n",ctrlr->sgl_support);)
+
+	/* Allocate PRP List chains for every IO command id, plus admin */
+	size_t pool_bytes = (nvme_io_cids(ctrlr) + 1) *
+			    ctrlr->prp_lists_per_cmd * sizeof(PrpList);
+	ctrlr->prp_pool = dma_memalign(NVME_PAGE_SIZE, pool_bytes);
+	if (!(ctrlr->prp_pool)) {
+		printf("NVMe driver failed to allocate prp list memory\n");
+		status = NVME_OUT_OF_RESOURCES;
+		goto exit;
+	}
+	memset(ctrlr->prp_pool, 0, pool_bytes);
+
 	NvmeModelData *model = nvme_match_static_model(ctrlr);
 	if (model) {
 		/* Create drive based on static namespace data */
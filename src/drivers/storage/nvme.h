@@ -39,8 +39,8 @@
 #define NVME_PAGE_SHIFT		12
 #define NVME_PAGE_SIZE		(1UL << NVME_PAGE_SHIFT)
 
-/* Max 1 PRP list per transfer */
-#define MAX_PRP_LISTS 1
+/* Max chained PRP lists per transfer */
+#define MAX_PRP_LISTS 4
 /* 8 bytes per entry */
 #define PRP_ENTRY_SHIFT 3
 /* 1 page per list */
@@ -48,7 +48,9 @@
 /* 1 page of memory addressed per entry*/
 #define PRP_ENTRY_XFER_SHIFT NVME_PAGE_SHIFT
 #define PRP_ENTRIES_PER_LIST (1UL << (PRP_LIST_SHIFT - PRP_ENTRY_SHIFT))
-#define NVME_MAX_XFER_BYTES  ((MAX_PRP_LISTS * PRP_ENTRIES_PER_LIST ) << PRP_ENTRY_XFER_SHIFT)
+/* Last entry of a non-final list points to the next list in the chain */
+#define PRP_DATA_ENTRIES_PER_LIST (PRP_ENTRIES_PER_LIST - 1)
+#define NVME_MAX_XFER_BYTES  ((MAX_PRP_LISTS * PRP_DATA_ENTRIES_PER_LIST) << PRP_ENTRY_XFER_SHIFT)
 
 /* Loop used to poll for command completions
  * timeout in milliseconds
@@ -90,13 +92,13 @@ typedef int NVME_STATUS;
 #define NVME_ASQ_SIZE	2	/* Number of admin submission queue entries, only 2 */
 #define NVME_ACQ_SIZE	2	/* Number of admin completion queue entries, only 2 */
 
-#define NVME_CSQ_SIZE	11	/* Number of I/O submission queue entries per queue, min 2, max 64 */
-#define NVME_CCQ_SIZE	11	/* Number of I/O completion queue entries per queue, min 2, max 64 */
+#define NVME_CSQ_SIZE	CONFIG_DRIVER_STORAGE_NVME_IO_QUEUE_DEPTH	/* Number of I/O submission queue entries per queue */
+#define NVME_CCQ_SIZE	CONFIG_DRIVER_STORAGE_NVME_IO_QUEUE_DEPTH	/* Number of I/O completion queue entries per queue */
 
-#define NVME_NUM_QUEUES	2	/* Number of queues (Admin + IO) supported by the driver, only 2 supported */
-#define NVME_NUM_IO_QUEUES	(NVME_NUM_QUEUES - 1) /* Number of IO queues (not counting Admin Queue) */
+#define NVME_NUM_IO_QUEUES	CONFIG_DRIVER_STORAGE_NVME_IO_QUEUES /* Max number of IO queues (not counting Admin Queue) */
+#define NVME_NUM_QUEUES	(NVME_NUM_IO_QUEUES + 1)	/* Max number of queues (Admin + IO) supported by the driver */
 #define NVME_ADMIN_QUEUE_INDEX	0	/* Admin queu index must be 0 */
-#define NVME_IO_QUEUE_INDEX		1	/* IO queue */
+#define NVME_IO_QUEUE_INDEX		1	/* First IO queue */
 
 /*
  * NVMe Controller Registers
@@ -188,6 +190,10 @@ typedef uint32_t NVME_CQHDBL;
 #define NVME_ADMIN_CRIOCQ_QID(x)	(x)
 #define NVME_ADMIN_CRIOCQ_QSIZE(x)	(((x)-1) << 16)
 
+#define NVME_ADMIN_DELIOSQ_OPC	0
+#define NVME_ADMIN_DELIOCQ_OPC	4
+#define NVME_ADMIN_DELIOQ_QID(x)	(x)
+
 #define NVME_ADMIN_GET_LOG_PAGE	2
 #define NVME_ADMIN_IDENTIFY_OPC	6
 
@@ -204,15 +210,29 @@ typedef uint32_t NVME_CQHDBL;
 /* NVMe namespace ID */
 #define NVME_NSID_ALL	0xffffffff
 
+/* 4.4 Scatter Gather List (SGL) descriptor */
+typedef struct {
+	uint64_t addr;	/* Address */
+	uint32_t length;	/* Length in bytes */
+	uint8_t  rsvd[3];
+	uint8_t  id;	/* SGL Descriptor Type and Sub Type */
+#define NVME_SGL_TYPE_DATA_BLOCK	(0 << 4)
+} NVME_SGL_DESC;
+
 /* Submission Queue */
 typedef struct {
 	uint8_t opc;	/* Opcode */
-	uint8_t flags;	/* FUSE and PSDT, only 0 setting supported */
+	uint8_t flags;	/* FUSE and PSDT, no fused commands supported */
+#define NVME_SQ_FLAGS_PSDT_PRP	(0 << 6)
+#define NVME_SQ_FLAGS_PSDT_SGL	(1 << 6)	/* SGL for data, MPTR is an address */
 	uint16_t cid;	/* Command Identifier */
 	uint32_t nsid;	/* Namespace Identifier */
 	uint64_t rsvd1;
 	uint64_t mptr;	/* Metadata Pointer */
-	uint64_t prp[2];	/* PRP entries only, SGL not supported */
+	union {
+		uint64_t prp[2];	/* PRP entries, PSDT 0 */
+		NVME_SGL_DESC sgl;	/* SGL segment 1, PSDT 1 */
+	};
 	uint32_t cdw10;
 	uint32_t cdw11;
 	uint32_t cdw12;
@@ -291,6 +311,10 @@ typedef struct {
 	uint16_t acwu;	/* Atomic Compare & Write Unit */
 	uint16_t rsvd5;	/* Reserved as of Nvm Express 1.1 Spec */
 	uint32_t sgls;	/* SGL Support  */
+#define NVME_SGLS_SUPPORT(x)	((x) & 0x3)
+#define NVME_SGLS_SUPPORT_NONE		0
+#define NVME_SGLS_SUPPORT_ANY		1	/* No alignment requirement */
+#define NVME_SGLS_SUPPORT_DWORD		2	/* Dword aligned address and length */
 	uint8_t  rsvd6[164];	/* Reserved as of Nvm Express 1.1 Spec */
 	//
 	// I/O Command set Attributes
@@ -401,8 +425,37 @@ typedef struct NvmeCtrlr {
 	/* virtual address of identify controller data */
 	NVME_ADMIN_CONTROLLER_DATA *controller_data;
 
-	/* virtual address of pre-allocated PRP Lists */
-	PrpList *prp_list[NVME_CSQ_SIZE];
+	/* virtual address of pre-allocated PRP List pool, prp_lists_per_cmd
+	 * chained lists for each I/O command id plus one set for admin use */
+	PrpList *prp_pool;
+	uint32_t prp_lists_per_cmd;
+	/* Largest transfer a single command may carry, from MDTS */
+	uint32_t max_xfer_bytes;
+
+	/* Stack of I/O command ids not currently in flight, shared by all
+	 * IO queues */
+	uint16_t *free_cids;
+	uint16_t num_free_cids;
+	/* Max I/O commands in flight per queue, one less than the queue size */
+	uint16_t io_depth;
+	/* Number of IO queue pairs granted by the controller */
+	uint16_t num_io_queues;
+	/* Commands in flight on each queue */
+	uint16_t inflight[NVME_NUM_QUEUES];
+	/* SQ tail as of the last doorbell write */
+	uint16_t sq_t_rung[NVME_NUM_QUEUES];
+
+	/* Request each I/O command id was issued for */
+	BlockDevRequest **cid_req;
+	/* Requests with blocks left to issue or commands in flight */
+	ListNode requests;
+	/* timer_us() of the last I/O completion, for timeouts */
+	uint64_t last_progress;
+
+	/* SGL support from identify controller data, NVME_SGLS_SUPPORT_* */
+	uint8_t sgl_support;
+	/* Dword 0 of the most recent admin completion */
+	uint32_t admin_cdw0;
 
 	/* virtual address of raw buffer, split into queues below */
 	uint8_t *buffer;
@@ -105,83 +105,71 @@ static int sdhci_transfer_data(SdhciHost *host, MmcData *data,
 	return 0;
 }
 
+/*
+ * Descriptors for the largest transfer mmc.c hands us, b_max blocks of 512
+ * bytes, plus a packed command header and a boundary per packed entry. The
+ * chain is allocated once so the common case never has to grow it.
+ */
+static u32 sdhci_adma_max_descs(SdhciHost *host)
+{
+	return host->mmc_ctrlr.b_max * 512 / SDHCI_MAX_PER_DESCRIPTOR + 2 +
+	       MMC_PACKED_MAX_ENTRIES;
+}
+
 static void sdhci_alloc_adma_descs(SdhciHost *host, u32 need_descriptors)
 {
 	if (host->adma_descs) {
-		if (host->adma_desc_count < need_descriptors) {
-			/* Previously allocated array is too small */
-			free(host->adma_descs);
-			host->adma_desc_count = 0;
-			host->adma_descs = NULL;
-		}
+		if (host->adma_desc_count >= need_descriptors)
+			return;
+		/* Previously allocated array is too small */
+		free(host->adma_descs);
+		host->adma_desc_count = 0;
+		host->adma_descs = NULL;
 	}
 
-	/* use dma_malloc() to make sure we get the coherent/uncached memory */
-	if (!host->adma_descs) {
-		host->adma_descs = dma_malloc(need_descriptors *
-					      sizeof(*host->adma_descs));
-		if (host->adma_descs == NULL)
-			die("fail to malloc adma_descs\n");
-		host->adma_desc_count = need_descriptors;
-	}
+	need_descriptors = MAX(need_descriptors, sdhci_adma_max_descs(host));
 
-	memset(host->adma_descs, 0, sizeof(*host->adma_descs) *
-	       need_descriptors);
+	/* use dma_malloc() to make sure we get the coherent/uncached memory */
+	host->adma_descs = dma_malloc(need_descriptors *
+				      sizeof(*host->adma_descs));
+	if (host->adma_descs == NULL)
+		die("fail to malloc adma_descs\n");
+	host->adma_desc_count = need_descriptors;
 }
 
 static void sdhci_alloc_adma64_descs(SdhciHost *host, u32 need_descriptors)
 {
 	if (host->adma64_descs) {
-		if (host->adma_desc_count < need_descriptors) {
-			/* Previously allocated array is too small */
-			free(host->adma64_descs);
-			host->adma_desc_count = 0;
-			host->adma64_descs = NULL;
-		}
+		if (host->adma_desc_count >= need_descriptors)
+			return;
+		/* Previously allocated array is too small */
+		free(host->adma64_descs);
+		host->adma_desc_count = 0;
+		host->adma64_descs = NULL;
 	}
 
-	/* use dma_malloc() to make sure we get the coherent/uncached memory */
-	if (!host->adma64_descs) {
-		host->adma64_descs = dma_malloc(need_descriptors *
-					   sizeof(*host->adma64_descs));
-		if (host->adma64_descs == NULL)
-			die("fail to malloc adma64_descs\n");
-
-		host->adma_desc_count = need_descriptors;
-	}
+	need_descriptors = MAX(need_descriptors, sdhci_adma_max_descs(host));
 
-	memset(host->adma64_descs, 0, sizeof(*host->adma64_descs) *
-	       need_descriptors);
+	/* use dma_malloc() to make sure we get the coherent/uncached memory */
+	host->adma64_descs = dma_malloc(need_descriptors *
+					sizeof(*host->adma64_descs));
+	if (host->adma64_descs == NULL)
+		die("fail to malloc adma64_descs\n");
+	host->adma_desc_count = need_descriptors;
 }
 
-static int sdhci_setup_adma(SdhciHost *host, MmcData *data,
-			    struct bounce_buffer *bbstate)
+/*
+ * Describe len bytes at buffer_data starting with descriptor i, marking
+ * the last one as the end of the chain if last is set. Every field of the
+ * descriptors used is written, so the chain needs no clearing between
+ * transfers. Returns the index of the next free descriptor.
+ */
+static int sdhci_adma_add(SdhciHost *host, int i, char *buffer_data,
+			  u32 togo, int last)
 {
-	int i, togo, need_descriptors;
-	char *buffer_data;
 	u16 attributes;
 
-	togo = data->blocks * data->blocksize;
-	if (!togo) {
-		printf("%s: MmcData corrupted: %d blocks of %d bytes\n",
-		       __func__, data->blocks, data->blocksize);
-		return -1;
-	}
-
-	need_descriptors = 1 +  togo / SDHCI_MAX_PER_DESCRIPTOR;
-
-	if (host->dma64)
-		sdhci_alloc_adma64_descs(host, need_descriptors);
-	else
-		sdhci_alloc_adma_descs(host, need_descriptors);
-
-	if (bbstate)
-		buffer_data = (char *)bbstate->bounce_buffer;
-	else
-		buffer_data = data->dest;
-
-	/* Now set up the descriptor chain. */
-	for (i = 0; togo; i++) {
+	for (; togo; i++) {
 		unsigned desc_length;
 
 		if (togo < SDHCI_MAX_PER_DESCRIPTOR)
@@ -191,7 +179,7 @@ static int sdhci_setup_adma(SdhciHost *host, MmcData *data,
 		togo -= desc_length;
 
 		attributes = SDHCI_ADMA_VALID | SDHCI_ACT_TRAN;
-		if (togo == 0)
+		if (togo == 0 && last)
 			attributes |= SDHCI_ADMA_END;
 
 		if (host->dma64) {
@@ -212,6 +200,11 @@ static int sdhci_setup_adma(SdhciHost *host, MmcData *data,
 		buffer_data += desc_length;
 	}
 
+	return i;
+}
+
+static void sdhci_set_adma_address(SdhciHost *host)
+{
 	if (host->dma64) {
 		uintptr_t lo = (uintptr_t) host->adma64_descs & 0xFFFFFFFF;
 		uintptr_t hi = 0;
@@ -222,6 +215,45 @@ static int sdhci_setup_adma(SdhciHost *host, MmcData *data,
 		sdhci_writel(host, (uintptr_t) host->adma_descs,
 			     SDHCI_ADMA_ADDRESS);
 	}
+}
+
+static void sdhci_alloc_descs(SdhciHost *host, u32 need_descriptors)
+{
+	if (host->dma64)
+		sdhci_alloc_adma64_descs(host, need_descriptors);
+	else
+		sdhci_alloc_adma_descs(host, need_descriptors);
+}
+
+static int sdhci_setup_adma(SdhciHost *host, MmcData *data,
+			    struct bounce_buffer *bbstate)
+{
+	int togo, count, desc = 0;
+	struct bounce_segment seg[3];
+
+	togo = data->blocks * data->blocksize;
+	if (!togo) {
+		printf("%s: MmcData corrupted: %d blocks of %d bytes\n",
+		       __func__, data->blocks, data->blocksize);
+		return -1;
+	}
+
+	if (bbstate) {
+		count = bounce_buffer_segments(bbstate, seg);
+	} else {
+		seg[0].addr = data->dest;
+		seg[0].len = togo;
+		count = 1;
+	}
+
+	/* A split bounce buffer adds up to two short head/tail pieces. */
+	sdhci_alloc_descs(host, 1 + togo / SDHCI_MAX_PER_DESCRIPTOR + 2);
+
+	/* Now set up the descriptor chain. */
+	for (int i = 0; i < count; i++)
+		desc = sdhci_adma_add(host, desc, seg[i].addr, seg[i].len,
+				      i == count - 1);
+	sdhci_set_adma_address(host);
 
 	return 0;
 }
@@ -406,16 +438,36 @@ int sdhci_execute_tuning(struct MmcMedia *media)
 	return ret;
 }
 
-static int sdhci_send_command_bounced(MmcCtrlr *mmc_ctrl, MmcCommand *cmd,
-				      MmcData *data,
-				      struct bounce_buffer *bbstate)
+/*
+ * Whether the controller should send SET_BLOCK_COUNT ahead of cmd. With a
+ * pre-defined block count the card knows the transfer length up front and
+ * no STOP_TRANSMISSION is needed at the end. Hosts without
+ * MMC_CAPS_AUTO_CMD12 get an explicit CMD12 from mmc.c, which isn't allowed
+ * after a closed-ended transfer, so those stay open-ended.
+ */
+static int sdhci_auto_cmd23(SdhciHost *host, MmcCommand *cmd)
+{
+	MmcMedia *media = host->mmc_ctrlr.media;
+
+	if ((host->version & SDHCI_SPEC_VER_MASK) < SDHCI_SPEC_300 ||
+	    !(host->host_caps & MMC_CAPS_AUTO_CMD12) ||
+	    (host->quirks & SDHCI_QUIRK_BROKEN_AUTO_CMD23))
+		return 0;
+	if (!media || !media->cmd23)
+		return 0;
+	return cmd->cmdidx == MMC_CMD_READ_MULTIPLE_BLOCK ||
+	       cmd->cmdidx == MMC_CMD_WRITE_MULTIPLE_BLOCK;
+}
+
+/*
+ * Program the controller for cmd and send it, without waiting for the
+ * response. Returns the response mask to wait for, or 0 on error.
+ */
+static u32 sdhci_start_command(SdhciHost *host, MmcCommand *cmd,
+			       MmcData *data, struct bounce_buffer *bbstate)
 {
-	unsigned int stat = 0;
-	int ret = 0;
 	u32 mask, flags;
-	unsigned int timeout, start_addr = 0;
-	uint64_t start;
-	SdhciHost *host = container_of(mmc_ctrl, SdhciHost, mmc_ctrlr);
+	unsigned int timeout;
 
 	/* Wait max 1 s */
 	timeout = 1000;
@@ -433,7 +485,7 @@ static int sdhci_send_command_bounced(MmcCtrlr *mmc_ctrl, MmcCommand *cmd,
 			printf("Controller never released inhibit bit(s), "
 			       "present state %#8.8x.\n",
 			       sdhci_readl(host, SDHCI_PRESENT_STATE));
-			return MMC_COMM_ERR;
+			return 0;
 		}
 		timeout--;
 		udelay(1000);
@@ -468,15 +520,27 @@ static int sdhci_send_command_bounced(MmcCtrlr *mmc_ctrl, MmcCommand *cmd,
 		if (data->flags == MMC_DATA_READ)
 			mode |= SDHCI_TRNS_READ;
 
-		if (data->blocks > 1)
-			mode |= SDHCI_TRNS_BLK_CNT_EN |
-				SDHCI_TRNS_MULTI | SDHCI_TRNS_ACMD12;
+		if (data->blocks > 1) {
+			mode |= SDHCI_TRNS_BLK_CNT_EN | SDHCI_TRNS_MULTI;
+			if (sdhci_auto_cmd23(host, cmd)) {
+				u32 sbc = data->blocks;
+
+				if (host->packed_count)
+					sbc |= MMC_CMD23_ARG_PACKED;
+				sdhci_writel(host, sbc, SDHCI_ARGUMENT2);
+				mode |= SDHCI_TRNS_AUTO_CMD23;
+			} else {
+				mode |= SDHCI_TRNS_ACMD12;
+			}
+		}
 
 		sdhci_writew(host, data->blocks, SDHCI_BLOCK_COUNT);
 
 		if (host->host_caps & MMC_CAPS_AUTO_CMD12) {
-			if (sdhci_setup_adma(host, data, bbstate))
-				return -1;
+			/* Packed writes come with their chain already built */
+			if (!host->packed_count &&
+			    sdhci_setup_adma(host, data, bbstate))
+				return 0;
 
 			mode |= SDHCI_TRNS_DMA;
 		}
@@ -492,6 +556,24 @@ static int sdhci_send_command_bounced(MmcCtrlr *mmc_ctrl, MmcCommand *cmd,
 	sdhci_writel(host, cmd->cmdarg, SDHCI_ARGUMENT);
 	sdhci_writew(host, SDHCI_MAKE_CMD(cmd->cmdidx, flags), SDHCI_COMMAND);
 
+	return mask;
+}
+
+static int sdhci_send_command_bounced(MmcCtrlr *mmc_ctrl, MmcCommand *cmd,
+				      MmcData *data,
+				      struct bounce_buffer *bbstate)
+{
+	unsigned int stat = 0;
+	int ret = 0;
+	u32 mask;
+	unsigned int start_addr = 0;
+	uint64_t start;
+	SdhciHost *host = container_of(mmc_ctrl, SdhciHost, mmc_ctrlr);
+
+	mask = sdhci_start_command(host, cmd, data, bbstate);
+	if (!mask)
+		return MMC_COMM_ERR;
+
 	if (data && (host->host_caps & MMC_CAPS_AUTO_CMD12))
 		return sdhci_complete_adma(host, cmd);
 
@@ -539,6 +621,21 @@ static int sdhci_send_command_bounced(MmcCtrlr *mmc_ctrl, MmcCommand *cmd,
 		return MMC_COMM_ERR;
 }
 
+static void sdhci_async_poll(SdhciHost *host);
+
+/*
+ * With ADMA the descriptor chain can point at several pieces of memory, so
+ * only the partial cache lines around an unaligned buffer need bouncing.
+ */
+static int sdhci_bounce_start(SdhciHost *host, struct bounce_buffer *bbstate,
+			      void *buf, size_t len, unsigned int flags)
+{
+	if (host->host_caps & MMC_CAPS_AUTO_CMD12)
+		return bounce_buffer_start_split(bbstate, buf, len, flags,
+						 host->dma64 ? 8 : 4);
+	return bounce_buffer_start(bbstate, buf, len, flags);
+}
+
 static int sdhci_send_command(MmcCtrlr *mmc_ctrl, MmcCommand *cmd,
 			      MmcData *data)
 {
@@ -548,6 +645,11 @@ static int sdhci_send_command(MmcCtrlr *mmc_ctrl, MmcCommand *cmd,
 	struct bounce_buffer *bbstate = NULL;
 	struct bounce_buffer bbstate_val;
 	int ret;
+	SdhciHost *host = container_of(mmc_ctrl, SdhciHost, mmc_ctrlr);
+
+	/* The bus is busy until every queued request is through. */
+	while (host->async_req)
+		sdhci_async_poll(host);
 
 	if (data) {
 		if (data->flags & MMC_DATA_READ) {
@@ -566,7 +668,8 @@ static int sdhci_send_command(MmcCtrlr *mmc_ctrl, MmcCommand *cmd,
 		 */
 		if (!dma_coherent(buf)) {
 			bbstate = &bbstate_val;
-			if (bounce_buffer_start(bbstate, buf, len, bbflags)) {
+			if (sdhci_bounce_start(host, bbstate, buf, len,
+					       bbflags)) {
 				printf("ERROR: Failed to get bounce buffer.\n");
 				return -1;
 			}
@@ -581,6 +684,268 @@ static int sdhci_send_command(MmcCtrlr *mmc_ctrl, MmcCommand *cmd,
 	return ret;
 }
 
+/*
+ * Non-blocking counterpart of sdhci_complete_adma(). Returns 1 while the
+ * transfer is still running, otherwise the same as sdhci_complete_adma().
+ */
+static int sdhci_adma_poll(SdhciHost *host, MmcCommand *cmd, uint64_t start)
+{
+	u32 stat = sdhci_readl(host, SDHCI_INT_STATUS);
+
+	if (!(stat & (SDHCI_INT_ERROR | SDHCI_INT_ADMA_ERROR))) {
+		if (stat & SDHCI_INT_DATA_END) {
+			sdhci_writel(host, stat, SDHCI_INT_STATUS);
+			sdhci_cmd_done(host, cmd);
+			return 0;
+		}
+		/* Transfer should take 10 seconds tops. */
+		if (timer_us(start) < 10 * USECS_PER_SEC)
+			return 1;
+	}
+
+	printf("%s: transfer error, stat %#x, adma error %#x\n",
+	       __func__, stat, sdhci_readl(host, SDHCI_ADMA_ERROR));
+
+	sdhci_writel(host, stat, SDHCI_INT_STATUS);
+	sdhci_reset(host, SDHCI_RESET_CMD);
+	sdhci_reset(host, SDHCI_RESET_DATA);
+
+	if (stat & SDHCI_INT_TIMEOUT)
+		return MMC_TIMEOUT;
+	else
+		return MMC_COMM_ERR;
+}
+
+/*
+ * Send the write requests queued from first on as one eMMC packed write: a
+ * header block listing every request's CMD23/CMD25 arguments followed by
+ * their data, all in one ADMA chain, so the card sees a single command for
+ * the batch. Returns 1 if the packed write was started.
+ */
+static int sdhci_start_packed(SdhciHost *host, BlockDevRequest *first)
+{
+	MmcMedia *media = host->mmc_ctrlr.media;
+	MmcCommand *cmd = &host->async_cmd;
+	MmcData *data = &host->async_data;
+	uint32_t blocks = 1;	/* the header */
+	ListNode *node;
+	int i, n = 0;
+
+	cmd->cmdidx = MMC_CMD_WRITE_MULTIPLE_BLOCK;
+	if (media->max_packed_writes < 2 || media->write_bl_len != 512 ||
+	    !sdhci_auto_cmd23(host, cmd))
+		return 0;
+
+	for (node = &first->list_node; node; node = node->next) {
+		BlockDevRequest *req = container_of(node, BlockDevRequest,
+						    list_node);
+		if (n == media->max_packed_writes || !req->is_write ||
+		    req->submitted || req->status ||
+		    blocks + req->count > host->mmc_ctrlr.b_max ||
+		    !dma_coherent(req->buffer))
+			break;
+		host->packed[n++] = req;
+		blocks += req->count;
+	}
+	if (n < 2)
+		return 0;
+
+	if (!host->packed_hdr) {
+		host->packed_hdr = dma_malloc(512);
+		if (!host->packed_hdr)
+			return 0;
+	}
+	memset(host->packed_hdr, 0, 512);
+	host->packed_hdr[0] = htolel(MMC_PACKED_HDR(n));
+
+	sdhci_alloc_descs(host, blocks * 512 / SDHCI_MAX_PER_DESCRIPTOR +
+			  n + 1);
+	int desc = sdhci_adma_add(host, 0, (char *)host->packed_hdr, 512, 0);
+	for (i = 0; i < n; i++) {
+		BlockDevRequest *req = host->packed[i];
+		lba_t start = req->start;
+
+		host->packed_hdr[2 + 2 * i] = htolel(req->count);
+		host->packed_hdr[3 + 2 * i] = htolel(media->high_capacity ?
+						     start : start * 512);
+		desc = sdhci_adma_add(host, desc, req->buffer,
+				      req->count * 512, i == n - 1);
+	}
+	sdhci_set_adma_address(host);
+
+	cmd->cmdarg = media->high_capacity ? first->start : first->start * 512;
+	cmd->resp_type = MMC_RSP_R1;
+	cmd->flags = 0;
+
+	data->dest = NULL;
+	data->blocks = blocks;
+	data->blocksize = 512;
+	data->flags = MMC_DATA_WRITE;
+
+	host->packed_count = n;
+	host->async_bounced = 0;
+	if (!sdhci_start_command(host, cmd, data, NULL)) {
+		host->packed_count = 0;
+		return 0;
+	}
+
+	host->async_req = first;
+	host->async_start = timer_us(0);
+	for (i = 0; i < n; i++) {
+		host->packed[i]->submitted = host->packed[i]->count;
+		host->packed[i]->pending++;
+	}
+	return 1;
+}
+
+/* Start an ADMA transfer for the next chunk of the first unfinished request */
+static void sdhci_async_start(SdhciHost *host)
+{
+	MmcMedia *media = host->mmc_ctrlr.media;
+	BlockDevRequest *req = NULL;
+	ListNode *node;
+
+	for (node = host->requests.next; node; node = node->next) {
+		req = container_of(node, BlockDevRequest, list_node);
+		if (!req->status && req->submitted < req->count)
+			break;
+	}
+	if (!node)
+		return;
+
+	if (req->is_write && !req->submitted && sdhci_start_packed(host, req))
+		return;
+
+	uint32_t bl_len = req->is_write ? media->write_bl_len :
+					  media->read_bl_len;
+	uint32_t blocks = MIN(req->count - req->submitted,
+			      host->mmc_ctrlr.b_max);
+	lba_t start = req->start + req->submitted;
+	char *buf = (char *)req->buffer + req->submitted * bl_len;
+	MmcCommand *cmd = &host->async_cmd;
+	MmcData *data = &host->async_data;
+
+	if (req->is_write)
+		cmd->cmdidx = blocks > 1 ? MMC_CMD_WRITE_MULTIPLE_BLOCK :
+					   MMC_CMD_WRITE_SINGLE_BLOCK;
+	else
+		cmd->cmdidx = blocks > 1 ? MMC_CMD_READ_MULTIPLE_BLOCK :
+					   MMC_CMD_READ_SINGLE_BLOCK;
+	cmd->cmdarg = media->high_capacity ? start : start * bl_len;
+	cmd->resp_type = MMC_RSP_R1;
+	cmd->flags = 0;
+
+	data->dest = buf;
+	data->blocks = blocks;
+	data->blocksize = bl_len;
+	data->flags = req->is_write ? MMC_DATA_WRITE : MMC_DATA_READ;
+
+	host->async_bounced = !dma_coherent(buf);
+	if (host->async_bounced &&
+	    sdhci_bounce_start(host, &host->async_bb, buf, blocks * bl_len,
+			       req->is_write ? GEN_BB_READ : GEN_BB_WRITE)) {
+		printf("ERROR: Failed to get bounce buffer.\n");
+		req->status = -1;
+		return;
+	}
+
+	if (!sdhci_start_command(host, cmd, data, host->async_bounced ?
+				 &host->async_bb : NULL)) {
+		if (host->async_bounced)
+			bounce_buffer_stop(&host->async_bb);
+		req->status = -1;
+		return;
+	}
+
+	host->async_req = req;
+	host->async_start = timer_us(0);
+	req->submitted += blocks;
+	req->pending++;
+}
+
+static void sdhci_async_poll(SdhciHost *host)
+{
+	BlockDevRequest *req = host->async_req;
+
+	if (req) {
+		int ret = sdhci_adma_poll(host, &host->async_cmd,
+					  host->async_start);
+		if (ret == 1)
+			return;
+		if (host->async_bounced)
+			bounce_buffer_stop(&host->async_bb);
+		if (host->packed_count) {
+			for (int i = 0; i < host->packed_count; i++) {
+				if (ret)
+					host->packed[i]->status = -1;
+				host->packed[i]->pending--;
+			}
+			host->packed_count = 0;
+		} else {
+			if (ret)
+				req->status = -1;
+			req->pending--;
+		}
+		host->async_req = NULL;
+	}
+
+	/* Complete requests with nothing left to do */
+	ListNode *node = host->requests.next;
+	while (node) {
+		req = container_of(node, BlockDevRequest, list_node);
+		node = node->next;
+		if (req->pending)
+			continue;
+		if (!req->status && req->submitted < req->count)
+			continue;
+		list_remove(&req->list_node);
+		blockdev_complete(req, req->status);
+	}
+
+	sdhci_async_start(host);
+}
+
+static inline SdhciHost *sdhci_host(BlockDevOps *me)
+{
+	MmcMedia *media = container_of(me, MmcMedia, dev.ops);
+
+	return container_of(media->ctrlr, SdhciHost, mmc_ctrlr);
+}
+
+static int sdhci_submit(BlockDevOps *me, BlockDevRequest *req)
+{
+	SdhciHost *host = sdhci_host(me);
+	MmcMedia *media = host->mmc_ctrlr.media;
+
+	/*
+	 * The block length is set while the bus is idle; requests queued
+	 * behind others reuse it and only need the range check.
+	 */
+	if (!host->requests.next) {
+		if (!block_mmc_setup(me, req->start, req->count,
+				     !req->is_write))
+			return -1;
+	} else if (req->start + req->count > media->dev.block_count) {
+		return -1;
+	}
+
+	list_append(&req->list_node, &host->requests);
+	if (!host->async_req)
+		sdhci_async_start(host);
+	return 0;
+}
+
+static void sdhci_poll(BlockDevOps *me)
+{
+	sdhci_async_poll(sdhci_host(me));
+}
+
+/* A transfer already in flight is left to finish */
+static void sdhci_cancel(BlockDevOps *me, BlockDevRequest *req)
+{
+	req->status = -1;
+}
+
 static int sdhci_set_clock(MmcCtrlr *mmc_ctrlr, unsigned int clock)
 {
 	unsigned int div, clk, timeout;
@@ -1204,6 +1569,12 @@ static int sdhci_update(BlockDevCtrlrOps *me)
 	host->mmc_ctrlr.media->dev.ops.new_stream = new_simple_stream;
 	host->mmc_ctrlr.media->dev.ops.get_health_info =
 		block_mmc_get_health_info;
+	/* Asynchronous transfers need ADMA */
+	if (host->host_caps & MMC_CAPS_AUTO_CMD12) {
+		host->mmc_ctrlr.media->dev.ops.submit = sdhci_submit;
+		host->mmc_ctrlr.media->dev.ops.poll = sdhci_poll;
+		host->mmc_ctrlr.media->dev.ops.cancel = sdhci_cancel;
+	}
 
 	return 0;
 }
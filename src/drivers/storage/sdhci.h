@@ -31,6 +31,7 @@
  */
 
 #define SDHCI_DMA_ADDRESS	0x00
+#define SDHCI_ARGUMENT2		SDHCI_DMA_ADDRESS
 
 #define SDHCI_BLOCK_SIZE	0x04
 #define  SDHCI_MAKE_BLKSZ(dma, blksz) (((dma & 0x7) << 12) | (blksz & 0xFFF))
@@ -43,6 +44,7 @@
 #define  SDHCI_TRNS_DMA		0x01
 #define  SDHCI_TRNS_BLK_CNT_EN	0x02
 #define  SDHCI_TRNS_ACMD12	0x04
+#define  SDHCI_TRNS_AUTO_CMD23	0x08
 #define  SDHCI_TRNS_READ	0x10
 #define  SDHCI_TRNS_MULTI	0x20
 
@@ -271,6 +273,7 @@
 #define SDHCI_QUIRK_CAP_CLOCK_BASE_BROKEN (1 << 10)
 #define SDHCI_QUIRK_CLEAR_TRANSFER_BEFORE_CMD	(1 << 12)
 #define SDHCI_QUIRK_NEED_2X_CLK_FOR_DDR_MODE	(1 << 13)
+#define SDHCI_QUIRK_BROKEN_AUTO_CMD23		(1 << 14)
 
 /* JEDEC 84-B51A: The Device is guaranteed to complete a
  * sequence of 40 times CMD21 executions within 150ms. */
@@ -346,6 +349,22 @@ struct sdhci_host {
 	 */
 	GpioOps *cd_gpio;
 
+	/*
+	 * Asynchronous BlockDevOps state. Requests are served in order with
+	 * one ADMA transfer in flight at a time.
+	 */
+	ListNode requests;
+	BlockDevRequest *async_req;	/* request the transfer is for */
+	MmcCommand async_cmd;
+	MmcData async_data;
+	struct bounce_buffer async_bb;
+	int async_bounced;
+	uint64_t async_start;
+	/* Requests sharing the running transfer as one packed write. */
+	BlockDevRequest *packed[MMC_PACKED_MAX_ENTRIES];
+	int packed_count;
+	uint32_t *packed_hdr;
+
 	int (*attach)(SdhciHost *host);
 };
 
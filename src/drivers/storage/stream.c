@@ -0,0 +1,168 @@
+/*
+ * Copyright 2021 Google Inc.
+ *
+ * See file CREDITS for list of people who contributed to this
+ * project.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but without any warranty; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <libpayload.h>
+
+#include "base/container_of.h"
+#include "drivers/storage/stream.h"
+
+/* Readahead window used when the device doesn't suggest one. */
+#define STREAM_DEFAULT_WINDOW	(128 * KiB)
+
+typedef struct {
+	StreamOps stream;
+	StreamOps *raw;
+	uint64_t left;		/* bytes still to be read from raw */
+	uint32_t align;
+	uint32_t window;
+	uint8_t *buf;
+	uint32_t buf_pos;
+	uint32_t buf_len;
+} BufferedStream;
+
+/*
+ * Read count bytes from the raw stream, return how many arrived. func, if
+ * given, sees them as they come in.
+ */
+static uint64_t buffered_stream_raw_read(BufferedStream *stream,
+					 uint64_t count, void *dest,
+					 StreamDataFunc func, void *arg)
+{
+	uint64_t got;
+
+	if (func)
+		got = stream_read_observed(stream->raw, count, dest, func,
+					   arg);
+	else
+		got = stream->raw->read(stream->raw, count, dest);
+
+	/* Raw streams report errors as 0 or as a negative errno. */
+	if (got > count)
+		got = 0;
+	stream->left -= got;
+	return got;
+}
+
+static uint64_t buffered_stream_read_observed(StreamOps *me, uint64_t count,
+					      void *buffer,
+					      StreamDataFunc func, void *arg)
+{
+	BufferedStream *stream = container_of(me, BufferedStream, stream);
+	uint8_t *dest = buffer;
+	uint64_t done = 0;
+
+	while (done < count) {
+		uint64_t want = count - done;
+
+		/* Hand out what's left of the last window first. */
+		if (stream->buf_pos < stream->buf_len) {
+			uint64_t n = MIN(want,
+					 stream->buf_len - stream->buf_pos);
+			memcpy(dest + done, stream->buf + stream->buf_pos, n);
+			if (func)
+				func(arg, dest + done, n);
+			stream->buf_pos += n;
+			done += n;
+			continue;
+		}
+
+		if (!stream->left)
+			break;
+
+		/*
+		 * Requests of at least a window go straight into the
+		 * caller's buffer, only the unaligned tail gets buffered.
+		 */
+		uint64_t direct = ALIGN_DOWN(MIN(want, stream->left),
+					     stream->align);
+		if (direct >= stream->window) {
+			uint64_t got = buffered_stream_raw_read(stream, direct,
+								dest + done,
+								func, arg);
+			done += got;
+			if (got != direct)
+				break;
+			continue;
+		}
+
+		/* Refill the window. */
+		if (!stream->buf)
+			stream->buf = xmemalign(ARCH_DMA_MINALIGN,
+						stream->window);
+		uint64_t fill = MIN(stream->window, stream->left);
+		stream->buf_pos = 0;
+		stream->buf_len = buffered_stream_raw_read(stream, fill,
+							   stream->buf,
+							   NULL, NULL);
+		if (!stream->buf_len)
+			break;
+	}
+
+	if (done != count)
+		printf("Buffered stream read short, %lld of %lld bytes\n",
+		       done, count);
+	return done;
+}
+
+static uint64_t buffered_stream_read(StreamOps *me, uint64_t count,
+				     void *buffer)
+{
+	return buffered_stream_read_observed(me, count, buffer, NULL, NULL);
+}
+
+static void buffered_stream_close(StreamOps *me)
+{
+	BufferedStream *stream = container_of(me, BufferedStream, stream);
+
+	stream->raw->close(stream->raw);
+	free(stream->buf);
+	free(stream);
+}
+
+StreamOps *new_buffered_stream(StreamOps *raw, uint64_t size, uint32_t align,
+			       uint64_t window)
+{
+	if (!raw)
+		return NULL;
+
+	BufferedStream *stream = xzalloc(sizeof(*stream));
+	stream->raw = raw;
+	stream->left = size;
+	stream->align = align;
+
+	if (!window)
+		window = STREAM_DEFAULT_WINDOW;
+	window = MIN(window, STREAM_MAX_WINDOW);
+	stream->window = MAX(ALIGN_DOWN(window, align), align);
+
+	stream->stream.read = buffered_stream_read;
+	stream->stream.close = buffered_stream_close;
+	stream->stream.read_observed = buffered_stream_read_observed;
+	return &stream->stream;
+}
+
+uint64_t stream_read_observed(StreamOps *stream, uint64_t count, void *buffer,
+			      StreamDataFunc func, void *arg)
+{
+	if (stream->read_observed)
+		return stream->read_observed(stream, count, buffer, func, arg);
+
+	uint64_t got = stream->read(stream, count, buffer);
+	if (got && got <= count)
+		func(arg, buffer, got);
+	return got;
+}
@@ -27,10 +27,21 @@
  * the underlying medium and the size found in practice may be smaller,
  * e.g., due to skipping bad blocks on NAND.
  */
+typedef void (*StreamDataFunc)(void *arg, const void *data, uint64_t size);
+
 typedef struct StreamOps {
 	uint64_t (*read)(struct StreamOps *me, uint64_t count,
 			 void *buffer);
 	void (*close)(struct StreamOps *me);
+	/*
+	 * Optional. Like read, but hands each piece of buffer to func, in
+	 * order, as soon as it has arrived, while the device already works
+	 * on the next piece. Use stream_read_observed(), which falls back to
+	 * read when this is missing.
+	 */
+	uint64_t (*read_observed)(struct StreamOps *me, uint64_t count,
+				  void *buffer, StreamDataFunc func,
+				  void *arg);
 } StreamOps;
 
 /* Lazily initialized representation of a device; factory for streams to
@@ -44,5 +55,27 @@ typedef struct StreamCtrlr {
 	uint64_t (*size)(struct StreamCtrlr *me);
 } StreamCtrlr;
 
+/* Largest readahead window a buffered stream uses, so that a device hint
+ * can't eat too much of the heap. */
+#define STREAM_MAX_WINDOW	(1024 * 1024)
+
+/*
+ * Wrap a raw stream that can only read multiples of align bytes so that it
+ * accepts reads of any size. Small reads are served from a readahead window
+ * of the given size (0 picks a default), large ones bypass it. size is the
+ * number of bytes the raw stream can return. Closing the buffered stream
+ * also closes the raw one.
+ */
+StreamOps *new_buffered_stream(StreamOps *raw, uint64_t size, uint32_t align,
+			       uint64_t window);
+
+/*
+ * Read count bytes into buffer and pass what arrived to func, piece by piece
+ * on streams that can overlap the two. Returns the number of bytes read,
+ * all of which have been passed to func.
+ */
+uint64_t stream_read_observed(StreamOps *stream, uint64_t count, void *buffer,
+			      StreamDataFunc func, void *arg);
+
 #endif /* __DRIVERS_STORAGE_STREAM_H__ */
 
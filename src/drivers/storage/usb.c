@@ -23,6 +23,7 @@
 
 #include "base/init_funcs.h"
 #include "drivers/bus/usb/usb.h"
+#include "drivers/storage/blockcache.h"
 #include "drivers/storage/blockdev.h"
 #include "drivers/storage/usb.h"
 
@@ -37,11 +38,25 @@ typedef struct UsbDrive {
 // unlikely in practice that we can stomach the memory leak in that case.
 static UsbDrive *remove_me = NULL;
 
+/* Preferred size of a single transfer. */
+#define USB_XFER_BYTES	MiB
+
+/* libpayload takes the block range as int and can't address beyond it. */
+static int dc_usb_range_ok(UsbDrive *drive, lba_t start, lba_t count)
+{
+	if (start + count <= INT32_MAX)
+		return 1;
+	printf("%s: blocks %llu+%llu beyond the addressable range\n",
+	       drive->dev.name, start, count);
+	return 0;
+}
+
 static lba_t dc_usb_read(BlockDevOps *me, lba_t start, lba_t count,
 			 void *buffer)
 {
 	UsbDrive *drive = container_of(me, UsbDrive, dev.ops);
-	if (!drive->udev || readwrite_blocks(drive->udev, start, count,
+	if (!drive->udev || !dc_usb_range_ok(drive, start, count) ||
+	    readwrite_blocks(drive->udev, start, count,
 			cbw_direction_data_in, buffer))
 		return 0;
 	else
@@ -52,7 +67,8 @@ static lba_t dc_usb_write(BlockDevOps *me, lba_t start, lba_t count,
 			  const void *buffer)
 {
 	UsbDrive *drive = container_of(me, UsbDrive, dev.ops);
-	if (!drive->udev || readwrite_blocks(drive->udev, start, count,
+	if (!drive->udev || !dc_usb_range_ok(drive, start, count) ||
+	    readwrite_blocks(drive->udev, start, count,
 			cbw_direction_data_out, (void *)buffer))
 		return 0;
 	else
@@ -73,7 +89,11 @@ void usbdisk_create(usbdev_t *dev)
 	drive->dev.removable = 1;
 	drive->dev.block_size = msc->blocksize;
 	drive->dev.block_count = msc->numblocks;
+	/* Every bulk-only command costs a CBW/CSW round trip, so have
+	 * streams read ahead in large transfers. */
+	drive->dev.readahead_blocks = MAX(USB_XFER_BYTES / msc->blocksize, 1);
 	drive->udev = dev;
+	blockcache_enable(&drive->dev, 1);
 
 	msc->data = drive;
 
@@ -89,6 +109,7 @@ void usbdisk_remove(usbdev_t *dev)
 	assert(drive);
 
 	list_remove(&drive->dev.list_node);
+	blockcache_drop(&drive->dev);
 	printf("Removed %s.\n", drive->dev.name);
 	remove_me = drive;
 	drive->udev = NULL;
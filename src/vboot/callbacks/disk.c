@@ -21,6 +21,7 @@
 #include <vboot_api.h>
 
 #include "base/timestamp.h"
+#include "drivers/storage/blockcache.h"
 #include "drivers/storage/blockdev.h"
 #include "drivers/storage/stream.h"
 
@@ -81,8 +82,8 @@ vb2_error_t VbExDiskFreeInfo(VbDiskInfo *infos,
 vb2_error_t VbExDiskRead(VbExDiskHandle_t handle, uint64_t lba_start,
 			 uint64_t lba_count, void *buffer)
 {
-	BlockDevOps *ops = &((BlockDev *)handle)->ops;
-	if (ops->read(ops, lba_start, lba_count, buffer) != lba_count) {
+	BlockDev *bdev = (BlockDev *)handle;
+	if (blockcache_read(bdev, lba_start, lba_count, buffer) != lba_count) {
 		printf("Read failed.\n");
 		return VB2_ERROR_UNKNOWN;
 	}
@@ -92,8 +93,8 @@ vb2_error_t VbExDiskRead(VbExDiskHandle_t handle, uint64_t lba_start,
 vb2_error_t VbExDiskWrite(VbExDiskHandle_t handle, uint64_t lba_start,
 			  uint64_t lba_count, const void *buffer)
 {
-	BlockDevOps *ops = &((BlockDev *)handle)->ops;
-	if (ops->write(ops, lba_start, lba_count, buffer) != lba_count) {
+	BlockDev *bdev = (BlockDev *)handle;
+	if (blockcache_write(bdev, lba_start, lba_count, buffer) != lba_count) {
 		printf("Write failed.\n");
 		return VB2_ERROR_UNKNOWN;
 	}
@@ -115,15 +116,19 @@ vb2_error_t VbExStreamOpen(VbExDiskHandle_t handle, uint64_t lba_start,
 vb2_error_t VbExStreamRead(VbExStream_t stream, uint32_t bytes, void *buffer)
 {
 	StreamOps *dev = (StreamOps *)stream;
+
+	// Vboot first reads some headers from the front of the kernel partition
+	// and then the whole kernel body in one call. We assume that any read
+	// larger than 1MB is the kernel body, and thus the last read.
+	if (bytes > MiB)
+		timestamp_add_now(TS_VB_READ_KERNEL_START);
+
 	int ret = dev->read(dev, bytes, buffer);
 	if (ret != bytes) {
 		printf("Stream read failed.\n");
 		return VB2_ERROR_UNKNOWN;
 	}
 
-	// Vboot first reads some headers from the front of the kernel partition
-	// and then the whole kernel body in one call. We assume that any read
-	// larger than 1MB is the kernel body, and thus the last read.
 	if (bytes > MiB)
 		timestamp_add_now(TS_VB_READ_KERNEL_DONE);
 